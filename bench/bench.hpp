@@ -0,0 +1,79 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+// Host benchmarks run against the mock firmware. Firmware services are the
+// mock's host implementations, so they stand in for the call overhead of a
+// service rather than for the speed of any real firmware.
+
+#include <chrono>
+#include <cstdio>
+
+#include "efi/boot_services.hpp"
+
+namespace efi::bench {
+
+constexpr auto min_duration = std::chrono::milliseconds{50};
+
+// Runs f until min_duration passed, returns the seconds per call. Calls are
+// timed in doubling batches so reading the clock stays out of the result.
+template <typename F>
+auto seconds_per_call(F&& f) -> double {
+  using clock = std::chrono::steady_clock;
+
+  f();
+  auto       calls = uint64_t{0};
+  auto       batch = uint64_t{1};
+  const auto start = clock::now();
+  auto       now   = start;
+  do {
+    for (auto i = uint64_t{0}; i < batch; ++i) {
+      f();
+    }
+    calls += batch;
+    batch *= 2;
+    now    = clock::now();
+  } while (now - start < min_duration);
+
+  return std::chrono::duration<double>(now - start).count() /
+         static_cast<double>(calls);
+}
+
+// In GB/s
+template <typename F>
+auto throughput(uintn_t bytes, F&& f) -> double {
+  return static_cast<double>(bytes) / seconds_per_call(f) / 1e9;
+}
+
+inline void print_size(uintn_t bytes) {
+  if (bytes >= (uintn_t{1} << 20)) {
+    std::printf("%6zu MiB", static_cast<size_t>(bytes >> 20));
+  } else if (bytes >= (uintn_t{1} << 10)) {
+    std::printf("%6zu KiB", static_cast<size_t>(bytes >> 10));
+  } else {
+    std::printf("%6zu B  ", static_cast<size_t>(bytes));
+  }
+}
+
+void memory(BootServices* boot_services);
+void crc32(BootServices* boot_services);
+void fiber(BootServices* boot_services);
+
+}  // namespace efi::bench
@@ -0,0 +1,65 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <vector>
+
+#include "bench.hpp"
+#include "efi/crc32.hpp"
+
+namespace efi::bench {
+
+namespace {
+
+constexpr auto min_size = uintn_t{64};
+constexpr auto max_size = uintn_t{16} << 20;
+
+// Keeps the results alive so the kernels are not optimized out
+volatile uint32_t sink = 0;
+
+}  // namespace
+
+// calculate_crc32 against the Crc32 kernels the cpu supports, from 64B to
+// 16MiB in steps of 4
+void crc32(BootServices* boot_services) {
+  const auto pclmul = Crc32::detect() == Crc32Kernel::Pclmul;
+
+  auto        data  = std::vector<uint8_t>(max_size);
+  const auto* bytes = data.data();
+  for (auto i = uintn_t{0}; i < data.size(); ++i) {
+    data[i] = static_cast<uint8_t>(i * 31);
+  }
+
+  std::printf("\ncrc32, GB/s\n      size    firmware    slicing8");
+  std::printf(pclmul ? "      pclmul\n" : "\n");
+  for (auto size = min_size; size <= max_size; size *= 4) {
+    print_size(size);
+    std::printf("  %10.2f", throughput(size, [&] {
+                  auto crc = uint32_t{0};
+                  boot_services->calculate_crc32(bytes, size, &crc);
+                  sink = crc;
+                }));
+    std::printf("  %10.2f", throughput(size, [&] {
+                  sink = Crc32::update_slicing8(~uint32_t{0}, bytes, size);
+                }));
+    if (pclmul) {
+      std::printf("  %10.2f", throughput(size, [&] {
+                    sink = Crc32::update_pclmul(~uint32_t{0}, bytes, size);
+                  }));
+    }
+    std::printf("\n");
+  }
+}
+
+}  // namespace efi::bench
@@ -0,0 +1,66 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <memory>
+#include <vector>
+
+#include "bench.hpp"
+#include "efi/fiber.hpp"
+
+namespace efi::bench {
+
+namespace {
+
+constexpr auto yields = uint64_t{1} << 18;
+
+void yield_loop(FiberScheduler* scheduler, void* /*context*/) noexcept {
+  for (auto i = uint64_t{0}; i < yields; ++i) {
+    scheduler->yield();
+  }
+}
+
+// Seconds per yield with count fibers taking turns. A yield switches into
+// the scheduler and from there into the next fiber.
+auto seconds_per_yield(BootServices* boot_services, uintn_t count) -> double {
+  using clock = std::chrono::steady_clock;
+
+  auto scheduler = FiberScheduler{boot_services};
+  auto fibers    = std::vector<std::unique_ptr<Fiber>>{};
+  for (auto i = uintn_t{0}; i < count; ++i) {
+    fibers.push_back(std::make_unique<Fiber>(&yield_loop, nullptr));
+    if (scheduler.spawn(fibers.back().get()) != Status::Success) {
+      return 0;
+    }
+  }
+
+  const auto start = clock::now();
+  scheduler.run();
+  const auto elapsed = std::chrono::duration<double>(clock::now() - start);
+  return elapsed.count() / static_cast<double>(yields * count);
+}
+
+}  // namespace
+
+// Cost of a round trip through the scheduler, from 1 to max_fibers fibers
+void fiber(BootServices* boot_services) {
+  std::printf("\nfiber yield, ns\n    fibers       yield\n");
+  for (auto count = uintn_t{1}; count <= FiberScheduler::max_fibers;
+       count *= 2) {
+    std::printf("%10zu  %10.2f\n", static_cast<size_t>(count),
+                seconds_per_yield(boot_services, count) * 1e9);
+  }
+}
+
+}  // namespace efi::bench
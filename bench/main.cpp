@@ -0,0 +1,28 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include "bench.hpp"
+#include "efi/mock/firmware.hpp"
+
+auto main() -> int {
+  auto  fw = efi::mock::Firmware{};
+  auto* bs = fw.boot_services();
+
+  efi::bench::memory(bs);
+  efi::bench::crc32(bs);
+  efi::bench::fiber(bs);
+
+  return 0;
+}
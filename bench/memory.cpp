@@ -0,0 +1,87 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <vector>
+
+#include "bench.hpp"
+#include "efi/platform/x64_memory.hpp"
+
+namespace efi::bench {
+
+namespace {
+
+constexpr auto min_size = uintn_t{64};
+constexpr auto max_size = uintn_t{64} << 20;
+
+void print_header(const char* title, bool avx2) {
+  std::printf("\n%s, GB/s\n      size    firmware   rep movsb        sse2",
+              title);
+  std::printf(avx2 ? "        avx2\n" : "\n");
+}
+
+}  // namespace
+
+// copy_mem / set_mem against every MemoryKernels kernel the cpu supports,
+// from 64B to 64MiB in steps of 4
+void memory(BootServices* boot_services) {
+  const auto avx2 = MemoryKernels::detect() == MemoryKernel::Avx2;
+
+  auto source      = std::vector<uint8_t>(max_size, 0x5a);
+  auto destination = std::vector<uint8_t>(max_size);
+  auto* to         = destination.data();
+  const auto* from = source.data();
+
+  print_header("copy", avx2);
+  for (auto size = min_size; size <= max_size; size *= 4) {
+    print_size(size);
+    std::printf("  %10.2f", throughput(size, [&] {
+                  boot_services->copy_mem(to, from, size);
+                }));
+    std::printf("  %10.2f", throughput(size, [&] {
+                  MemoryKernels::copy_rep_movsb(to, from, size);
+                }));
+    std::printf("  %10.2f", throughput(size, [&] {
+                  MemoryKernels::copy_sse2(to, from, size);
+                }));
+    if (avx2) {
+      std::printf("  %10.2f", throughput(size, [&] {
+                    MemoryKernels::copy_avx2(to, from, size);
+                  }));
+    }
+    std::printf("\n");
+  }
+
+  print_header("set", avx2);
+  for (auto size = min_size; size <= max_size; size *= 4) {
+    print_size(size);
+    std::printf("  %10.2f", throughput(size, [&] {
+                  boot_services->set_mem(to, size, 0xa5);
+                }));
+    std::printf("  %10.2f", throughput(size, [&] {
+                  MemoryKernels::set_rep_stosb(to, 0xa5, size);
+                }));
+    std::printf("  %10.2f", throughput(size, [&] {
+                  MemoryKernels::set_sse2(to, 0xa5, size);
+                }));
+    if (avx2) {
+      std::printf("  %10.2f", throughput(size, [&] {
+                    MemoryKernels::set_avx2(to, 0xa5, size);
+                  }));
+    }
+    std::printf("\n");
+  }
+}
+
+}  // namespace efi::bench
@@ -26,6 +26,11 @@ namespace efi {
 
 using EventNotify = void(EFI_CALL*)(Event event, void* context) noexcept;
 
+constexpr auto TplApplication = TPL{4};
+constexpr auto TplCallback    = TPL{8};
+constexpr auto TplNotify      = TPL{16};
+constexpr auto TplHighLevel   = TPL{31};
+
 enum class AllocateType {
   AnyPages,
   MaxAddress,
@@ -39,10 +44,12 @@ enum class EventType : uint32_t {
   NotifyWait                        = 0x00000100,
   NotifySignal                      = 0x00000200,
 
-  SignalExitSimpleTextInputProtocol = 0x00000201,
+  SignalExitBootServices            = 0x00000201,
   SignalVirtualAddressChange        = 0x60000202
 };
 
+ENUM_FLAGS(EventType);
+
 enum class LocateSearchType {
   AllHandles,
   ByRegisterNotify,
@@ -65,6 +72,39 @@ class MemoryDescriptor {
   VirtualAddress virtual_start_;
   uint64_t number_of_pages_;
   uint64_t attribute_;
+
+  friend class MemoryMapView;
+
+ public:
+  NODISCARD auto type() const noexcept {
+    return type_;
+  }
+
+  NODISCARD auto physical_start() const noexcept {
+    return physical_start_;
+  }
+
+  // One past the last byte of the range
+  NODISCARD auto physical_end() const noexcept {
+    return physical_start_ + number_of_pages_ * page_size;
+  }
+
+  NODISCARD auto virtual_start() const noexcept {
+    return virtual_start_;
+  }
+
+  NODISCARD auto number_of_pages() const noexcept {
+    return number_of_pages_;
+  }
+
+  NODISCARD auto attribute() const noexcept {
+    return attribute_;
+  }
+
+  NODISCARD auto contains(PhysicalAddress address) const noexcept {
+    return address >= physical_start_ &&
+           address - physical_start_ < number_of_pages_ * page_size;
+  }
 };
 
 class OpenProtocolInformationEntry {
@@ -292,6 +332,8 @@ class BootServices final : public Table {
 
   const CreateEventExFn create_event_ex_;
 
+  friend class Tracer;
+
  public:
   BootServices()                                       = delete;
   BootServices(BootServices&&)                         = delete;
@@ -320,6 +362,16 @@ class BootServices final : public Table {
     return create_event_(type, notify_tpl, notify_function, context, event);
   }
 
+  // Joins the event to event_group, signaling any event of a group signals
+  // all of them. A null event_group behaves like create_event.
+  FORCE_INLINE auto create_event_ex(EventType type, TPL notify_tpl,
+                                    EventNotify notify_function, void* context,
+                                    const Guid* event_group,
+                                    Event*      event) noexcept {
+    return create_event_ex_(type, notify_tpl, notify_function, context,
+                            event_group, event);
+  }
+
   FORCE_INLINE auto close_event(Event event) noexcept {
     return close_event_(event);
   }
@@ -409,6 +461,27 @@ class BootServices final : public Table {
 
 #pragma region Protocols
 
+  // Creates a new handle when *handle is null
+  FORCE_INLINE auto install_protocol_interface(Handle* handle,
+                                               const Guid& protocol,
+                                               const void* interface) noexcept {
+    return install_protocol_interface_(handle, &protocol,
+                                       InterfaceType::Native, interface);
+  }
+
+  // Frees the handle along with its last interface
+  FORCE_INLINE auto uninstall_protocol_interface(
+      Handle handle, const Guid& protocol, const void* interface) noexcept {
+    return uninstall_protocol_interface_(handle, &protocol, interface);
+  }
+
+  // Signals event whenever an interface for protocol is installed or
+  // reinstalled, uninstalls are not reported
+  FORCE_INLINE auto register_protocol_notify(const Guid& protocol, Event event,
+                                             void** registration) noexcept {
+    return register_protocol_notify_(&protocol, event, registration);
+  }
+
   FORCE_INLINE auto locate_handle(LocateSearchType search_type,
                                   const Guid& protocol, const void* search_key,
                                   uintn_t* buffer_size,
@@ -425,7 +498,8 @@ class BootServices final : public Table {
   template <IsProtocol Protocol>
   FORCE_INLINE auto handle_protocol(Handle handle,
                                     Protocol** interface) noexcept {
-    return handle_protocol_(handle, Protocol::Guid, interface);
+    return handle_protocol_(handle, Protocol::guid,
+                            reinterpret_cast<void**>(interface));
   }
 
   FORCE_INLINE auto locate_device_path(const Guid& protocol,
@@ -437,7 +511,7 @@ class BootServices final : public Table {
   template <IsProtocol Protocol>
   FORCE_INLINE auto locate_device_path(DevicePathProtocol** device_path,
                                        Handle* device) noexcept {
-    return locate_device_path_(Protocol::Guid, device_path, device);
+    return locate_device_path_(Protocol::guid, device_path, device);
   }
 
   FORCE_INLINE auto open_protocol(Handle handle, const Guid& protocol,
@@ -452,7 +526,8 @@ class BootServices final : public Table {
   FORCE_INLINE auto open_protocol(Handle handle, Protocol** interface,
                                   Handle agent_handle, Handle controller_handle,
                                   OpenProtocolAttribute attributes) noexcept {
-    return open_protocol_(handle, Protocol::Guid, interface, agent_handle,
+    return open_protocol_(handle, Protocol::guid,
+                          reinterpret_cast<void**>(interface), agent_handle,
                           controller_handle, attributes);
   }
 
@@ -465,7 +540,7 @@ class BootServices final : public Table {
   template <IsProtocol Protocol>
   FORCE_INLINE auto close_protocol(Handle handle, Handle agent_handle,
                                    Handle controller_handle) noexcept {
-    return close_protocol_(handle, Protocol::Guid, agent_handle,
+    return close_protocol_(handle, Protocol::guid, agent_handle,
                            controller_handle);
   }
 
@@ -501,7 +576,7 @@ class BootServices final : public Table {
   template <IsProtocol Protocol>
   FORCE_INLINE auto locate_handle_buffer(uintn_t* num_handles,
                                          Handle** buffer) noexcept {
-    return locate_handle_buffer_(LocateSearchType::ByProtocol, &Protocol::Guid,
+    return locate_handle_buffer_(LocateSearchType::ByProtocol, &Protocol::guid,
                                  nullptr, num_handles, buffer);
   }
 
@@ -520,7 +595,8 @@ class BootServices final : public Table {
 
   template <IsProtocol Protocol>
   FORCE_INLINE auto locate_protocol(Protocol** interface) noexcept {
-    return locate_protocol_(Protocol::Guid, nullptr, interface);
+    return locate_protocol_(Protocol::guid, nullptr,
+                            reinterpret_cast<void**>(interface));
   }
 
 #pragma endregion
@@ -572,6 +648,33 @@ class BootServices final : public Table {
   static constexpr uint64_t Signature = 0x56524553544f4f42;
 };
 
+// Raises the TPL for the lifetime of the guard. Code at a raised TPL can not
+// be preempted by notify functions at or below it.
+class TplGuard final {
+ private:
+  BootServices* const boot_services_;
+  const TPL           previous_;
+
+ public:
+  TplGuard(BootServices* boot_services, TPL tpl) noexcept
+      : boot_services_{boot_services},
+        previous_{boot_services->raise_tpl(tpl)} {}
+
+  ~TplGuard() {
+    boot_services_->restore_tpl(previous_);
+  }
+
+  TplGuard()                                   = delete;
+  TplGuard(TplGuard&&)                         = delete;
+  TplGuard(const TplGuard&)                    = delete;
+  auto operator=(TplGuard&&) -> TplGuard&      = delete;
+  auto operator=(const TplGuard&) -> TplGuard& = delete;
+
+  NODISCARD auto previous() const noexcept {
+    return previous_;
+  }
+};
+
 static const Event TimerEvent =
     reinterpret_cast<Event>(static_cast<uintptr_t>(0x80000000));
 static const Event RuntimeEvent =
@@ -589,4 +692,48 @@ static const Event SignalExitBootServicesEvent =
 static const Event SignalVirtualAddressChangeEvent =
     reinterpret_cast<Event>(static_cast<uintptr_t>(0x60000202));
 
+// Event groups defined by the specification, for create_event_ex
+
+constexpr auto EventGroupExitBootServices =
+    Guid{0x27abf055,
+         0xb1b8,
+         0x4c26,
+         {0x80, 0x48, 0x74, 0x8f, 0x37, 0xba, 0xa2, 0xdf}};
+
+constexpr auto EventGroupBeforeExitBootServices =
+    Guid{0x8be0e274,
+         0x3970,
+         0x4b44,
+         {0x80, 0xc5, 0x1a, 0xb9, 0x50, 0x2f, 0x3b, 0xfc}};
+
+constexpr auto EventGroupVirtualAddressChange =
+    Guid{0x13fa7698,
+         0xc831,
+         0x49c7,
+         {0x87, 0xea, 0x8f, 0x43, 0xfc, 0xc2, 0x51, 0x96}};
+
+constexpr auto EventGroupMemoryMapChange =
+    Guid{0x78bee926,
+         0x692f,
+         0x48fd,
+         {0x9e, 0xdb, 0x01, 0x42, 0x2e, 0xf0, 0xd7, 0xab}};
+
+constexpr auto EventGroupReadyToBoot =
+    Guid{0x7ce88fb3,
+         0x4bd7,
+         0x4679,
+         {0x87, 0xa8, 0xa8, 0xd8, 0xde, 0xe5, 0x0d, 0x2b}};
+
+constexpr auto EventGroupAfterReadyToBoot =
+    Guid{0x3a2a00ad,
+         0x98b9,
+         0x4cdf,
+         {0xa4, 0x78, 0x70, 0x27, 0x77, 0xf1, 0xc1, 0x0b}};
+
+constexpr auto EventGroupResetSystem =
+    Guid{0x62da6a56,
+         0x13fb,
+         0x485a,
+         {0xa8, 0xda, 0xa3, 0xdd, 0x79, 0x12, 0xcb, 0x6b}};
+
 }  // namespace efi
\ No newline at end of file
@@ -0,0 +1,168 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <chrono>
+
+#include "boot_services.hpp"
+#include "platform/x64.hpp"
+
+namespace efi {
+
+// Monotonic clock over the time stamp counter, usable as a std::chrono clock
+// and after exit_boot_services.
+//
+// The TSC frequency is measured once against a firmware timer event or the
+// ACPI PM timer. Until then now() stays at the epoch. Readings are only
+// steady across cores and power states when invariant_tsc() holds.
+class Clock final {
+ public:
+  using rep        = int64_t;
+  using period     = std::nano;
+  using duration   = std::chrono::nanoseconds;
+  using time_point = std::chrono::time_point<Clock>;
+
+  static constexpr bool is_steady = true;
+
+  // 50ms in 100ns units
+  static constexpr auto default_window = uint64_t{500'000};
+
+  static constexpr auto pm_timer_frequency = uint64_t{3'579'545};
+
+ private:
+  static inline uint64_t frequency_ = 0;
+
+  // Nanoseconds per cycle in 32.32 fixed point
+  static inline uint64_t scale_ = 0;
+
+ public:
+  Clock()                                = delete;
+  Clock(Clock&&)                         = delete;
+  Clock(const Clock&)                    = delete;
+  ~Clock()                               = delete;
+  auto operator=(Clock&&) -> Clock&      = delete;
+  auto operator=(const Clock&) -> Clock& = delete;
+
+  NODISCARD static auto now() noexcept -> time_point {
+    return time_point{duration{static_cast<rep>(nanoseconds(read_tsc()))}};
+  }
+
+  NODISCARD static auto nanoseconds(uint64_t cycles) noexcept -> uint64_t {
+    // cycles * scale_ >> 32 without a 128 bit product
+    return (cycles >> 32) * scale_ +
+           (((cycles & 0xffff'ffff) * scale_) >> 32);
+  }
+
+  NODISCARD static auto microseconds(uint64_t cycles) noexcept -> uint64_t {
+    return nanoseconds(cycles) / 1'000;
+  }
+
+  // Cycles per second, 0 until calibrated
+  NODISCARD static auto frequency() noexcept {
+    return frequency_;
+  }
+
+  NODISCARD static auto calibrated() noexcept {
+    return frequency_ != 0;
+  }
+
+  NODISCARD static auto invariant_tsc() noexcept -> bool {
+    constexpr auto invariant_bit = uint32_t{1} << 8;
+    return cpuid(0x8000'0000).eax >= 0x8000'0007 &&
+           (cpuid(0x8000'0007).edx & invariant_bit) != 0;
+  }
+
+  // For a frequency known from elsewhere, such as cpuid leaf 0x15
+  static void set_frequency(uint64_t frequency) noexcept {
+    frequency_ = frequency;
+    scale_     = frequency != 0 ? (uint64_t{1'000'000'000} << 32) / frequency
+                                : 0;
+  }
+
+  // Counts cycles across one period of a periodic timer event, starting on a
+  // tick edge so the firmware timer granularity does not skew the result.
+  // window is in 100ns units and must be called at TPL_APPLICATION.
+  static auto calibrate(BootServices* boot_services,
+                        uint64_t      window = default_window) noexcept
+      -> Status {
+    if (boot_services == nullptr || window == 0) {
+      return Status::InvalidParameter;
+    }
+
+    auto event  = Event{};
+    auto status = boot_services->create_event(EventType::Timer, TplCallback,
+                                              nullptr, nullptr, &event);
+    if (status != Status::Success) {
+      return status;
+    }
+
+    status = boot_services->set_timer(event, TimerDelay::Periodic, window);
+
+    auto index = uintn_t{0};
+    auto start = uint64_t{0};
+    if (status == Status::Success) {
+      status = boot_services->wait_for_events(1, &event, &index);
+      start  = read_tsc();
+    }
+    if (status == Status::Success) {
+      status = boot_services->wait_for_events(1, &event, &index);
+    }
+    const auto end = read_tsc();
+
+    boot_services->close_event(event);
+    if (status != Status::Success) {
+      return status;
+    }
+
+    set_frequency((end - start) * 10'000'000 / window);
+    return Status::Success;
+  }
+
+  // Counts cycles across window ticks of the ACPI PM timer at port, taken
+  // from the FADT. Only the low 24 bits are used so either counter width
+  // works, window is limited to half the 24 bit range, about 2.3 seconds.
+  static auto calibrate_pm_timer(uint16_t port, uint32_t window) noexcept
+      -> Status {
+    constexpr auto counter_mask = uint32_t{0x00ff'ffff};
+
+    if (port == 0 || window == 0 || window > counter_mask / 2) {
+      return Status::InvalidParameter;
+    }
+
+    // Align to a counter edge
+    const auto edge  = in32(port) & counter_mask;
+    auto       first = edge;
+    while (first == edge) {
+      first = in32(port) & counter_mask;
+    }
+    const auto start = read_tsc();
+
+    auto elapsed = uint32_t{0};
+    while (elapsed < window) {
+      elapsed = ((in32(port) & counter_mask) - first) & counter_mask;
+    }
+    const auto end = read_tsc();
+
+    set_frequency((end - start) * pm_timer_frequency / elapsed);
+    return Status::Success;
+  }
+};
+
+}  // namespace efi
@@ -21,6 +21,9 @@
 
 #include <span>
 #include <array>
+#include <bit>
+#include <compare>
+#include <concepts>
 #include <cstdint>
 #include <type_traits>
 
@@ -29,7 +32,7 @@
 #define FORCE_INLINE __forceinline
 #else
 #define EFI_CALL __attribute__((ms_abi))
-#define force_inline __attribute__((always_inline))
+#define FORCE_INLINE __attribute__((always_inline))
 #endif
 
 #ifndef NODISCARD
@@ -68,10 +71,12 @@ using TPL                        = uintn_t;
 using PhysicalAddress            = uint64_t;
 using VirtualAddress             = uint64_t;
 
+constexpr auto page_size         = uintn_t{4096};
+
 constexpr auto status_error_flag = uintn_t{1} << 63;
 
 consteval auto status_error_code_(uintn_t code) -> uintn_t {
-  return code & status_error_flag;
+  return code | status_error_flag;
 }
 
 consteval auto status_warning_code_(uintn_t code) -> uintn_t {
@@ -125,11 +130,11 @@ enum class Status : uintn_t {
   HTTPError           = status_error_code_(35),
 };
 
-auto operator!(Status status) {
+inline auto operator!(Status status) {
   return status != Status::Success;
 }
 
-auto status_is_error(Status status) -> bool {
+inline auto status_is_error(Status status) -> bool {
   return (static_cast<std::underlying_type_t<Status>>(status) &
           status_error_flag) > 0;
 }
@@ -174,8 +179,8 @@ enum class MemoryType : uint32_t {
   ReservedMemoryType,
   LoaderCode,
   LoaderData,
-  SimpleTextInputProtocolCode,
-  SimpleTextInputProtocolData,
+  BootServicesCode,
+  BootServicesData,
   RuntimeServicesCode,
   RuntimeServicesData,
   ConventionalMemory,
@@ -189,41 +194,116 @@ enum class MemoryType : uint32_t {
   UnacceptedMemoryType
 };
 
+// Reached only by a malformed Guid::parse argument, which turns the call
+// into a compile error
+inline void invalid_guid_text_() noexcept {}
+
+// Stored as the 16 bytes of the firmware layout, aligned so they load as two
+// little endian words. Comparisons and the hash work on the words.
 class Guid {
  public:
   using Bytes      = std::array<uint8_t, 16>;
   using Data4Bytes = std::array<uint8_t, 8>;
+  using Words      = std::array<uint64_t, 2>;
 
  private:
-  union {
-    Bytes bytes_;
-    struct {
-      uint32_t data1;
-      uint16_t data2;
-      uint16_t data3;
-      union {
-        Data4Bytes bytes;
-        uint64_t ull;
-      } data4;
-    } struct_;
-  };
+  alignas(uint64_t) Bytes bytes_;
 
  public:
   constexpr explicit Guid(const Bytes& bytes) : bytes_{bytes} {}
 
   constexpr Guid(uint32_t data1, uint16_t data2, uint16_t data3,
                  const Data4Bytes& data4)
-      : struct_{.data1 = data1,
-                .data2 = data2,
-                .data3 = data3,
-                .data4{.bytes = data4}} {}
+      : bytes_{static_cast<uint8_t>(data1),
+               static_cast<uint8_t>(data1 >> 8),
+               static_cast<uint8_t>(data1 >> 16),
+               static_cast<uint8_t>(data1 >> 24),
+               static_cast<uint8_t>(data2),
+               static_cast<uint8_t>(data2 >> 8),
+               static_cast<uint8_t>(data3),
+               static_cast<uint8_t>(data3 >> 8),
+               data4[0],
+               data4[1],
+               data4[2],
+               data4[3],
+               data4[4],
+               data4[5],
+               data4[6],
+               data4[7]} {}
+
+  // From the canonical text form, "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+  static consteval auto parse(const char (&text)[37]) -> Guid {
+    auto digit = [&](uintn_t index) -> uint8_t {
+      const auto c = text[index];
+      if (c >= '0' && c <= '9') {
+        return static_cast<uint8_t>(c - '0');
+      }
+      if (c >= 'a' && c <= 'f') {
+        return static_cast<uint8_t>(c - 'a' + 10);
+      }
+      if (c >= 'A' && c <= 'F') {
+        return static_cast<uint8_t>(c - 'A' + 10);
+      }
+      invalid_guid_text_();
+      return 0;
+    };
+
+    auto field = [&](uintn_t begin, uintn_t digits) -> uint64_t {
+      auto value = uint64_t{0};
+      for (auto i = uintn_t{0}; i < digits; ++i) {
+        value = value << 4 | digit(begin + i);
+      }
+      return value;
+    };
+
+    if (text[8] != '-' || text[13] != '-' || text[18] != '-' ||
+        text[23] != '-') {
+      invalid_guid_text_();
+    }
+
+    auto data4 = Data4Bytes{};
+    data4[0]   = static_cast<uint8_t>(field(19, 2));
+    data4[1]   = static_cast<uint8_t>(field(21, 2));
+    for (auto i = uintn_t{0}; i < 6; ++i) {
+      data4[i + 2] = static_cast<uint8_t>(field(24 + i * 2, 2));
+    }
+
+    return Guid{static_cast<uint32_t>(field(0, 8)),
+                static_cast<uint16_t>(field(9, 4)),
+                static_cast<uint16_t>(field(14, 4)), data4};
+  }
 
   NODISCARD constexpr auto& bytes() const noexcept {
     return bytes_;
   }
 
-  NODISCARD constexpr auto operator==(const Guid& guid) const -> bool {
-    return bytes_ == guid.bytes_;
+  NODISCARD constexpr auto words() const noexcept -> Words {
+    return std::bit_cast<Words>(bytes_);
+  }
+
+  // Every bit of the guid reaches every bit of the hash
+  NODISCARD constexpr auto hash() const noexcept -> uint64_t {
+    constexpr auto mix = [](uint64_t key) {
+      key ^= key >> 33;
+      key *= 0xff51'afd7'ed55'8ccd;
+      key ^= key >> 33;
+      key *= 0xc4ce'b9fe'1a85'ec53;
+      key ^= key >> 33;
+      return key;
+    };
+    const auto words = this->words();
+    return mix(words[0] ^ mix(words[1]));
+  }
+
+  NODISCARD constexpr auto operator==(const Guid& guid) const noexcept
+      -> bool {
+    return words() == guid.words();
+  }
+
+  // A total order on the words, which is not the order of the text form
+  NODISCARD constexpr auto operator<=>(const Guid& guid) const noexcept
+      -> std::strong_ordering {
+    return words() <=> guid.words();
   }
 };
 
@@ -276,6 +356,10 @@ class Table {
     return revision_;
   }
 
+  NODISCARD auto header_size() const noexcept {
+    return header_size_;
+  }
+
   NODISCARD auto crc32() const noexcept {
     return crc32_;
   }
@@ -286,6 +370,8 @@ consteval auto revision(uint16_t major, uint16_t point) noexcept -> uint32_t {
 }
 
 template <typename T>
-concept IsProtocol = requires(T) { T::Guid->Guid; };
+concept IsProtocol = requires {
+  { T::guid } -> std::convertible_to<const Guid&>;
+};
 
 }  // namespace efi
\ No newline at end of file
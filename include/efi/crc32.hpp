@@ -0,0 +1,321 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <concepts>
+
+#include <immintrin.h>
+
+#include "system_table.hpp"
+#include "platform/x64.hpp"
+
+namespace efi {
+
+enum class Crc32Kernel {
+  Slicing8,
+  Pclmul,
+};
+
+// The CRC32 used by table headers and GPT, computed without calling
+// BootServices::calculate_crc32, so it keeps working after
+// exit_boot_services.
+//
+// Small inputs and tails use slicing-by-8 tables built at compile time. When
+// the cpu has PCLMULQDQ, runs of at least pclmul_threshold bytes are folded
+// 64 bytes at a time with carry-less multiplies.
+class Crc32 final {
+ public:
+  using UpdateFn = uint32_t (*)(uint32_t state, const uint8_t* data,
+                                uintn_t size) noexcept;
+
+  // Reflected form of 0x04c11db7
+  static constexpr auto polynomial       = uint32_t{0xedb88320};
+  static constexpr auto pclmul_threshold = uintn_t{64};
+
+  using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+ private:
+  static const Tables tables_;
+
+  // Starts out pointing at a resolver which picks the kernel on first use
+  static UpdateFn update_;
+
+  uint32_t state_ = ~uint32_t{0};
+
+ public:
+  constexpr Crc32() noexcept = default;
+
+  // Feeds more data, the result is the same however the input is split
+  void update(const void* data, uintn_t size) noexcept {
+    state_ = update_(state_, static_cast<const uint8_t*>(data), size);
+  }
+
+  NODISCARD auto value() const noexcept -> uint32_t {
+    return ~state_;
+  }
+
+  void reset() noexcept {
+    state_ = ~uint32_t{0};
+  }
+
+  NODISCARD static auto compute(const void* data, uintn_t size) noexcept
+      -> uint32_t {
+    return ~update_(~uint32_t{0}, static_cast<const uint8_t*>(data), size);
+  }
+
+  NODISCARD static auto detect() noexcept -> Crc32Kernel {
+    constexpr auto pclmulqdq_bit = uint32_t{1} << 1;
+    return (cpuid(1).ecx & pclmulqdq_bit) != 0 ? Crc32Kernel::Pclmul
+                                               : Crc32Kernel::Slicing8;
+  }
+
+  // Overrides detection, the caller must ensure the cpu supports kernel
+  static void use(Crc32Kernel kernel) noexcept {
+    switch (kernel) {
+      case Crc32Kernel::Slicing8:
+        update_ = &update_slicing8;
+        break;
+      case Crc32Kernel::Pclmul:
+        update_ = &update_pclmul;
+        break;
+    }
+  }
+
+#pragma region Kernels
+
+  // state is the running value before the final inversion
+  static auto update_slicing8(uint32_t state, const uint8_t* data,
+                              uintn_t size) noexcept -> uint32_t {
+    const auto& t = tables_;
+
+    while (size >= 8) {
+      const auto low  = load32(data) ^ state;
+      const auto high = load32(data + 4);
+      state = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^
+              t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+              t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^
+              t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+      data += 8;
+      size -= 8;
+    }
+
+    while (size != 0) {
+      state = t[0][(state ^ *data) & 0xff] ^ (state >> 8);
+      ++data;
+      --size;
+    }
+    return state;
+  }
+
+  // Folding as described in Intel's "Fast CRC Computation for Generic
+  // Polynomials Using PCLMULQDQ Instruction", constants are for the
+  // reflected 0x04c11db7 polynomial
+  TARGET_FEATURES("pclmul,sse2")
+  static auto update_pclmul(uint32_t state, const uint8_t* data,
+                            uintn_t size) noexcept -> uint32_t {
+    if (size < pclmul_threshold) {
+      return update_slicing8(state, data, size);
+    }
+
+    const auto tail  = size & 15;
+    size            -= tail;
+
+    const auto k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const auto k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const auto k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const auto poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const auto mask = _mm_setr_epi32(-1, 0, -1, 0);
+
+    auto x1 = load(data);
+    auto x2 = load(data + 16);
+    auto x3 = load(data + 32);
+    auto x4 = load(data + 48);
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(state)));
+    data += 64;
+    size -= 64;
+
+    // Four independent lanes of 128 bits
+    while (size >= 64) {
+      x1 = fold(x1, k1k2, load(data));
+      x2 = fold(x2, k1k2, load(data + 16));
+      x3 = fold(x3, k1k2, load(data + 32));
+      x4 = fold(x4, k1k2, load(data + 48));
+      data += 64;
+      size -= 64;
+    }
+
+    x1 = fold(x1, k3k4, x2);
+    x1 = fold(x1, k3k4, x3);
+    x1 = fold(x1, k3k4, x4);
+
+    while (size >= 16) {
+      x1 = fold(x1, k3k4, load(data));
+      data += 16;
+      size -= 16;
+    }
+
+    // 128 to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    // 64 to 32 bits
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), poly, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    state = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+    return update_slicing8(state, data, tail);
+  }
+
+#pragma endregion
+
+ private:
+  static consteval auto make_tables() noexcept -> Tables {
+    auto tables = Tables{};
+    for (auto i = uint32_t{0}; i < 256; ++i) {
+      auto value = i;
+      for (auto bit = 0; bit < 8; ++bit) {
+        value = (value >> 1) ^ (polynomial & (0u - (value & 1u)));
+      }
+      tables[0][i] = value;
+    }
+
+    // Entry i of table k is the crc of byte i followed by k zero bytes
+    for (auto k = uintn_t{1}; k < tables.size(); ++k) {
+      for (auto i = uintn_t{0}; i < 256; ++i) {
+        const auto previous = tables[k - 1][i];
+        tables[k][i] = (previous >> 8) ^ tables[0][previous & 0xff];
+      }
+    }
+    return tables;
+  }
+
+  FORCE_INLINE static auto load32(const uint8_t* data) noexcept -> uint32_t {
+    return static_cast<uint32_t>(data[0]) |
+           (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) |
+           (static_cast<uint32_t>(data[3]) << 24);
+  }
+
+  TARGET_FEATURES("sse2")
+  FORCE_INLINE static auto load(const uint8_t* data) noexcept -> __m128i {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+  }
+
+  TARGET_FEATURES("pclmul,sse2")
+  FORCE_INLINE static auto fold(__m128i value, __m128i constants,
+                                __m128i next) noexcept -> __m128i {
+    const auto low  = _mm_clmulepi64_si128(value, constants, 0x00);
+    const auto high = _mm_clmulepi64_si128(value, constants, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(high, low), next);
+  }
+
+  static auto resolve(uint32_t state, const uint8_t* data,
+                      uintn_t size) noexcept -> uint32_t {
+    use(detect());
+    return update_(state, data, size);
+  }
+};
+
+inline constexpr Crc32::Tables Crc32::tables_ = Crc32::make_tables();
+
+inline Crc32::UpdateFn Crc32::update_ = &Crc32::resolve;
+
+// signature, revision and header_size precede the crc32 field of a table
+constexpr auto table_crc32_offset = uintn_t{16};
+
+// crc32 over the header_size bytes of a table, taken with the crc32 field as
+// zero. header_size must cover at least the header.
+NODISCARD inline auto table_crc32(const Table* table) noexcept -> uint32_t {
+  constexpr auto zero  = uint32_t{0};
+  constexpr auto after = table_crc32_offset + sizeof(zero);
+
+  const auto* bytes = reinterpret_cast<const uint8_t*>(table);
+  auto        crc   = Crc32{};
+  crc.update(bytes, table_crc32_offset);
+  crc.update(&zero, sizeof(zero));
+  crc.update(bytes + after, table->header_size() - after);
+  return crc.value();
+}
+
+// Checks a table header the way the firmware seals it: the expected
+// signature, a header_size covering at least the header, and a matching
+// crc32. The table is only read, so this works on tables mapped read only.
+NODISCARD inline auto verify_table(const Table* table,
+                                   uint64_t     signature) noexcept -> Status {
+  if (table == nullptr) {
+    return Status::InvalidParameter;
+  }
+  if (table->signature() != signature) {
+    return Status::Unsupported;
+  }
+  if (table->header_size() < sizeof(Table)) {
+    return Status::BadBufferSize;
+  }
+
+  return table_crc32(table) == table->crc32() ? Status::Success
+                                              : Status::CrcError;
+}
+
+// Stores a fresh crc32 in a table whose contents were changed in place, such
+// as a service table with patched function pointers
+inline auto seal_table(Table* table) noexcept -> Status {
+  if (table == nullptr) {
+    return Status::InvalidParameter;
+  }
+  if (table->header_size() < sizeof(Table)) {
+    return Status::BadBufferSize;
+  }
+
+  auto* bytes = reinterpret_cast<uint8_t*>(table);
+  *reinterpret_cast<uint32_t*>(bytes + table_crc32_offset) = table_crc32(table);
+  return Status::Success;
+}
+
+template <typename T>
+  requires std::derived_from<T, Table>
+NODISCARD auto verify_table(const T* table) noexcept -> Status {
+  return verify_table(table, T::Signature);
+}
+
+// Verifies the system table and the service tables it points to. After
+// exit_boot_services the boot services pointer is null and only the system
+// and runtime services tables are checked.
+NODISCARD inline auto verify_tables(const SystemTable* system_table) noexcept
+    -> Status {
+  if (auto status = verify_table(system_table); status != Status::Success) {
+    return status;
+  }
+  if (const auto* boot_services = system_table->boot_services();
+      boot_services != nullptr) {
+    if (auto status = verify_table(boot_services); status != Status::Success) {
+      return status;
+    }
+  }
+  return verify_table(system_table->runtime_services());
+}
+
+}  // namespace efi
@@ -50,4 +50,31 @@
 #include "protocol/dhcp.hpp"
 #include "protocol/dns_v4.hpp"
 #include "protocol/tcp_v4.hpp"
+
+// Library Utilities
+#include "page_arena.hpp"
+#include "slab_allocator.hpp"
+#include "memory_resource.hpp"
+#include "memory_map.hpp"
+#include "exit_boot_services.hpp"
+#include "page_allocator.hpp"
+#include "platform/x64_paging.hpp"
+#include "platform/x64_memory.hpp"
+#include "crc32.hpp"
+#include "task.hpp"
+#include "timer_wheel.hpp"
+#include "ring_buffer.hpp"
+#include "event_set.hpp"
+#include "clock.hpp"
+#include "trace.hpp"
+#include "poll_scheduler.hpp"
+#include "token_wait.hpp"
+#include "event_bus.hpp"
+#include "protocol_cache.hpp"
+#include "handle_snapshot.hpp"
+#include "guid_registry.hpp"
+#include "protocol_ref.hpp"
+#ifndef _WINDOWS
+#include "fiber.hpp"
+#endif
 #endif
@@ -0,0 +1,250 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <bit>
+
+#include "boot_services.hpp"
+
+namespace efi {
+
+// Subscriptions to firmware event groups, such as EventGroupExitBootServices
+// or EventGroupReadyToBoot, sharing one NotifySignal event per group.
+//
+// The group event is created with create_event_ex on the first subscription
+// and closed with the last. When any member of the group is signaled, by the
+// firmware or by publish, the notify function runs every subscriber of the
+// group in subscription order at the bus TPL. Subscribers to exit boot
+// services must follow its rules: no allocation and no boot services that
+// could change the memory map.
+//
+// An Id carries a generation next to its subscriber slot, so an Id kept
+// past its unsubscribe never matches a later subscription in that slot.
+class EventBus final {
+ public:
+  using Handler = void (*)(const Guid& group, void* context) noexcept;
+  using Id      = uintn_t;
+
+  static constexpr auto max_groups      = uintn_t{8};
+  static constexpr auto max_subscribers = uintn_t{32};
+
+  struct Stats {
+    uint64_t published;
+    uint64_t notified;
+    uint64_t dispatched;
+  };
+
+ private:
+  static constexpr auto slot_mask = max_subscribers - 1;
+  static_assert(std::has_single_bit(max_subscribers));
+
+  struct Group {
+    EventBus* bus         = nullptr;
+    Guid      guid        = Guid{Guid::Bytes{}};
+    Event     event       = nullptr;
+    uintn_t   subscribers = 0;
+  };
+
+  struct Subscriber {
+    Handler handler;
+    void*   context;
+    Group*  group;
+  };
+
+  BootServices* const boot_services_;
+  const TPL           notify_tpl_;
+
+  std::array<Group, max_groups>           groups_{};
+  std::array<Subscriber, max_subscribers> subscribers_{};
+  Stats                                   stats_{};
+
+  // Id of the current or next subscription in each slot
+  std::array<Id, max_subscribers> ids_{};
+
+ public:
+  explicit EventBus(BootServices* boot_services,
+                    TPL           notify_tpl = TplCallback) noexcept
+      : boot_services_{boot_services}, notify_tpl_{notify_tpl} {
+    for (auto i = uintn_t{0}; i < max_subscribers; ++i) {
+      ids_[i] = i;
+    }
+  }
+
+  ~EventBus() {
+    for (auto& group : groups_) {
+      if (group.event != nullptr) {
+        boot_services_->close_event(group.event);
+      }
+    }
+  }
+
+  EventBus()                                   = delete;
+  EventBus(EventBus&&)                         = delete;
+  EventBus(const EventBus&)                    = delete;
+  auto operator=(EventBus&&) -> EventBus&      = delete;
+  auto operator=(const EventBus&) -> EventBus& = delete;
+
+  auto subscribe(const Guid& group, Handler handler, void* context,
+                 Id* id) noexcept -> Status {
+    if (handler == nullptr || id == nullptr) {
+      return Status::InvalidParameter;
+    }
+
+    const auto guard = TplGuard{boot_services_, notify_tpl_};
+
+    auto* subscriber = free_subscriber();
+    if (subscriber == nullptr) {
+      return Status::OutOfResources;
+    }
+
+    auto* entry = find(group);
+    if (entry == nullptr) {
+      entry = free_group();
+      if (entry == nullptr) {
+        return Status::OutOfResources;
+      }
+      if (auto status = open(entry, group); status != Status::Success) {
+        return status;
+      }
+    }
+
+    entry->subscribers++;
+    *subscriber = Subscriber{handler, context, entry};
+    *id         = ids_[subscriber - subscribers_.data()];
+    return Status::Success;
+  }
+
+  // Safe to call from a handler, for any subscription
+  auto unsubscribe(Id id) noexcept -> Status {
+    const auto slot = id & slot_mask;
+    if (subscribers_[slot].handler == nullptr || ids_[slot] != id) {
+      return Status::NotFound;
+    }
+
+    const auto guard = TplGuard{boot_services_, notify_tpl_};
+
+    auto* group        = subscribers_[slot].group;
+    subscribers_[slot] = Subscriber{};
+    ids_[slot]         = id + max_subscribers;
+    if (--group->subscribers == 0) {
+      boot_services_->close_event(group->event);
+      *group = Group{};
+    }
+    return Status::Success;
+  }
+
+  // Signals every event of the group, subscribed here or not. Without a
+  // subscription a member event is created just to be signaled.
+  auto publish(const Guid& group) noexcept -> Status {
+    stats_.published++;
+
+    if (const auto* entry = find(group); entry != nullptr) {
+      return boot_services_->signal_event(entry->event);
+    }
+
+    auto event  = Event{};
+    auto status = boot_services_->create_event_ex(
+        EventType::NotifySignal, notify_tpl_, &ignore, nullptr, &group,
+        &event);
+    if (status != Status::Success) {
+      return status;
+    }
+
+    status = boot_services_->signal_event(event);
+    boot_services_->close_event(event);
+    return status;
+  }
+
+  NODISCARD auto subscribed(const Guid& group) const noexcept -> bool {
+    for (const auto& entry : groups_) {
+      if (entry.event != nullptr && entry.guid == group) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  static EFI_CALL void ignore(Event /*event*/, void* /*context*/) noexcept {}
+
+  static EFI_CALL void on_signal(Event /*event*/, void* context) noexcept {
+    auto* group = static_cast<Group*>(context);
+    group->bus->dispatch(group);
+  }
+
+  // A handler unsubscribing another clears its slot before it is reached.
+  // The guid is kept in case the last one leaves and the slot is reused.
+  void dispatch(Group* group) noexcept {
+    const auto guid = group->guid;
+    stats_.notified++;
+    for (const auto& subscriber : subscribers_) {
+      if (subscriber.handler != nullptr && subscriber.group == group &&
+          group->guid == guid) {
+        stats_.dispatched++;
+        subscriber.handler(guid, subscriber.context);
+      }
+    }
+  }
+
+  auto open(Group* group, const Guid& guid) noexcept -> Status {
+    *group            = Group{this, guid, nullptr, 0};
+    const auto status = boot_services_->create_event_ex(
+        EventType::NotifySignal, notify_tpl_, &on_signal, group, &group->guid,
+        &group->event);
+    if (status != Status::Success) {
+      *group = Group{};
+    }
+    return status;
+  }
+
+  NODISCARD auto find(const Guid& guid) noexcept -> Group* {
+    for (auto& group : groups_) {
+      if (group.event != nullptr && group.guid == guid) {
+        return &group;
+      }
+    }
+    return nullptr;
+  }
+
+  NODISCARD auto free_group() noexcept -> Group* {
+    for (auto& group : groups_) {
+      if (group.event == nullptr) {
+        return &group;
+      }
+    }
+    return nullptr;
+  }
+
+  NODISCARD auto free_subscriber() noexcept -> Subscriber* {
+    for (auto& subscriber : subscribers_) {
+      if (subscriber.handler == nullptr) {
+        return &subscriber;
+      }
+    }
+    return nullptr;
+  }
+};
+
+}  // namespace efi
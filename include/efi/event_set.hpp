@@ -0,0 +1,224 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <bit>
+
+#include "boot_services.hpp"
+#include "platform/x64.hpp"
+
+namespace efi {
+
+// Persistent set of events with a handler each, for main loops waiting on
+// many sources at once.
+//
+// The events live in one contiguous array that is handed to wait_for_events
+// as is, with the handlers in a parallel array, so the returned index leads
+// straight to its handler. Entries are addressed by a stable Id, add and
+// remove are O(1) with the last entry swapped into a removed slot. An Id
+// carries a generation next to its slot, so an Id kept past its remove never
+// matches a later entry that reuses the slot.
+//
+// Above poll_threshold events a dispatch first sweeps the set with
+// check_event and runs every handler that is ready in one pass, blocking in
+// wait_for_events only when nothing was. Events must not be of type
+// NotifySignal.
+class EventSet final {
+ public:
+  using Handler = void (*)(Event event, void* context) noexcept;
+  using Id      = uintn_t;
+
+  static constexpr auto max_events             = uintn_t{64};
+  static constexpr auto default_poll_threshold = uintn_t{16};
+
+  struct Stats {
+    uint64_t waits;
+    uint64_t sweeps;
+    uint64_t dispatched;
+
+    // Time blocked in wait_for_events, in tsc cycles
+    uint64_t idle_cycles;
+  };
+
+ private:
+  static constexpr auto no_index  = ~uintn_t{0};
+  static constexpr auto slot_mask = max_events - 1;
+  static_assert(std::has_single_bit(max_events));
+
+  struct Entry {
+    Handler handler;
+    void*   context;
+    Id      id;
+  };
+
+  BootServices* const boot_services_;
+  const uintn_t       poll_threshold_;
+
+  std::array<Event, max_events> events_{};
+  std::array<Entry, max_events> entries_{};
+  uintn_t                       count_ = 0;
+
+  // Position of each id slot in events_, no_index when free. Free ids are
+  // already of the generation their slot is used next with.
+  std::array<uintn_t, max_events> index_of_{};
+  std::array<Id, max_events>      free_ids_{};
+  uintn_t                         free_count_ = max_events;
+
+  Stats stats_{};
+
+ public:
+  explicit EventSet(BootServices* boot_services,
+                    uintn_t poll_threshold = default_poll_threshold) noexcept
+      : boot_services_{boot_services}, poll_threshold_{poll_threshold} {
+    for (auto i = uintn_t{0}; i < max_events; ++i) {
+      index_of_[i] = no_index;
+      free_ids_[i] = max_events - 1 - i;
+    }
+  }
+
+  EventSet()                                   = delete;
+  EventSet(EventSet&&)                         = delete;
+  EventSet(const EventSet&)                    = delete;
+  auto operator=(EventSet&&) -> EventSet&      = delete;
+  auto operator=(const EventSet&) -> EventSet& = delete;
+
+  // The event stays owned by the caller
+  auto add(Event event, Handler handler, void* context, Id* id) noexcept
+      -> Status {
+    if (event == nullptr || handler == nullptr || id == nullptr) {
+      return Status::InvalidParameter;
+    }
+    if (free_count_ == 0) {
+      return Status::OutOfResources;
+    }
+
+    *id                  = free_ids_[--free_count_];
+    index_of_[slot(*id)] = count_;
+    events_[count_]      = event;
+    entries_[count_]     = Entry{handler, context, *id};
+    count_++;
+    return Status::Success;
+  }
+
+  // Safe to call from a handler, for any entry
+  auto remove(Id id) noexcept -> Status {
+    if (!contains(id)) {
+      return Status::NotFound;
+    }
+
+    const auto index = index_of_[slot(id)];
+    count_--;
+    if (index != count_) {
+      events_[index]                      = events_[count_];
+      entries_[index]                     = entries_[count_];
+      index_of_[slot(entries_[index].id)] = index;
+    }
+
+    index_of_[slot(id)]      = no_index;
+    free_ids_[free_count_++] = id + max_events;
+    return Status::Success;
+  }
+
+  NODISCARD auto contains(Id id) const noexcept -> bool {
+    const auto index = index_of_[slot(id)];
+    return index != no_index && entries_[index].id == id;
+  }
+
+  NODISCARD auto size() const noexcept {
+    return count_;
+  }
+
+  NODISCARD auto empty() const noexcept {
+    return count_ == 0;
+  }
+
+  // Contiguous, valid until the next add or remove
+  NODISCARD auto* events() const noexcept {
+    return events_.data();
+  }
+
+  // Waits until at least one event is signaled and runs its handler, or the
+  // handlers of every ready event in a sweep. Must be called at
+  // TPL_APPLICATION.
+  auto dispatch() noexcept -> Status {
+    if (count_ == 0) {
+      return Status::NotReady;
+    }
+
+    if (count_ > poll_threshold_ && sweep() != 0) {
+      return Status::Success;
+    }
+
+    const auto start  = read_tsc();
+    auto       index  = uintn_t{0};
+    const auto status =
+        boot_services_->wait_for_events(count_, events_.data(), &index);
+    stats_.idle_cycles += read_tsc() - start;
+    stats_.waits++;
+
+    if (status != Status::Success) {
+      return status;
+    }
+
+    run(index);
+    return Status::Success;
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  NODISCARD static auto slot(Id id) noexcept -> uintn_t {
+    return id & slot_mask;
+  }
+
+  void run(uintn_t index) noexcept {
+    const auto entry = entries_[index];
+    stats_.dispatched++;
+    entry.handler(events_[index], entry.context);
+  }
+
+  // check_event clears what it reports, so ready ids are collected before
+  // any handler can reshuffle the arrays. A handler removing a ready entry
+  // and adding another in its slot changes the generation, so the new entry
+  // is not run for the old event.
+  auto sweep() noexcept -> uintn_t {
+    stats_.sweeps++;
+
+    std::array<Id, max_events> ready;
+    auto                       ready_count = uintn_t{0};
+    for (auto i = uintn_t{0}; i < count_; ++i) {
+      if (boot_services_->check_event(events_[i]) == Status::Success) {
+        ready[ready_count++] = entries_[i].id;
+      }
+    }
+
+    for (auto i = uintn_t{0}; i < ready_count; ++i) {
+      if (contains(ready[i])) {
+        run(index_of_[slot(ready[i])]);
+      }
+    }
+    return ready_count;
+  }
+};
+
+}  // namespace efi
@@ -0,0 +1,195 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include "boot_services.hpp"
+#include "memory_map.hpp"
+#include "platform/x64.hpp"
+
+namespace efi {
+
+// Hands the machine over with a memory map buffer sized once, up front.
+//
+// prepare reserves the buffer with headroom for the descriptors that later
+// allocations, including its own, add to the map. exit then loops
+// get_memory_map / exit_boot_services on that buffer without allocating, which
+// is required once an exit_boot_services call has failed.
+class ExitBootServicesSequencer final {
+ public:
+  struct Stats {
+    uintn_t  attempts;
+    uint64_t cycles;
+    uintn_t  buffer_size;
+    uintn_t  map_size;
+
+    NODISCARD auto microseconds(uint64_t tsc_frequency) const noexcept
+        -> uint64_t {
+      return tsc_frequency != 0 ? cycles * 1'000'000 / tsc_frequency : 0;
+    }
+  };
+
+  // Extra descriptors reserved beyond what the map needs at prepare time
+  static constexpr auto default_headroom     = uintn_t{16};
+  static constexpr auto default_max_attempts = uintn_t{4};
+
+ private:
+  BootServices* const boot_services_;
+  const Handle        image_handle_;
+
+  MemoryDescriptor* buffer_             = nullptr;
+  uintn_t           buffer_pages_       = 0;
+  uintn_t           map_size_           = 0;
+  uintn_t           descriptor_size_    = 0;
+  uint32_t          descriptor_version_ = 0;
+  bool              exited_             = false;
+  Stats             stats_{};
+
+ public:
+  ExitBootServicesSequencer(BootServices* boot_services,
+                            Handle        image_handle) noexcept
+      : boot_services_{boot_services}, image_handle_{image_handle} {}
+
+  // The buffer is handed to the caller once boot services have exited
+  ~ExitBootServicesSequencer() {
+    if (!exited_) {
+      release();
+    }
+  }
+
+  ExitBootServicesSequencer()                                 = delete;
+  ExitBootServicesSequencer(ExitBootServicesSequencer&&)      = delete;
+  ExitBootServicesSequencer(const ExitBootServicesSequencer&) = delete;
+  auto operator=(ExitBootServicesSequencer&&)
+      -> ExitBootServicesSequencer& = delete;
+  auto operator=(const ExitBootServicesSequencer&)
+      -> ExitBootServicesSequencer& = delete;
+
+  auto prepare(uintn_t headroom = default_headroom) noexcept -> Status {
+    if (exited_) {
+      return Status::AlreadyStarted;
+    }
+
+    auto map_size = uintn_t{0};
+    auto map_key  = uintn_t{0};
+    auto status =
+        boot_services_->get_memory_map(&map_size, nullptr, &map_key,
+                                       &descriptor_size_, &descriptor_version_);
+    if (status != Status::BufferTooSmall) {
+      return status == Status::Success ? Status::DeviceError : status;
+    }
+
+    // The page allocation below may itself split a free range
+    const auto needed = map_size + (headroom + 2) * descriptor_size_;
+    const auto pages  = (needed + page_size - 1) / page_size;
+    if (pages <= buffer_pages_) {
+      return Status::Success;
+    }
+
+    release();
+
+    auto memory = PhysicalAddress{};
+    status = boot_services_->allocate_pages(
+        AllocateType::AnyPages, MemoryType::LoaderData, pages, &memory);
+    if (status != Status::Success) {
+      return status;
+    }
+
+    buffer_            = reinterpret_cast<MemoryDescriptor*>(memory);
+    buffer_pages_      = pages;
+    stats_.buffer_size = pages * page_size;
+    return Status::Success;
+  }
+
+  // On success boot services are gone and memory_map describes the final map.
+  // Returns BufferTooSmall when the map outgrew the headroom after the first
+  // failed attempt, at which point nothing may be allocated any more.
+  auto exit(uintn_t max_attempts = default_max_attempts) noexcept -> Status {
+    if (exited_) {
+      return Status::AlreadyStarted;
+    }
+
+    const auto start = read_tsc();
+
+    if (buffer_ == nullptr) {
+      if (auto status = prepare(); status != Status::Success) {
+        return status;
+      }
+    }
+
+    auto status = Status::Aborted;
+    for (auto attempt = uintn_t{0}; attempt < max_attempts; ++attempt) {
+      auto map_key = uintn_t{0};
+      map_size_    = buffer_pages_ * page_size;
+      status = boot_services_->get_memory_map(&map_size_, buffer_, &map_key,
+                                              &descriptor_size_,
+                                              &descriptor_version_);
+
+      // Growing is only allowed while no exit attempt has failed yet
+      if (status == Status::BufferTooSmall && stats_.attempts == 0) {
+        if (status = prepare(); status != Status::Success) {
+          break;
+        }
+        continue;
+      }
+      if (status != Status::Success) {
+        break;
+      }
+
+      stats_.attempts++;
+      status = boot_services_->exit_boot_services(image_handle_, map_key);
+      if (status != Status::InvalidParameter) {
+        break;
+      }
+    }
+
+    stats_.cycles   += read_tsc() - start;
+    stats_.map_size  = map_size_;
+    exited_          = status == Status::Success;
+    return status;
+  }
+
+  NODISCARD auto memory_map() const noexcept {
+    return MemoryMapView{buffer_, map_size_, descriptor_size_};
+  }
+
+  NODISCARD auto descriptor_version() const noexcept {
+    return descriptor_version_;
+  }
+
+  NODISCARD auto exited() const noexcept {
+    return exited_;
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  void release() noexcept {
+    if (buffer_ != nullptr) {
+      boot_services_->free_pages(reinterpret_cast<PhysicalAddress>(buffer_),
+                                 buffer_pages_);
+      buffer_       = nullptr;
+      buffer_pages_ = 0;
+    }
+  }
+};
+
+}  // namespace efi
@@ -0,0 +1,478 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#ifdef _WINDOWS
+#error "Fibers need GNU style inline assembly"
+#endif
+
+#include <array>
+#include <cstddef>
+
+#include "boot_services.hpp"
+#include "platform/x64.hpp"
+
+namespace efi {
+
+class FiberScheduler;
+
+// Stackful coroutine with its own stack taken from boot services pages.
+//
+// A switch saves the callee saved state of the Microsoft x64 ABI, a
+// superset of the System V one: rbx, rbp, rdi, rsi, r12-r15, xmm6-xmm15,
+// MXCSR and the x87 control word. They are pushed onto the stack being
+// left, so a suspended fiber is just its stack pointer.
+//
+// The fiber is owned by the caller and must outlive its run.
+class Fiber final {
+ public:
+  using Function = void (*)(FiberScheduler* scheduler, void* context) noexcept;
+
+  enum class State {
+    Created,
+    Ready,
+    Waiting,
+    Done,
+  };
+
+  // 64KiB
+  static constexpr auto default_stack_pages = uintn_t{16};
+
+ private:
+  // The stack at a saved stack pointer, lowest address first
+  struct Frame {
+    std::array<std::array<uint8_t, 16>, 10> xmm;
+    uint32_t                                mxcsr;
+    uint16_t                                fpu_control;
+    uint16_t                                reserved;
+    uint64_t r15, r14, r13, r12, rsi, rdi, rbx, rbp;
+    void*    return_address;
+  };
+
+  static_assert(offsetof(Frame, mxcsr) == 160 &&
+                    offsetof(Frame, fpu_control) == 164 &&
+                    offsetof(Frame, r15) == 168 && sizeof(Frame) == 240,
+                "Frame must match switch_to");
+
+  static constexpr auto default_mxcsr       = uint32_t{0x1f80};
+  static constexpr auto default_fpu_control = uint16_t{0x037f};
+
+  // Fills fresh stacks, so overflow into the guard and the deepest use can
+  // be told apart from untouched memory
+  static constexpr auto fill_pattern = uint64_t{0xcccc'cccc'cccc'cccc};
+  static constexpr auto canary_words = uintn_t{8};
+
+  const Function  function_;
+  void* const     context_;
+  FiberScheduler* scheduler_ = nullptr;
+  void*           sp_        = nullptr;
+
+  PhysicalAddress stack_       = 0;
+  uintn_t         stack_pages_ = 0;
+  bool            guard_       = false;
+  uintn_t         stack_peak_  = 0;
+
+  State  state_       = State::Created;
+  Event  event_       = nullptr;
+  Status wait_status_ = Status::Success;
+  Status status_      = Status::Success;
+
+ public:
+  Fiber(Function function, void* context) noexcept
+      : function_{function}, context_{context} {}
+
+  Fiber()                                = delete;
+  Fiber(Fiber&&)                         = delete;
+  Fiber(const Fiber&)                    = delete;
+  auto operator=(Fiber&&) -> Fiber&      = delete;
+  auto operator=(const Fiber&) -> Fiber& = delete;
+
+  NODISCARD auto state() const noexcept {
+    return state_;
+  }
+
+  NODISCARD auto done() const noexcept {
+    return state_ == State::Done;
+  }
+
+  // BufferTooSmall when the fiber was stopped for overflowing its stack
+  NODISCARD auto status() const noexcept {
+    return status_;
+  }
+
+  // Deepest stack use in bytes, known once done
+  NODISCARD auto stack_peak() const noexcept {
+    return stack_peak_;
+  }
+
+ private:
+  NODISCARD auto stack_bottom() const noexcept -> uint64_t* {
+    return reinterpret_cast<uint64_t*>(stack_ + (guard_ ? page_size : 0));
+  }
+
+  NODISCARD auto stack_top() const noexcept -> uint64_t* {
+    return reinterpret_cast<uint64_t*>(stack_ + stack_pages_ * page_size);
+  }
+
+  // The words just below the usable stack are the first an overflow hits
+  NODISCARD auto canary_intact() const noexcept -> bool {
+    if (!guard_) {
+      return true;
+    }
+    const auto* canary = stack_bottom() - canary_words;
+    for (auto i = uintn_t{0}; i < canary_words; ++i) {
+      if (canary[i] != fill_pattern) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  NODISCARD auto measure_stack() const noexcept -> uintn_t {
+    const auto* word = stack_bottom();
+    const auto* top  = stack_top();
+    while (word < top && *word == fill_pattern) {
+      ++word;
+    }
+    return static_cast<uintn_t>(top - word) * sizeof(uint64_t);
+  }
+
+  // Prepares the stack so the first switch_to returns into trampoline,
+  // which calls entry with the fiber
+  void prepare(void(EFI_CALL* entry)(Fiber*)) noexcept {
+    for (auto* word = reinterpret_cast<uint64_t*>(stack_);
+         word < stack_top(); ++word) {
+      *word = fill_pattern;
+    }
+
+    auto* frame           = reinterpret_cast<Frame*>(stack_top()) - 1;
+    *frame                = Frame{};
+    frame->mxcsr          = default_mxcsr;
+    frame->fpu_control    = default_fpu_control;
+    frame->rbx            = reinterpret_cast<uint64_t>(this);
+    frame->r12            = reinterpret_cast<uint64_t>(entry);
+    frame->return_address = reinterpret_cast<void*>(&trampoline);
+    sp_                   = frame;
+  }
+
+  // Saves the current context on its stack, stores the stack pointer in
+  // *save and continues the context saved at resume
+  __attribute__((naked, noinline)) static EFI_CALL void switch_to(
+      void** /*save*/, void* /*resume*/) noexcept {
+    asm volatile(
+        "pushq %rbp\n\t"
+        "pushq %rbx\n\t"
+        "pushq %rdi\n\t"
+        "pushq %rsi\n\t"
+        "pushq %r12\n\t"
+        "pushq %r13\n\t"
+        "pushq %r14\n\t"
+        "pushq %r15\n\t"
+        "subq $168, %rsp\n\t"
+        "movups %xmm6, 0(%rsp)\n\t"
+        "movups %xmm7, 16(%rsp)\n\t"
+        "movups %xmm8, 32(%rsp)\n\t"
+        "movups %xmm9, 48(%rsp)\n\t"
+        "movups %xmm10, 64(%rsp)\n\t"
+        "movups %xmm11, 80(%rsp)\n\t"
+        "movups %xmm12, 96(%rsp)\n\t"
+        "movups %xmm13, 112(%rsp)\n\t"
+        "movups %xmm14, 128(%rsp)\n\t"
+        "movups %xmm15, 144(%rsp)\n\t"
+        "stmxcsr 160(%rsp)\n\t"
+        "fnstcw 164(%rsp)\n\t"
+        "movq %rsp, (%rcx)\n\t"
+        "movq %rdx, %rsp\n\t"
+        "movups 0(%rsp), %xmm6\n\t"
+        "movups 16(%rsp), %xmm7\n\t"
+        "movups 32(%rsp), %xmm8\n\t"
+        "movups 48(%rsp), %xmm9\n\t"
+        "movups 64(%rsp), %xmm10\n\t"
+        "movups 80(%rsp), %xmm11\n\t"
+        "movups 96(%rsp), %xmm12\n\t"
+        "movups 112(%rsp), %xmm13\n\t"
+        "movups 128(%rsp), %xmm14\n\t"
+        "movups 144(%rsp), %xmm15\n\t"
+        "ldmxcsr 160(%rsp)\n\t"
+        "fldcw 164(%rsp)\n\t"
+        "addq $168, %rsp\n\t"
+        "popq %r15\n\t"
+        "popq %r14\n\t"
+        "popq %r13\n\t"
+        "popq %r12\n\t"
+        "popq %rsi\n\t"
+        "popq %rdi\n\t"
+        "popq %rbx\n\t"
+        "popq %rbp\n\t"
+        "ret\n\t");
+  }
+
+  // First code on a fresh stack, with the fiber in rbx and the entry in
+  // r12. The stack is 16 byte aligned here, the call leaves shadow space.
+  __attribute__((naked, noinline)) static void trampoline() noexcept {
+    asm volatile(
+        "movq %rbx, %rcx\n\t"
+        "subq $32, %rsp\n\t"
+        "callq *%r12\n\t"
+        "ud2\n\t");
+  }
+
+  friend class FiberScheduler;
+};
+
+// Runs fibers round robin on the boot processor until all are done.
+//
+// A fiber runs until it yields, waits on an event or returns. When every
+// fiber is waiting the scheduler blocks in wait_for_events on all of their
+// events, each waited on by one fiber at most. Events must not be
+// NotifySignal and run must be called at TPL_APPLICATION outside of any
+// fiber.
+class FiberScheduler final {
+ public:
+  static constexpr auto max_fibers = uintn_t{32};
+
+  struct Stats {
+    uint64_t switches;
+    uint64_t waits;
+
+    // Time blocked in wait_for_events, in tsc cycles
+    uint64_t idle_cycles;
+  };
+
+ private:
+  BootServices* const boot_services_;
+
+  std::array<Fiber*, max_fibers> fibers_{};
+  uintn_t                        count_ = 0;
+
+  Fiber* current_ = nullptr;
+  void*  main_sp_ = nullptr;
+  Stats  stats_{};
+
+ public:
+  explicit FiberScheduler(BootServices* boot_services) noexcept
+      : boot_services_{boot_services} {}
+
+  // Fibers still alive are abandoned with their stacks released
+  ~FiberScheduler() {
+    for (auto i = uintn_t{0}; i < count_; ++i) {
+      release(fibers_[i]);
+    }
+  }
+
+  FiberScheduler()                                         = delete;
+  FiberScheduler(FiberScheduler&&)                         = delete;
+  FiberScheduler(const FiberScheduler&)                    = delete;
+  auto operator=(FiberScheduler&&) -> FiberScheduler&      = delete;
+  auto operator=(const FiberScheduler&) -> FiberScheduler& = delete;
+
+  // Allocates the stack, one more page when guard is set, holding the
+  // canary checked after every switch. Callable from a fiber.
+  auto spawn(Fiber* fiber, uintn_t stack_pages = Fiber::default_stack_pages,
+             bool guard = true) noexcept -> Status {
+    if (fiber == nullptr || fiber->function_ == nullptr || stack_pages == 0 ||
+        fiber->state_ != Fiber::State::Created) {
+      return Status::InvalidParameter;
+    }
+    if (count_ == max_fibers) {
+      return Status::OutOfResources;
+    }
+
+    const auto pages  = stack_pages + (guard ? 1 : 0);
+    const auto status = boot_services_->allocate_pages(
+        AllocateType::AnyPages, MemoryType::LoaderData, pages, &fiber->stack_);
+    if (status != Status::Success) {
+      return status;
+    }
+
+    fiber->stack_pages_ = pages;
+    fiber->guard_       = guard;
+    fiber->scheduler_   = this;
+    fiber->prepare(&start);
+    fiber->state_       = Fiber::State::Ready;
+    fibers_[count_++]   = fiber;
+    return Status::Success;
+  }
+
+  auto run() noexcept -> Status {
+    if (current_ != nullptr) {
+      return Status::InvalidParameter;
+    }
+
+    while (count_ != 0) {
+      auto ran = false;
+      for (auto i = uintn_t{0}; i < count_; ++i) {
+        auto* fiber = fibers_[i];
+        if (fiber->state_ == Fiber::State::Waiting) {
+          poll(fiber);
+        }
+        if (fiber->state_ == Fiber::State::Ready) {
+          resume(fiber);
+          ran = true;
+        }
+      }
+
+      reap();
+      if (!ran && count_ != 0) {
+        if (auto status = idle(); status != Status::Success) {
+          return status;
+        }
+      }
+    }
+    return Status::Success;
+  }
+
+  // Lets the other ready fibers run, does nothing outside a fiber
+  void yield() noexcept {
+    if (current_ != nullptr) {
+      suspend(Fiber::State::Ready);
+    }
+  }
+
+  // Blocks the calling fiber until event is signaled, or the caller itself
+  // outside a fiber. A signal wakes a single waiter, so AccessDenied when
+  // another fiber already waits on event; it would never be woken.
+  auto wait(Event event) noexcept -> Status {
+    if (current_ == nullptr) {
+      auto index = uintn_t{0};
+      return boot_services_->wait_for_events(1, &event, &index);
+    }
+    if (waited_on(event)) {
+      return Status::AccessDenied;
+    }
+
+    const auto status = boot_services_->check_event(event);
+    if (status != Status::NotReady) {
+      return status;
+    }
+
+    current_->event_       = event;
+    current_->wait_status_ = Status::Success;
+    return suspend(Fiber::State::Waiting);
+  }
+
+  // nullptr outside a fiber
+  NODISCARD auto* current() const noexcept {
+    return current_;
+  }
+
+  NODISCARD auto size() const noexcept {
+    return count_;
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  static EFI_CALL void start(Fiber* fiber) noexcept {
+    auto* scheduler = fiber->scheduler_;
+    fiber->function_(scheduler, fiber->context_);
+    scheduler->suspend(Fiber::State::Done);
+  }
+
+  auto suspend(Fiber::State state) noexcept -> Status {
+    auto* fiber   = current_;
+    fiber->state_ = state;
+    Fiber::switch_to(&fiber->sp_, main_sp_);
+    return fiber->wait_status_;
+  }
+
+  void resume(Fiber* fiber) noexcept {
+    current_ = fiber;
+    Fiber::switch_to(&main_sp_, fiber->sp_);
+    current_ = nullptr;
+    stats_.switches++;
+
+    if (!fiber->canary_intact()) {
+      fiber->status_ = Status::BufferTooSmall;
+      fiber->state_  = Fiber::State::Done;
+    }
+  }
+
+  NODISCARD auto waited_on(Event event) const noexcept -> bool {
+    for (auto i = uintn_t{0}; i < count_; ++i) {
+      const auto* fiber = fibers_[i];
+      if (fiber->state_ == Fiber::State::Waiting && fiber->event_ == event) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // check_event clears the signal, the fiber is told it fired
+  void poll(Fiber* fiber) noexcept {
+    const auto status = boot_services_->check_event(fiber->event_);
+    if (status != Status::NotReady) {
+      fiber->wait_status_ = status;
+      fiber->state_       = Fiber::State::Ready;
+    }
+  }
+
+  auto idle() noexcept -> Status {
+    std::array<Event, max_fibers> events;
+    for (auto i = uintn_t{0}; i < count_; ++i) {
+      events[i] = fibers_[i]->event_;
+    }
+
+    const auto start  = read_tsc();
+    auto       index  = uintn_t{0};
+    const auto status = boot_services_->wait_for_events(count_, events.data(),
+                                                        &index);
+    stats_.idle_cycles += read_tsc() - start;
+    stats_.waits++;
+
+    // An unwaitable event fails its own fiber's wait rather than the run
+    if (status == Status::InvalidParameter && index < count_) {
+      fibers_[index]->wait_status_ = status;
+      fibers_[index]->state_       = Fiber::State::Ready;
+      return Status::Success;
+    }
+    if (status != Status::Success) {
+      return status;
+    }
+
+    fibers_[index]->state_ = Fiber::State::Ready;
+    return Status::Success;
+  }
+
+  // Drops finished fibers, keeping the others in order
+  void reap() noexcept {
+    auto kept = uintn_t{0};
+    for (auto i = uintn_t{0}; i < count_; ++i) {
+      auto* fiber = fibers_[i];
+      if (fiber->state_ == Fiber::State::Done) {
+        fiber->stack_peak_ = fiber->measure_stack();
+        release(fiber);
+      } else {
+        fibers_[kept++] = fiber;
+      }
+    }
+    count_ = kept;
+  }
+
+  void release(Fiber* fiber) noexcept {
+    boot_services_->free_pages(fiber->stack_, fiber->stack_pages_);
+    fiber->stack_ = 0;
+    fiber->sp_    = nullptr;
+  }
+};
+
+}  // namespace efi
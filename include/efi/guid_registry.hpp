@@ -0,0 +1,219 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <bit>
+
+#include "system_table.hpp"
+#include "efi/protocol/simple_text_ex.hpp"
+#include "efi/protocol/pointer.hpp"
+#include "efi/protocol/serial.hpp"
+#include "efi/protocol/graphics_output.hpp"
+#include "efi/protocol/edid.hpp"
+#include "efi/protocol/device_path.hpp"
+#include "efi/protocol/load_file.hpp"
+#include "efi/protocol/file_system.hpp"
+#include "efi/protocol/file.hpp"
+#include "efi/protocol/disk_io.hpp"
+#include "efi/protocol/block_io.hpp"
+#include "efi/protocol/debug_support.hpp"
+#include "efi/protocol/debug_port.hpp"
+#include "protocol/nic.hpp"
+#include "protocol/simple_network.hpp"
+#include "protocol/managed_network.hpp"
+#include "protocol/ipv4.hpp"
+#include "protocol/arp.hpp"
+#include "protocol/dhcp.hpp"
+#include "protocol/dns_v4.hpp"
+#include "protocol/tcp_v4.hpp"
+
+namespace efi {
+
+// Reached only when no multiplier separates the registry entries, most
+// likely because a guid was added twice
+inline void guid_registry_collision_() noexcept {}
+
+// Every guid defined by the headers with its name. The id of a guid is its
+// index in the registry, so ids double as type ids of the protocols.
+//
+// Lookups are one multiply, one probe of a slot table and one compare: the
+// slot table is filled at compile time with the first multiplier that maps
+// every entry's Guid::hash to a slot of its own.
+class GuidRegistry final {
+ public:
+  using Id = uintn_t;
+
+  static constexpr auto no_id = ~Id{0};
+
+  struct Entry {
+    Guid        guid;
+    const char* name;
+  };
+
+ private:
+  static constexpr auto entries_ = std::array{
+      Entry{SimpleTextInputProtocol::guid, "SimpleTextInputProtocol"},
+      Entry{SimpleTextInputExProtocol::guid, "SimpleTextInputExProtocol"},
+      Entry{SimpleTextOutputProtocol::guid, "SimpleTextOutputProtocol"},
+      Entry{SimplePointerProtocol::guid, "SimplePointerProtocol"},
+      Entry{AbsolutePointerProtocol::guid, "AbsolutePointerProtocol"},
+      Entry{SerialIOProtocol::guid, "SerialIOProtocol"},
+      Entry{GraphicsOutputProtocol::guid, "GraphicsOutputProtocol"},
+      Entry{EdidDiscoveredProtocol::guid, "EdidDiscoveredProtocol"},
+      Entry{EdidActiveProtocol::guid, "EdidActiveProtocol"},
+      Entry{EdidOverrideProtocol::guid, "EdidOverrideProtocol"},
+      Entry{DevicePathProtocol::guid, "DevicePathProtocol"},
+      Entry{LoadFileProtocol::guid, "LoadFileProtocol"},
+      Entry{LoadFile2Protocol::guid, "LoadFile2Protocol"},
+      Entry{SimpleFileSystemProtocol::guid, "SimpleFileSystemProtocol"},
+      Entry{FileInfo::guid, "FileInfo"},
+      Entry{FileSystemInfo::guid, "FileSystemInfo"},
+      Entry{DiskIOProtocol::guid, "DiskIOProtocol"},
+      Entry{BlockIOProtocol::guid, "BlockIOProtocol"},
+      Entry{EraseBlockProtocol::guid, "EraseBlockProtocol"},
+      Entry{DebugSupportProtocol::guid, "DebugSupportProtocol"},
+      Entry{DebugPortProtocol::guid, "DebugPortProtocol"},
+      Entry{NetworkInterfaceIdentifierProtocol::guid,
+            "NetworkInterfaceIdentifierProtocol"},
+      Entry{SimpleNetworkProtocol::guid, "SimpleNetworkProtocol"},
+      Entry{ManagedNetworkProtocol::guid, "ManagedNetworkProtocol"},
+      Entry{Ipv4Protocol::guid, "Ipv4Protocol"},
+      Entry{ArpProtocol::guid, "ArpProtocol"},
+      Entry{DHCP4Protocol::guid, "DHCP4Protocol"},
+      Entry{DNS4Protocol::guid, "DNS4Protocol"},
+      Entry{Tcp4Protocol::guid, "Tcp4Protocol"},
+
+      // Configuration tables
+      Entry{MPSTableGuid, "MPSTableGuid"},
+      Entry{ACPITableGuid, "ACPITableGuid"},
+      Entry{ACPI20TableGuid, "ACPI20TableGuid"},
+      Entry{SMBIOSTableGuid, "SMBIOSTableGuid"},
+      Entry{SMBIOS3TableGuid, "SMBIOS3TableGuid"},
+      Entry{SALSystemTableGuid, "SALSystemTableGuid"},
+      Entry{DTBTableGuid, "DTBTableGuid"},
+
+      // Event groups
+      Entry{EventGroupExitBootServices, "EventGroupExitBootServices"},
+      Entry{EventGroupBeforeExitBootServices,
+            "EventGroupBeforeExitBootServices"},
+      Entry{EventGroupVirtualAddressChange, "EventGroupVirtualAddressChange"},
+      Entry{EventGroupMemoryMapChange, "EventGroupMemoryMapChange"},
+      Entry{EventGroupReadyToBoot, "EventGroupReadyToBoot"},
+      Entry{EventGroupAfterReadyToBoot, "EventGroupAfterReadyToBoot"},
+      Entry{EventGroupResetSystem, "EventGroupResetSystem"},
+
+      // Device path vendor guids
+      Entry{SerialIOProtocol::TerminalDeviceTypeGuid,
+            "SerialIOProtocol::TerminalDeviceTypeGuid"},
+      Entry{VendorMessagingDevicePath::PCAnsiGuid,
+            "VendorMessagingDevicePath::PCAnsiGuid"},
+      Entry{VendorMessagingDevicePath::VT100Guid,
+            "VendorMessagingDevicePath::VT100Guid"},
+      Entry{VendorMessagingDevicePath::VT100PlusGuid,
+            "VendorMessagingDevicePath::VT100PlusGuid"},
+      Entry{VendorMessagingDevicePath::VTUtf8Guid,
+            "VendorMessagingDevicePath::VTUtf8Guid"},
+      Entry{UartFlowControlMessagingDevicePath::UartFlowControlGuid,
+            "UartFlowControlMessagingDevicePath::UartFlowControlGuid"},
+      Entry{RamDiskDevicePath::VirtualDiskGuid,
+            "RamDiskDevicePath::VirtualDiskGuid"},
+      Entry{RamDiskDevicePath::VirtualCdGuid,
+            "RamDiskDevicePath::VirtualCdGuid"},
+      Entry{RamDiskDevicePath::PersistentVirtualDiskGuid,
+            "RamDiskDevicePath::PersistentVirtualDiskGuid"},
+      Entry{RamDiskDevicePath::PersistentVirtualCdGuid,
+            "RamDiskDevicePath::PersistentVirtualCdGuid"},
+  };
+
+  // About a quarter of the slots are used
+  static constexpr auto slot_bits  = std::bit_width(entries_.size()) + 2;
+  static constexpr auto slot_count = uintn_t{1} << slot_bits;
+  static constexpr auto slot_shift = 64 - slot_bits;
+  static constexpr auto empty_slot = uint8_t{0xff};
+  static constexpr auto max_seeds  = uint64_t{1} << 16;
+
+  static_assert(entries_.size() < empty_slot);
+
+  struct Table {
+    uint64_t                        multiplier;
+    std::array<uint8_t, slot_count> slots;
+  };
+
+  // Tries odd multipliers until no two entries share a slot
+  static constexpr auto table_ = [] {
+    for (auto seed = uint64_t{0}; seed < max_seeds; ++seed) {
+      auto table = Table{0x9e37'79b9'7f4a'7c15 + 2 * seed, {}};
+      table.slots.fill(empty_slot);
+
+      auto unique = true;
+      for (auto i = uintn_t{0}; i < entries_.size() && unique; ++i) {
+        const auto hash  = entries_[i].guid.hash();
+        auto&      index = table.slots[(hash * table.multiplier) >> slot_shift];
+        unique           = index == empty_slot;
+        index            = static_cast<uint8_t>(i);
+      }
+      if (unique) {
+        return table;
+      }
+    }
+
+    guid_registry_collision_();
+    return Table{};
+  }();
+
+ public:
+  GuidRegistry()                                       = delete;
+  GuidRegistry(GuidRegistry&&)                         = delete;
+  GuidRegistry(const GuidRegistry&)                    = delete;
+  auto operator=(GuidRegistry&&) -> GuidRegistry&      = delete;
+  auto operator=(const GuidRegistry&) -> GuidRegistry& = delete;
+
+  // no_id for guids not in the registry
+  NODISCARD static constexpr auto id(const Guid& guid) noexcept -> Id {
+    const auto hash  = guid.hash();
+    const auto index = table_.slots[(hash * table_.multiplier) >> slot_shift];
+    return index != empty_slot && entries_[index].guid == guid ? Id{index}
+                                                                 : no_id;
+  }
+
+  template <typename T>
+  NODISCARD static constexpr auto id_of() noexcept -> Id {
+    return id(T::guid);
+  }
+
+  // nullptr for guids not in the registry
+  NODISCARD static constexpr auto name(const Guid& guid) noexcept
+      -> const char* {
+    const auto index = id(guid);
+    return index != no_id ? entries_[index].name : nullptr;
+  }
+
+  NODISCARD static constexpr auto entry(Id id) noexcept -> const Entry& {
+    return entries_[id];
+  }
+
+  NODISCARD static constexpr auto size() noexcept -> uintn_t {
+    return entries_.size();
+  }
+
+};
+
+}  // namespace efi
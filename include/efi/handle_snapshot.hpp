@@ -0,0 +1,427 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <initializer_list>
+#include <span>
+#include <utility>
+
+#include "boot_services.hpp"
+
+namespace efi {
+
+// Copy of the handle database as one bitset of handles per protocol, so
+// "which handles have all of these protocols" is an AND over a few words.
+//
+// refresh enumerates every handle once, paying one protocols_per_handle
+// per handle. Protocols passed to watch get a protocol notify; update then
+// rescans only the handles those notifications name. Uninstalls are not
+// notified by the firmware and need a refresh or a rescan of the handle.
+class HandleSnapshot final {
+ public:
+  static constexpr auto max_handles   = uintn_t{512};
+  static constexpr auto max_protocols = uintn_t{128};
+  static constexpr auto max_watches   = uintn_t{32};
+
+  static constexpr auto word_bits  = uintn_t{64};
+  static constexpr auto word_count = max_handles / word_bits;
+
+  // Handle indices of a snapshot
+  class HandleSet final {
+   private:
+    std::array<uint64_t, word_count> words_{};
+
+   public:
+    constexpr HandleSet() noexcept = default;
+
+    NODISCARD auto contains(uintn_t index) const noexcept -> bool {
+      return index < max_handles &&
+             (words_[index / word_bits] >> (index % word_bits) & 1) != 0;
+    }
+
+    NODISCARD auto count() const noexcept -> uintn_t {
+      auto total = uintn_t{0};
+      for (const auto word : words_) {
+        total += static_cast<uintn_t>(std::popcount(word));
+      }
+      return total;
+    }
+
+    NODISCARD auto empty() const noexcept -> bool {
+      for (const auto word : words_) {
+        if (word != 0) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // First member at or after index, max_handles when there is none
+    NODISCARD auto next(uintn_t index) const noexcept -> uintn_t {
+      while (index < max_handles) {
+        const auto word =
+            words_[index / word_bits] >> (index % word_bits);
+        if (word != 0) {
+          return index + static_cast<uintn_t>(std::countr_zero(word));
+        }
+        index = (index / word_bits + 1) * word_bits;
+      }
+      return max_handles;
+    }
+
+    auto operator&=(const HandleSet& other) noexcept -> HandleSet& {
+      for (auto i = uintn_t{0}; i < word_count; ++i) {
+        words_[i] &= other.words_[i];
+      }
+      return *this;
+    }
+
+    auto operator|=(const HandleSet& other) noexcept -> HandleSet& {
+      for (auto i = uintn_t{0}; i < word_count; ++i) {
+        words_[i] |= other.words_[i];
+      }
+      return *this;
+    }
+
+    // Members of this set missing from other
+    auto subtract(const HandleSet& other) noexcept -> HandleSet& {
+      for (auto i = uintn_t{0}; i < word_count; ++i) {
+        words_[i] &= ~other.words_[i];
+      }
+      return *this;
+    }
+
+   private:
+    void set(uintn_t index) noexcept {
+      words_[index / word_bits] |= uint64_t{1} << (index % word_bits);
+    }
+
+    void reset(uintn_t index) noexcept {
+      words_[index / word_bits] &= ~(uint64_t{1} << (index % word_bits));
+    }
+
+    friend class HandleSnapshot;
+  };
+
+  struct Stats {
+    uint64_t refreshes;
+    uint64_t scans;
+
+    // Handles or protocols left out for lack of room
+    uint64_t dropped;
+  };
+
+ private:
+  static constexpr auto no_index = ~uintn_t{0};
+
+  struct Watch {
+    HandleSnapshot* snapshot     = nullptr;
+    Guid            guid         = Guid{Guid::Bytes{}};
+    Event           event        = nullptr;
+    void*           registration = nullptr;
+  };
+
+  BootServices* const boot_services_;
+
+  // Rows: handles, live_ marks the ones still present
+  std::array<Handle, max_handles> handles_{};
+  uintn_t                         handle_count_ = 0;
+  HandleSet                       live_{};
+
+  // Columns: one handle set per protocol
+  std::array<Guid, max_protocols>      guids_;
+  std::array<HandleSet, max_protocols> members_{};
+  uintn_t                              protocol_count_ = 0;
+
+  std::array<Watch, max_watches> watches_{};
+  uintn_t                        watch_count_ = 0;
+  std::atomic<uint32_t>          pending_{0};
+
+  Stats stats_{};
+
+ public:
+  explicit HandleSnapshot(BootServices* boot_services) noexcept
+      : boot_services_{boot_services}, guids_{empty_guids()} {}
+
+  ~HandleSnapshot() {
+    for (auto i = uintn_t{0}; i < watch_count_; ++i) {
+      boot_services_->close_event(watches_[i].event);
+    }
+  }
+
+  HandleSnapshot()                                         = delete;
+  HandleSnapshot(HandleSnapshot&&)                         = delete;
+  HandleSnapshot(const HandleSnapshot&)                    = delete;
+  auto operator=(HandleSnapshot&&) -> HandleSnapshot&      = delete;
+  auto operator=(const HandleSnapshot&) -> HandleSnapshot& = delete;
+
+  // Rebuilds the snapshot from every handle. BufferTooSmall when handles or
+  // protocols did not fit, the snapshot then holds the ones that did.
+  auto refresh() noexcept -> Status {
+    handle_count_   = 0;
+    protocol_count_ = 0;
+    live_           = HandleSet{};
+    for (auto& members : members_) {
+      members = HandleSet{};
+    }
+    stats_.refreshes++;
+
+    // Earlier notifications are covered by the full scan
+    pending_.store(0, std::memory_order_relaxed);
+
+    auto  count   = uintn_t{0};
+    auto* handles = static_cast<Handle*>(nullptr);
+    auto  status  = boot_services_->locate_handle_buffer(&count, &handles);
+    if (status != Status::Success) {
+      return status;
+    }
+
+    const auto before = stats_.dropped;
+    for (auto i = uintn_t{0}; i < count; ++i) {
+      rescan(handles[i]);
+    }
+    boot_services_->free_pool(handles);
+
+    return stats_.dropped == before ? Status::Success : Status::BufferTooSmall;
+  }
+
+  // Re-reads the protocols of one handle, dropping it when it is gone
+  auto rescan(Handle handle) noexcept -> Status {
+    if (handle == nullptr) {
+      return Status::InvalidParameter;
+    }
+    stats_.scans++;
+
+    auto index = find(handle);
+
+    Guid** protocols = nullptr;
+    auto   count     = uintn_t{0};
+    const auto status =
+        boot_services_->protocols_per_handle(handle, &protocols, &count);
+    if (status != Status::Success) {
+      if (index != no_index) {
+        remove(index);
+      }
+      return status;
+    }
+
+    if (index == no_index) {
+      index = insert(handle);
+    } else {
+      clear_row(index);
+    }
+
+    if (index != no_index) {
+      for (auto i = uintn_t{0}; i < count; ++i) {
+        const auto column = intern(*protocols[i]);
+        if (column != no_index) {
+          members_[column].set(index);
+        } else {
+          stats_.dropped++;
+        }
+      }
+    }
+
+    boot_services_->free_pool(protocols);
+    return index != no_index ? Status::Success : Status::BufferTooSmall;
+  }
+
+  // Keeps the snapshot current for installs of protocol, through update
+  auto watch(const Guid& protocol) noexcept -> Status {
+    for (auto i = uintn_t{0}; i < watch_count_; ++i) {
+      if (watches_[i].guid == protocol) {
+        return Status::Success;
+      }
+    }
+    if (watch_count_ == max_watches) {
+      return Status::OutOfResources;
+    }
+
+    auto& watch = watches_[watch_count_];
+    watch       = Watch{this, protocol, nullptr, nullptr};
+
+    auto status = boot_services_->create_event(
+        EventType::NotifySignal, TplCallback, &on_notify, &watch,
+        &watch.event);
+    if (status != Status::Success) {
+      return status;
+    }
+
+    status = boot_services_->register_protocol_notify(protocol, watch.event,
+                                                      &watch.registration);
+    if (status != Status::Success) {
+      boot_services_->close_event(watch.event);
+      return status;
+    }
+
+    watch_count_++;
+    return Status::Success;
+  }
+
+  // Rescans the handles named by notifications since the last update and
+  // returns how many
+  auto update() noexcept -> uintn_t {
+    auto scanned = uintn_t{0};
+    auto pending = pending_.exchange(0, std::memory_order_acquire);
+    while (pending != 0) {
+      const auto& watch = watches_[std::countr_zero(pending)];
+      pending          &= pending - 1;
+
+      for (;;) {
+        auto handle = Handle{};
+        auto size   = uintn_t{sizeof(handle)};
+        if (boot_services_->locate_handle(LocateSearchType::ByRegisterNotify,
+                                          watch.guid, watch.registration,
+                                          &size, &handle) != Status::Success) {
+          break;
+        }
+        rescan(handle);
+        scanned++;
+      }
+    }
+    return scanned;
+  }
+
+  // Handles having every one of protocols, an unknown protocol gives an
+  // empty set
+  NODISCARD auto query(std::span<const Guid> protocols) const noexcept
+      -> HandleSet {
+    auto result = live_;
+    for (const auto& protocol : protocols) {
+      const auto column = find(protocol);
+      if (column == no_index) {
+        return HandleSet{};
+      }
+      result &= members_[column];
+    }
+    return result;
+  }
+
+  NODISCARD auto query(std::initializer_list<Guid> protocols) const noexcept
+      -> HandleSet {
+    return query(std::span<const Guid>{protocols.begin(), protocols.size()});
+  }
+
+  NODISCARD auto handle(uintn_t index) const noexcept -> Handle {
+    return live_.contains(index) ? handles_[index] : nullptr;
+  }
+
+  // Copies the handles of set, up to capacity, and returns how many
+  auto handles(const HandleSet& set, Handle* buffer,
+               uintn_t capacity) const noexcept -> uintn_t {
+    auto count = uintn_t{0};
+    auto index = set.next(0);
+    while (index < max_handles && count < capacity) {
+      buffer[count++] = handles_[index];
+      index           = set.next(index + 1);
+    }
+    return count;
+  }
+
+  NODISCARD auto& all() const noexcept {
+    return live_;
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  NODISCARD static auto empty_guids() noexcept
+      -> std::array<Guid, max_protocols> {
+    return [&]<uintn_t... I>(std::index_sequence<I...>) {
+      return std::array<Guid, max_protocols>{
+          ((void)I, Guid{Guid::Bytes{}})...};
+    }(std::make_index_sequence<max_protocols>{});
+  }
+
+  static EFI_CALL void on_notify(Event /*event*/, void* context) noexcept {
+    auto*      watch    = static_cast<Watch*>(context);
+    auto*      snapshot = watch->snapshot;
+    const auto bit = uint32_t{1} << (watch - snapshot->watches_.data());
+    snapshot->pending_.fetch_or(bit, std::memory_order_release);
+  }
+
+  NODISCARD auto find(Handle handle) const noexcept -> uintn_t {
+    for (auto i = uintn_t{0}; i < handle_count_; ++i) {
+      if (handles_[i] == handle && live_.contains(i)) {
+        return i;
+      }
+    }
+    return no_index;
+  }
+
+  NODISCARD auto find(const Guid& protocol) const noexcept -> uintn_t {
+    for (auto i = uintn_t{0}; i < protocol_count_; ++i) {
+      if (guids_[i] == protocol) {
+        return i;
+      }
+    }
+    return no_index;
+  }
+
+  // Column of protocol, added when new
+  auto intern(const Guid& protocol) noexcept -> uintn_t {
+    if (const auto column = find(protocol); column != no_index) {
+      return column;
+    }
+    if (protocol_count_ == max_protocols) {
+      return no_index;
+    }
+    guids_[protocol_count_] = protocol;
+    return protocol_count_++;
+  }
+
+  // Reuses the row of a removed handle first
+  auto insert(Handle handle) noexcept -> uintn_t {
+    auto index = uintn_t{0};
+    while (index < handle_count_ && live_.contains(index)) {
+      ++index;
+    }
+    if (index == max_handles) {
+      stats_.dropped++;
+      return no_index;
+    }
+    if (index == handle_count_) {
+      handle_count_++;
+    }
+
+    handles_[index] = handle;
+    live_.set(index);
+    return index;
+  }
+
+  void remove(uintn_t index) noexcept {
+    clear_row(index);
+    live_.reset(index);
+    handles_[index] = nullptr;
+  }
+
+  void clear_row(uintn_t index) noexcept {
+    for (auto i = uintn_t{0}; i < protocol_count_; ++i) {
+      members_[i].reset(index);
+    }
+  }
+};
+
+}  // namespace efi
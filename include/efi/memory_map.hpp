@@ -0,0 +1,290 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <cstddef>
+#include <iterator>
+
+#include "boot_services.hpp"
+
+namespace efi {
+
+// View over a buffer filled by get_memory_map. Descriptors are addressed by
+// the descriptor_size the firmware reported, which may be larger than
+// sizeof(MemoryDescriptor), so the buffer is never copied or repacked.
+//
+// sort and coalesce work in place, find requires a sorted map.
+class MemoryMapView final {
+ public:
+  class Iterator final {
+   public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type        = MemoryDescriptor;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = MemoryDescriptor*;
+    using reference         = MemoryDescriptor&;
+
+   private:
+    uint8_t* position_ = nullptr;
+    uintn_t  stride_   = 0;
+
+   public:
+    constexpr Iterator() noexcept = default;
+
+    constexpr Iterator(uint8_t* position, uintn_t stride) noexcept
+        : position_{position}, stride_{stride} {}
+
+    NODISCARD auto operator*() const noexcept -> reference {
+      return *reinterpret_cast<MemoryDescriptor*>(position_);
+    }
+
+    NODISCARD auto operator->() const noexcept -> pointer {
+      return reinterpret_cast<MemoryDescriptor*>(position_);
+    }
+
+    NODISCARD auto operator[](difference_type n) const noexcept -> reference {
+      return *(*this + n);
+    }
+
+    auto operator++() noexcept -> Iterator& {
+      position_ += stride_;
+      return *this;
+    }
+
+    auto operator++(int) noexcept -> Iterator {
+      auto copy = *this;
+      position_ += stride_;
+      return copy;
+    }
+
+    auto operator--() noexcept -> Iterator& {
+      position_ -= stride_;
+      return *this;
+    }
+
+    auto operator--(int) noexcept -> Iterator {
+      auto copy = *this;
+      position_ -= stride_;
+      return copy;
+    }
+
+    auto operator+=(difference_type n) noexcept -> Iterator& {
+      position_ += n * static_cast<difference_type>(stride_);
+      return *this;
+    }
+
+    auto operator-=(difference_type n) noexcept -> Iterator& {
+      position_ -= n * static_cast<difference_type>(stride_);
+      return *this;
+    }
+
+    NODISCARD friend auto operator+(Iterator it, difference_type n) noexcept
+        -> Iterator {
+      return it += n;
+    }
+
+    NODISCARD friend auto operator+(difference_type n, Iterator it) noexcept
+        -> Iterator {
+      return it += n;
+    }
+
+    NODISCARD friend auto operator-(Iterator it, difference_type n) noexcept
+        -> Iterator {
+      return it -= n;
+    }
+
+    NODISCARD friend auto operator-(const Iterator& lhs,
+                                    const Iterator& rhs) noexcept
+        -> difference_type {
+      return (lhs.position_ - rhs.position_) /
+             static_cast<difference_type>(lhs.stride_);
+    }
+
+    NODISCARD auto operator==(const Iterator& other) const noexcept -> bool {
+      return position_ == other.position_;
+    }
+
+    NODISCARD auto operator<=>(const Iterator& other) const noexcept {
+      return position_ <=> other.position_;
+    }
+  };
+
+ private:
+  uint8_t* buffer_;
+  uintn_t  map_size_;
+  uintn_t  descriptor_size_;
+
+ public:
+  // map_size and descriptor_size as returned by get_memory_map
+  MemoryMapView(MemoryDescriptor* memory_map, uintn_t map_size,
+                uintn_t descriptor_size) noexcept
+      : buffer_{reinterpret_cast<uint8_t*>(memory_map)},
+        map_size_{map_size},
+        descriptor_size_{descriptor_size} {}
+
+  NODISCARD auto size() const noexcept -> uintn_t {
+    return descriptor_size_ != 0 ? map_size_ / descriptor_size_ : 0;
+  }
+
+  NODISCARD auto empty() const noexcept {
+    return size() == 0;
+  }
+
+  // Bytes covered by the descriptors, shrinks after coalesce
+  NODISCARD auto map_size() const noexcept {
+    return map_size_;
+  }
+
+  NODISCARD auto descriptor_size() const noexcept {
+    return descriptor_size_;
+  }
+
+  NODISCARD auto begin() const noexcept {
+    return Iterator{buffer_, descriptor_size_};
+  }
+
+  NODISCARD auto end() const noexcept {
+    return Iterator{buffer_ + size() * descriptor_size_, descriptor_size_};
+  }
+
+  NODISCARD auto operator[](uintn_t index) const noexcept -> MemoryDescriptor& {
+    return *reinterpret_cast<MemoryDescriptor*>(buffer_ +
+                                                index * descriptor_size_);
+  }
+
+  NODISCARD auto is_sorted() const noexcept -> bool {
+    for (auto i = uintn_t{1}; i < size(); ++i) {
+      if ((*this)[i].physical_start_ < (*this)[i - 1].physical_start_) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Insertion sort by physical_start. Firmware maps are almost always sorted
+  // already, which makes this a single pass, and the whole descriptor stride
+  // is moved so any trailing firmware data travels with its descriptor.
+  void sort() noexcept {
+    for (auto i = uintn_t{1}; i < size(); ++i) {
+      for (auto j = i; j > 0; --j) {
+        if ((*this)[j - 1].physical_start_ <= (*this)[j].physical_start_) {
+          break;
+        }
+        swap(j, j - 1);
+      }
+    }
+  }
+
+  // Merges physically and virtually contiguous neighbours with the same type
+  // and attributes, compacting the buffer. Returns the new descriptor count.
+  auto coalesce() noexcept -> uintn_t {
+    if (empty()) {
+      return 0;
+    }
+
+    auto last = uintn_t{0};
+    for (auto i = uintn_t{1}; i < size(); ++i) {
+      auto&       into = (*this)[last];
+      const auto& next = (*this)[i];
+
+      if (into.type_ == next.type_ && into.attribute_ == next.attribute_ &&
+          into.physical_end() == next.physical_start_ &&
+          virtually_contiguous(into, next)) {
+        into.number_of_pages_ += next.number_of_pages_;
+        continue;
+      }
+
+      if (++last != i) {
+        copy(last, i);
+      }
+    }
+
+    map_size_ = (last + 1) * descriptor_size_;
+    return last + 1;
+  }
+
+  // Binary search for the descriptor containing address, nullptr when the
+  // address is not described. The map must be sorted.
+  NODISCARD auto find(PhysicalAddress address) const noexcept
+      -> MemoryDescriptor* {
+    auto low  = uintn_t{0};
+    auto high = size();
+    while (low < high) {
+      const auto middle = low + (high - low) / 2;
+      if ((*this)[middle].physical_start_ <= address) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+
+    if (low == 0) {
+      return nullptr;
+    }
+
+    auto& descriptor = (*this)[low - 1];
+    return descriptor.contains(address) ? &descriptor : nullptr;
+  }
+
+  // Total pages of the given type
+  NODISCARD auto pages(MemoryType type) const noexcept -> uint64_t {
+    auto pages = uint64_t{0};
+    for (const auto& descriptor : *this) {
+      if (descriptor.type_ == type) {
+        pages += descriptor.number_of_pages_;
+      }
+    }
+    return pages;
+  }
+
+ private:
+  // Virtual addresses are zero until SetVirtualAddressMap assigns them
+  NODISCARD static auto virtually_contiguous(
+      const MemoryDescriptor& into, const MemoryDescriptor& next) noexcept
+      -> bool {
+    if (into.virtual_start_ == 0 && next.virtual_start_ == 0) {
+      return true;
+    }
+    return into.virtual_start_ + into.number_of_pages_ * page_size ==
+           next.virtual_start_;
+  }
+
+  void swap(uintn_t a, uintn_t b) noexcept {
+    auto* lhs = buffer_ + a * descriptor_size_;
+    auto* rhs = buffer_ + b * descriptor_size_;
+    for (auto i = uintn_t{0}; i < descriptor_size_; ++i) {
+      const auto byte = lhs[i];
+      lhs[i]          = rhs[i];
+      rhs[i]          = byte;
+    }
+  }
+
+  void copy(uintn_t to, uintn_t from) noexcept {
+    auto*       dst = buffer_ + to * descriptor_size_;
+    const auto* src = buffer_ + from * descriptor_size_;
+    for (auto i = uintn_t{0}; i < descriptor_size_; ++i) {
+      dst[i] = src[i];
+    }
+  }
+};
+
+static_assert(std::random_access_iterator<MemoryMapView::Iterator>);
+
+}  // namespace efi
@@ -0,0 +1,200 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <memory_resource>
+
+#include "boot_services.hpp"
+#include "page_arena.hpp"
+
+namespace efi {
+
+// std::pmr adapters over firmware memory, so pmr containers can be used in
+// boot code without a global operator new.
+//
+// memory_resource reports failure by throwing, the adapters defer that to
+// null_memory_resource so this header never throws itself.
+
+#pragma region Pool
+
+class PoolMemoryResource final : public std::pmr::memory_resource {
+ public:
+  // allocate_pool only guarantees 8 byte alignment
+  static constexpr auto pool_alignment = uintn_t{8};
+
+ private:
+  BootServices* const boot_services_;
+  const MemoryType    memory_type_;
+
+ public:
+  explicit PoolMemoryResource(
+      BootServices* boot_services,
+      MemoryType    memory_type = MemoryType::LoaderData) noexcept
+      : boot_services_{boot_services}, memory_type_{memory_type} {}
+
+  PoolMemoryResource()                                             = delete;
+  PoolMemoryResource(PoolMemoryResource&&)                         = delete;
+  PoolMemoryResource(const PoolMemoryResource&)                    = delete;
+  auto operator=(PoolMemoryResource&&) -> PoolMemoryResource&      = delete;
+  auto operator=(const PoolMemoryResource&) -> PoolMemoryResource& = delete;
+
+  NODISCARD auto memory_type() const noexcept {
+    return memory_type_;
+  }
+
+ private:
+  auto do_allocate(size_t bytes, size_t alignment) -> void* override {
+    if (alignment <= pool_alignment) {
+      void* memory = nullptr;
+      if (boot_services_->allocate_pool(memory_type_, bytes, &memory) !=
+          Status::Success) {
+        return std::pmr::null_memory_resource()->allocate(bytes, alignment);
+      }
+      return memory;
+    }
+
+    // Over aligned blocks keep the pool pointer just ahead of the block
+    const auto padded = bytes + alignment + sizeof(void*);
+    void*      memory = nullptr;
+    if (padded < bytes ||
+        boot_services_->allocate_pool(memory_type_, padded, &memory) !=
+            Status::Success) {
+      return std::pmr::null_memory_resource()->allocate(bytes, alignment);
+    }
+
+    const auto address =
+        (reinterpret_cast<uintn_t>(memory) + sizeof(void*) + alignment - 1) &
+        ~(alignment - 1);
+    reinterpret_cast<void**>(address)[-1] = memory;
+    return reinterpret_cast<void*>(address);
+  }
+
+  void do_deallocate(void* memory, size_t, size_t alignment) override {
+    if (alignment > pool_alignment) {
+      memory = static_cast<void**>(memory)[-1];
+    }
+    boot_services_->free_pool(memory);
+  }
+
+  NODISCARD auto do_is_equal(const std::pmr::memory_resource& other)
+      const noexcept -> bool override {
+    return this == &other;
+  }
+};
+
+#pragma endregion
+
+#pragma region Page
+
+// Every allocation is its own page run, suited to large buffers
+class PageMemoryResource final : public std::pmr::memory_resource {
+ private:
+  BootServices* const boot_services_;
+  const MemoryType    memory_type_;
+
+ public:
+  explicit PageMemoryResource(
+      BootServices* boot_services,
+      MemoryType    memory_type = MemoryType::LoaderData) noexcept
+      : boot_services_{boot_services}, memory_type_{memory_type} {}
+
+  PageMemoryResource()                                             = delete;
+  PageMemoryResource(PageMemoryResource&&)                         = delete;
+  PageMemoryResource(const PageMemoryResource&)                    = delete;
+  auto operator=(PageMemoryResource&&) -> PageMemoryResource&      = delete;
+  auto operator=(const PageMemoryResource&) -> PageMemoryResource& = delete;
+
+  NODISCARD auto memory_type() const noexcept {
+    return memory_type_;
+  }
+
+ private:
+  // At least one, std::pmr wants a valid block for 0 bytes too
+  NODISCARD static auto pages(size_t bytes) noexcept -> uintn_t {
+    return bytes != 0 ? (bytes + page_size - 1) / page_size : 1;
+  }
+
+  auto do_allocate(size_t bytes, size_t alignment) -> void* override {
+    auto memory = PhysicalAddress{};
+    if (alignment > page_size ||
+        boot_services_->allocate_pages(AllocateType::AnyPages, memory_type_,
+                                       pages(bytes), &memory) !=
+            Status::Success) {
+      return std::pmr::null_memory_resource()->allocate(bytes, alignment);
+    }
+    return reinterpret_cast<void*>(memory);
+  }
+
+  void do_deallocate(void* memory, size_t bytes, size_t) override {
+    boot_services_->free_pages(reinterpret_cast<PhysicalAddress>(memory),
+                               pages(bytes));
+  }
+
+  NODISCARD auto do_is_equal(const std::pmr::memory_resource& other)
+      const noexcept -> bool override {
+    return this == &other;
+  }
+};
+
+#pragma endregion
+
+#pragma region Monotonic
+
+// Deallocation is a no-op, memory is returned when the arena is rewound or
+// released
+class MonotonicMemoryResource final : public std::pmr::memory_resource {
+ private:
+  PageArena& arena_;
+
+ public:
+  explicit MonotonicMemoryResource(PageArena& arena) noexcept
+      : arena_{arena} {}
+
+  MonotonicMemoryResource()                               = delete;
+  MonotonicMemoryResource(MonotonicMemoryResource&&)      = delete;
+  MonotonicMemoryResource(const MonotonicMemoryResource&) = delete;
+  auto operator=(MonotonicMemoryResource&&)
+      -> MonotonicMemoryResource& = delete;
+  auto operator=(const MonotonicMemoryResource&)
+      -> MonotonicMemoryResource& = delete;
+
+  NODISCARD auto& arena() const noexcept {
+    return arena_;
+  }
+
+ private:
+  auto do_allocate(size_t bytes, size_t alignment) -> void* override {
+    if (auto* memory = arena_.allocate(bytes, alignment); memory != nullptr) {
+      return memory;
+    }
+    return std::pmr::null_memory_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void*, size_t, size_t) override {}
+
+  NODISCARD auto do_is_equal(const std::pmr::memory_resource& other)
+      const noexcept -> bool override {
+    return this == &other;
+  }
+};
+
+#pragma endregion
+
+}  // namespace efi
@@ -0,0 +1,99 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+// Host-side firmware used to exercise the wrappers without booting real
+// firmware. Every table entry is a real EFI_CALL function backed by the host
+// OS, so code written against SystemTable / BootServices runs unmodified.
+//
+// Only one Firmware may be alive at a time, the boot service entry points
+// carry no context and resolve the active instance globally.
+
+#include <memory>
+#include <string_view>
+
+#include "efi/system_table.hpp"
+#include "efi/net_core.hpp"
+
+namespace efi::mock {
+
+namespace detail {
+class State;
+}  // namespace detail
+
+struct FirmwareConfig {
+  // Host memory handed out by allocate_pages and described by get_memory_map
+  uint64_t memory_size        = 64 * 1024 * 1024;
+
+  // Extra bytes appended to every descriptor returned by get_memory_map, real
+  // firmware commonly reports a descriptor_size larger than the structure
+  uintn_t  descriptor_padding = 8;
+
+  // Echo con_out / std_err to the host stdout / stderr
+  bool     echo_console       = false;
+};
+
+class Firmware final {
+ private:
+  std::unique_ptr<detail::State> state_;
+
+ public:
+  explicit Firmware(const FirmwareConfig& config = {});
+  ~Firmware();
+
+  Firmware(Firmware&&)                         = delete;
+  Firmware(const Firmware&)                    = delete;
+  auto operator=(Firmware&&) -> Firmware&      = delete;
+  auto operator=(const Firmware&) -> Firmware& = delete;
+
+  NODISCARD auto system_table() const noexcept -> SystemTable*;
+
+  NODISCARD auto boot_services() const noexcept -> BootServices*;
+
+  NODISCARD auto runtime_services() const noexcept -> RuntimeServices*;
+
+  NODISCARD auto image_handle() const noexcept -> Handle;
+
+  NODISCARD auto map_key() const noexcept -> uintn_t;
+
+  NODISCARD auto boot_services_exited() const noexcept -> bool;
+
+  // Everything written to con_out and std_err, converted to UTF-8
+  NODISCARD auto console_output() const noexcept -> std::string_view;
+
+  // Installs a BlockIOProtocol backed by the host file at path
+  auto add_block_device(const char* path, uint32_t block_size,
+                        Handle* handle) noexcept -> Status;
+
+  // Installs an empty in-memory SimpleFileSystemProtocol
+  auto add_file_system(Handle* handle) noexcept -> Status;
+
+  // Creates a file (and any missing directories) in a file system installed by
+  // add_file_system, path components are separated by '\'
+  auto add_file(Handle file_system, const char16_t* path, const void* data,
+                uintn_t size) noexcept -> Status;
+
+  // Installs a SimpleNetworkProtocol whose transmitted frames are received
+  // back on the same interface
+  auto add_loopback_network(const MacAddress& address, Handle* handle) noexcept
+      -> Status;
+};
+
+}  // namespace efi::mock
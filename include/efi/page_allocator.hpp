@@ -0,0 +1,420 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <bit>
+
+#include "memory_map.hpp"
+
+namespace efi {
+
+// Buddy allocator over physical pages for use after exit_boot_services, seeded
+// from the final memory map without any firmware call.
+//
+// Blocks are naturally aligned to their size, so an order 9 block is a 2MiB
+// aligned 2MiB range usable as a large page. Free blocks hold their own list
+// links, which assumes physical memory is identity mapped as the firmware
+// leaves it. Page state is one byte per page, carved from the largest
+// ConventionalMemory range. Physical page 0 is never handed out.
+class PageAllocator final {
+ public:
+  static constexpr auto max_order = uintn_t{18};
+  static constexpr auto max_zones = uintn_t{64};
+
+  struct Stats {
+    uint64_t total_pages;
+    uint64_t free_pages;
+    uint64_t metadata_pages;
+
+    // Usable pages not managed because max_zones was exceeded
+    uint64_t dropped_pages;
+
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t splits;
+    uint64_t merges;
+  };
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+    FreeBlock* previous;
+  };
+
+  // A contiguous run of managed pages, state has one byte per page
+  struct Zone {
+    uint64_t first_page;
+    uint64_t pages;
+    uint8_t* state;
+
+    NODISCARD auto end_page() const noexcept {
+      return first_page + pages;
+    }
+  };
+
+  // State of the first page of a block, every other page is zero
+  static constexpr auto state_free      = uint8_t{0x80};
+  static constexpr auto state_allocated = uint8_t{0x40};
+  static constexpr auto state_order     = uint8_t{0x3f};
+
+  std::array<FreeBlock*, max_order + 1> free_lists_{};
+  std::array<Zone, max_zones>           zones_{};
+  uintn_t                               zone_count_    = 0;
+  uint64_t                              metadata_page_ = 0;
+  Stats                                 stats_{};
+
+ public:
+  PageAllocator() noexcept = default;
+
+  PageAllocator(PageAllocator&&)                         = delete;
+  PageAllocator(const PageAllocator&)                    = delete;
+  auto operator=(PageAllocator&&) -> PageAllocator&      = delete;
+  auto operator=(const PageAllocator&) -> PageAllocator& = delete;
+
+  // Smallest order holding pages
+  NODISCARD static constexpr auto order_for(uintn_t pages) noexcept
+      -> uintn_t {
+    return pages <= 1 ? 0 : std::bit_width(pages - 1);
+  }
+
+  // ConventionalMemory, and boot services memory when requested, becomes
+  // free. Loader ranges are managed but start allocated, hand them over with
+  // reclaim once the kernel no longer needs them. Sorts map in place.
+  auto seed(MemoryMapView map, bool include_boot_services = true) noexcept
+      -> Status {
+    if (zone_count_ != 0) {
+      return Status::AlreadyStarted;
+    }
+
+    map.sort();
+
+    for (const auto& descriptor : map) {
+      if (managed(descriptor.type(), include_boot_services)) {
+        add_zone(descriptor);
+      }
+    }
+
+    // Carve the page state from the largest free range
+    auto state_bytes = uint64_t{0};
+    for (auto i = uintn_t{0}; i < zone_count_; ++i) {
+      state_bytes += zones_[i].pages;
+    }
+    const auto state_pages = (state_bytes + page_size - 1) / page_size;
+
+    const MemoryDescriptor* carve = nullptr;
+    for (const auto& descriptor : map) {
+      if (descriptor.type() == MemoryType::ConventionalMemory &&
+          usable_pages(descriptor) >= state_pages &&
+          (carve == nullptr ||
+           usable_pages(descriptor) > usable_pages(*carve))) {
+        carve = &descriptor;
+      }
+    }
+    if (carve == nullptr) {
+      zone_count_ = 0;
+      return Status::OutOfResources;
+    }
+
+    const auto carve_first = first_usable_page(*carve);
+    auto* state = reinterpret_cast<uint8_t*>(carve_first * page_size);
+    for (auto i = uintn_t{0}; i < zone_count_; ++i) {
+      zones_[i].state = state;
+      for (auto page = uint64_t{0}; page < zones_[i].pages; ++page) {
+        state[page] = 0;
+      }
+      state += zones_[i].pages;
+    }
+    metadata_page_        = carve_first;
+    stats_.metadata_pages = state_pages;
+
+    for (const auto& descriptor : map) {
+      if (!free_type(descriptor.type(), include_boot_services)) {
+        continue;
+      }
+
+      // Ranges past max_zones were counted in dropped_pages by add_zone
+      auto       first = first_usable_page(descriptor);
+      const auto end   = descriptor.physical_end() / page_size;
+      if (first >= end || find_zone(first) == nullptr) {
+        continue;
+      }
+      if (&descriptor == carve) {
+        first += state_pages;
+      }
+      if (first < end) {
+        release_range(first, end - first);
+      }
+    }
+
+    return Status::Success;
+  }
+
+  auto allocate(uintn_t order, PhysicalAddress* address) noexcept -> Status {
+    if (address == nullptr || order > max_order) {
+      return Status::InvalidParameter;
+    }
+
+    auto current = order;
+    while (current <= max_order && free_lists_[current] == nullptr) {
+      ++current;
+    }
+    if (current > max_order) {
+      return Status::OutOfResources;
+    }
+
+    const auto page = pop(current);
+
+    // Split down, returning the upper halves
+    while (current > order) {
+      --current;
+      push(page + (uint64_t{1} << current), current);
+      stats_.splits++;
+    }
+
+    *state_of(page) = state_allocated | static_cast<uint8_t>(order);
+    stats_.allocations++;
+    *address = page * page_size;
+    return Status::Success;
+  }
+
+  auto allocate_pages(uintn_t pages, PhysicalAddress* address) noexcept
+      -> Status {
+    return allocate(order_for(pages), address);
+  }
+
+  // address must be the start of a block returned by allocate
+  auto free(PhysicalAddress address) noexcept -> Status {
+    auto* state = address % page_size == 0 ? state_of(address / page_size)
+                                           : nullptr;
+    if (state == nullptr || (*state & state_allocated) == 0) {
+      return Status::InvalidParameter;
+    }
+
+    const auto order = static_cast<uintn_t>(*state & state_order);
+    *state           = 0;
+    stats_.frees++;
+    free_block(address / page_size, order);
+    return Status::Success;
+  }
+
+  // Frees pages that were seeded as allocated, such as loader data.
+  // InvalidParameter when any page of the range was free, handed out by
+  // allocate, reclaimed before or holds the page state.
+  auto reclaim(PhysicalAddress address, uint64_t pages) noexcept -> Status {
+    if (address % page_size != 0 || pages == 0) {
+      return Status::InvalidParameter;
+    }
+
+    const auto  first = address / page_size;
+    const auto* zone  = find_zone(first);
+    if (zone == nullptr || first + pages > zone->end_page()) {
+      return Status::InvalidParameter;
+    }
+    if (first < metadata_page_ + stats_.metadata_pages &&
+        metadata_page_ < first + pages) {
+      return Status::InvalidParameter;
+    }
+    for (auto page = first; page < first + pages; ++page) {
+      if (!seeded_allocated(*zone, page)) {
+        return Status::InvalidParameter;
+      }
+    }
+
+    release_range(first, pages);
+    return Status::Success;
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  NODISCARD static auto managed(MemoryType type,
+                                bool include_boot_services) noexcept -> bool {
+    return free_type(type, include_boot_services) ||
+           type == MemoryType::LoaderCode || type == MemoryType::LoaderData ||
+           type == MemoryType::BootServicesCode ||
+           type == MemoryType::BootServicesData;
+  }
+
+  NODISCARD static auto free_type(MemoryType type,
+                                  bool include_boot_services) noexcept -> bool {
+    return type == MemoryType::ConventionalMemory ||
+           (include_boot_services && (type == MemoryType::BootServicesCode ||
+                                      type == MemoryType::BootServicesData));
+  }
+
+  NODISCARD static auto first_usable_page(
+      const MemoryDescriptor& descriptor) noexcept -> uint64_t {
+    const auto first = descriptor.physical_start() / page_size;
+    return first == 0 ? 1 : first;
+  }
+
+  NODISCARD static auto usable_pages(
+      const MemoryDescriptor& descriptor) noexcept -> uint64_t {
+    const auto end   = descriptor.physical_end() / page_size;
+    const auto first = first_usable_page(descriptor);
+    return first < end ? end - first : 0;
+  }
+
+  void add_zone(const MemoryDescriptor& descriptor) noexcept {
+    const auto first = first_usable_page(descriptor);
+    const auto pages = usable_pages(descriptor);
+    if (pages == 0) {
+      return;
+    }
+
+    if (zone_count_ != 0 && zones_[zone_count_ - 1].end_page() == first) {
+      zones_[zone_count_ - 1].pages += pages;
+      return;
+    }
+
+    if (zone_count_ == max_zones) {
+      stats_.dropped_pages += pages;
+      return;
+    }
+
+    zones_[zone_count_++] = Zone{first, pages, nullptr};
+  }
+
+  NODISCARD auto find_zone(uint64_t page) const noexcept -> const Zone* {
+    auto low  = uintn_t{0};
+    auto high = zone_count_;
+    while (low < high) {
+      const auto middle = low + (high - low) / 2;
+      if (zones_[middle].first_page <= page) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+
+    if (low == 0 || page >= zones_[low - 1].end_page()) {
+      return nullptr;
+    }
+    return &zones_[low - 1];
+  }
+
+  NODISCARD auto state_of(uint64_t page) const noexcept -> uint8_t* {
+    const auto* zone = find_zone(page);
+    return zone != nullptr ? &zone->state[page - zone->first_page] : nullptr;
+  }
+
+  // Pages seeded allocated have a zero state and lie in no block, so no
+  // aligned page below them heads a block of an order covering them
+  NODISCARD static auto seeded_allocated(const Zone& zone,
+                                         uint64_t    page) noexcept -> bool {
+    if (zone.state[page - zone.first_page] != 0) {
+      return false;
+    }
+    for (auto order = uintn_t{1}; order <= max_order; ++order) {
+      const auto head = page & ~((uint64_t{1} << order) - 1);
+      if (head < zone.first_page) {
+        break;
+      }
+      const auto state = zone.state[head - zone.first_page];
+      if (state != 0 && (state & state_order) >= order) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  NODISCARD static auto block(uint64_t page) noexcept {
+    return reinterpret_cast<FreeBlock*>(page * page_size);
+  }
+
+  void push(uint64_t page, uintn_t order) noexcept {
+    auto* node     = block(page);
+    node->previous = nullptr;
+    node->next     = free_lists_[order];
+    if (node->next != nullptr) {
+      node->next->previous = node;
+    }
+    free_lists_[order] = node;
+
+    *state_of(page)    = state_free | static_cast<uint8_t>(order);
+    stats_.free_pages += uint64_t{1} << order;
+  }
+
+  void unlink(uint64_t page, uintn_t order) noexcept {
+    auto* node = block(page);
+    if (node->previous != nullptr) {
+      node->previous->next = node->next;
+    } else {
+      free_lists_[order] = node->next;
+    }
+    if (node->next != nullptr) {
+      node->next->previous = node->previous;
+    }
+
+    *state_of(page)    = 0;
+    stats_.free_pages -= uint64_t{1} << order;
+  }
+
+  NODISCARD auto pop(uintn_t order) noexcept -> uint64_t {
+    const auto page = reinterpret_cast<uintn_t>(free_lists_[order]) / page_size;
+    unlink(page, order);
+    return page;
+  }
+
+  // Inserts a block, merging with its buddy while the buddy is free
+  void free_block(uint64_t page, uintn_t order) noexcept {
+    const auto* zone = find_zone(page);
+
+    while (order < max_order) {
+      const auto buddy = page ^ (uint64_t{1} << order);
+      if (buddy < zone->first_page ||
+          buddy + (uint64_t{1} << order) > zone->end_page() ||
+          zone->state[buddy - zone->first_page] !=
+              (state_free | static_cast<uint8_t>(order))) {
+        break;
+      }
+
+      unlink(buddy, order);
+      stats_.merges++;
+      page = page < buddy ? page : buddy;
+      ++order;
+    }
+
+    push(page, order);
+  }
+
+  // Splits a range into the largest naturally aligned blocks
+  void release_range(uint64_t page, uint64_t pages) noexcept {
+    stats_.total_pages += pages;
+    while (pages != 0) {
+      auto order = static_cast<uintn_t>(std::countr_zero(page));
+      if (order > max_order) {
+        order = max_order;
+      }
+      while ((uint64_t{1} << order) > pages) {
+        --order;
+      }
+
+      free_block(page, order);
+      page  += uint64_t{1} << order;
+      pages -= uint64_t{1} << order;
+    }
+  }
+};
+
+}  // namespace efi
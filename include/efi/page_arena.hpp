@@ -0,0 +1,220 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <cstddef>
+
+#include "boot_services.hpp"
+
+namespace efi {
+
+// Bump allocator over runs of LoaderData pages. Every allocation is served
+// from the current run, a new run is only requested from the firmware when the
+// current one is exhausted. Individual allocations are never freed, memory is
+// returned by rewinding to a checkpoint or releasing the whole arena.
+class PageArena final {
+ private:
+  // Lives at the start of every run, runs form a stack through previous
+  struct Run {
+    Run*    previous;
+    uintn_t pages;
+  };
+
+ public:
+  struct Stats {
+    uintn_t bytes_used;
+    uintn_t pages_reserved;
+    uintn_t allocations;
+    uintn_t firmware_calls;
+
+    // Every allocation served would otherwise cost an allocate_pool and a
+    // free_pool
+    NODISCARD auto calls_saved() const noexcept -> uintn_t {
+      const auto pool_calls = allocations * 2;
+      return pool_calls > firmware_calls ? pool_calls - firmware_calls : 0;
+    }
+  };
+
+  class Checkpoint final {
+   private:
+    Run*    run_;
+    uintn_t offset_;
+    uintn_t bytes_used_;
+
+    constexpr Checkpoint(Run* run, uintn_t offset, uintn_t bytes_used) noexcept
+        : run_{run}, offset_{offset}, bytes_used_{bytes_used} {}
+
+    friend class PageArena;
+  };
+
+  // Rewinds the arena to where it was when the scope was entered
+  class Scope final {
+   private:
+    PageArena&       arena_;
+    const Checkpoint checkpoint_;
+
+   public:
+    explicit Scope(PageArena& arena) noexcept
+        : arena_{arena}, checkpoint_{arena.checkpoint()} {}
+
+    ~Scope() {
+      arena_.rewind(checkpoint_);
+    }
+
+    Scope()                                = delete;
+    Scope(Scope&&)                         = delete;
+    Scope(const Scope&)                    = delete;
+    auto operator=(Scope&&) -> Scope&      = delete;
+    auto operator=(const Scope&) -> Scope& = delete;
+  };
+
+  static constexpr auto default_run_pages = uintn_t{16};
+
+ private:
+  BootServices* const boot_services_;
+  const uintn_t       run_pages_;
+
+  Run*    run_    = nullptr;
+  uintn_t offset_ = 0;
+  Stats   stats_{};
+
+ public:
+  explicit PageArena(BootServices* boot_services,
+                     uintn_t       run_pages = default_run_pages) noexcept
+      : boot_services_{boot_services},
+        run_pages_{run_pages != 0 ? run_pages : 1} {}
+
+  ~PageArena() {
+    release();
+  }
+
+  PageArena()                                    = delete;
+  PageArena(PageArena&&)                         = delete;
+  PageArena(const PageArena&)                    = delete;
+  auto operator=(PageArena&&) -> PageArena&      = delete;
+  auto operator=(const PageArena&) -> PageArena& = delete;
+
+  // Returns nullptr when the firmware is out of pages, alignment must be a
+  // power of two
+  NODISCARD auto allocate(
+      uintn_t size, uintn_t alignment = alignof(std::max_align_t)) noexcept
+      -> void* {
+    if (run_ != nullptr) {
+      if (auto* memory = bump(size, alignment); memory != nullptr) {
+        return memory;
+      }
+    }
+
+    if (!grow(size, alignment)) {
+      return nullptr;
+    }
+
+    return bump(size, alignment);
+  }
+
+  template <typename T>
+  NODISCARD auto allocate(uintn_t count = 1) noexcept -> T* {
+    if (count > ~uintn_t{0} / sizeof(T)) {
+      return nullptr;
+    }
+    return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+  }
+
+  NODISCARD auto checkpoint() const noexcept -> Checkpoint {
+    return Checkpoint{run_, offset_, stats_.bytes_used};
+  }
+
+  // Runs acquired after the checkpoint are returned to the firmware
+  void rewind(const Checkpoint& checkpoint) noexcept {
+    while (run_ != checkpoint.run_) {
+      pop_run();
+    }
+    offset_           = checkpoint.offset_;
+    stats_.bytes_used = checkpoint.bytes_used_;
+  }
+
+  // Returns every run to the firmware
+  void release() noexcept {
+    rewind(Checkpoint{nullptr, 0, 0});
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  NODISCARD auto base() const noexcept {
+    return reinterpret_cast<uintn_t>(run_);
+  }
+
+  NODISCARD auto bump(uintn_t size, uintn_t alignment) noexcept -> void* {
+    const auto capacity = run_->pages * page_size;
+    const auto address  = (base() + offset_ + alignment - 1) & ~(alignment - 1);
+    const auto offset   = address - base();
+
+    if (offset > capacity || size > capacity - offset) {
+      return nullptr;
+    }
+
+    stats_.bytes_used += offset + size - offset_;
+    stats_.allocations++;
+    offset_ = offset + size;
+    return reinterpret_cast<void*>(address);
+  }
+
+  NODISCARD auto grow(uintn_t size, uintn_t alignment) noexcept -> bool {
+    // Worst case the run header plus alignment padding precede the block
+    const auto needed = sizeof(Run) + alignment + size;
+    if (needed < size) {
+      return false;
+    }
+
+    const auto needed_pages = (needed + page_size - 1) / page_size;
+    const auto pages = needed_pages > run_pages_ ? needed_pages : run_pages_;
+
+    auto memory = PhysicalAddress{};
+    stats_.firmware_calls++;
+    if (boot_services_->allocate_pages(AllocateType::AnyPages,
+                                       MemoryType::LoaderData, pages,
+                                       &memory) != Status::Success) {
+      return false;
+    }
+
+    auto* run     = reinterpret_cast<Run*>(memory);
+    run->previous = run_;
+    run->pages    = pages;
+
+    run_                   = run;
+    offset_                = sizeof(Run);
+    stats_.pages_reserved += pages;
+    return true;
+  }
+
+  void pop_run() noexcept {
+    auto* run              = run_;
+    run_                   = run->previous;
+    stats_.pages_reserved -= run->pages;
+    stats_.firmware_calls++;
+    boot_services_->free_pages(reinterpret_cast<PhysicalAddress>(run),
+                               run->pages);
+  }
+};
+
+}  // namespace efi
@@ -13,10 +13,84 @@
 // You should have received a copy of the GNU General Public License along with
 // MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
 
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
 #include <cstdint>
 
+#ifdef _WINDOWS
+#include <intrin.h>
+#define TARGET_FEATURES(features)
+#else
+#define TARGET_FEATURES(features) __attribute__((target(features)))
+#endif
+
 namespace efi {
 
+struct CpuidResult {
+  uint32_t eax;
+  uint32_t ebx;
+  uint32_t ecx;
+  uint32_t edx;
+};
+
+inline auto cpuid(uint32_t leaf, uint32_t subleaf = 0) noexcept -> CpuidResult {
+#ifdef _WINDOWS
+  int registers[4];
+  __cpuidex(registers, static_cast<int>(leaf), static_cast<int>(subleaf));
+  return CpuidResult{static_cast<uint32_t>(registers[0]),
+                     static_cast<uint32_t>(registers[1]),
+                     static_cast<uint32_t>(registers[2]),
+                     static_cast<uint32_t>(registers[3])};
+#else
+  auto result = CpuidResult{};
+  asm volatile("cpuid"
+               : "=a"(result.eax), "=b"(result.ebx), "=c"(result.ecx),
+                 "=d"(result.edx)
+               : "a"(leaf), "c"(subleaf));
+  return result;
+#endif
+}
+
+// Only valid once cpuid reports OSXSAVE
+inline auto read_xcr0() noexcept -> uint64_t {
+#ifdef _WINDOWS
+  return _xgetbv(0);
+#else
+  uint32_t low;
+  uint32_t high;
+  asm volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+  return (static_cast<uint64_t>(high) << 32) | low;
+#endif
+}
+
+// Reads the time stamp counter, cycles are only comparable on the same core
+// unless the CPU reports an invariant TSC
+inline auto read_tsc() noexcept -> uint64_t {
+#ifdef _WINDOWS
+  return __rdtsc();
+#else
+  uint32_t low;
+  uint32_t high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return (static_cast<uint64_t>(high) << 32) | low;
+#endif
+}
+
+// Reads a 32 bit I/O port, requires ring 0
+inline auto in32(uint16_t port) noexcept -> uint32_t {
+#ifdef _WINDOWS
+  return __indword(port);
+#else
+  uint32_t value;
+  asm volatile("inl %w1, %0" : "=a"(value) : "Nd"(port));
+  return value;
+#endif
+}
+
 class FXSaveStateX64 final {
   uint16_t fcw_;
   uint16_t fsw_;
@@ -0,0 +1,401 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <immintrin.h>
+
+#include "../core.hpp"
+#include "x64.hpp"
+
+namespace efi {
+
+enum class MemoryKernel {
+  RepMovsb,
+  Sse2,
+  Avx2,
+};
+
+// Copy and fill routines used in place of BootServices::copy_mem / set_mem,
+// which are an indirect call into firmware that is often a byte loop.
+//
+// The kernel is picked from cpuid on first use. Copies of at least
+// non_temporal_threshold bytes bypass the cache with streaming stores, which
+// suits framebuffers and images that are not read back soon. Unlike copy_mem
+// the source and destination must not overlap.
+class MemoryKernels final {
+ public:
+  using CopyFn = void (*)(void* destination, const void* source,
+                          uintn_t size) noexcept;
+
+  using SetFn  = void (*)(void* buffer, uint8_t value, uintn_t size) noexcept;
+
+  static constexpr auto non_temporal_threshold = uintn_t{4} << 20;
+
+ private:
+  // Start out pointing at resolvers which pick the kernel on first use
+  static CopyFn copy_;
+  static SetFn  set_;
+
+ public:
+  MemoryKernels()                                        = delete;
+  MemoryKernels(MemoryKernels&&)                         = delete;
+  MemoryKernels(const MemoryKernels&)                    = delete;
+  ~MemoryKernels()                                       = delete;
+  auto operator=(MemoryKernels&&) -> MemoryKernels&      = delete;
+  auto operator=(const MemoryKernels&) -> MemoryKernels& = delete;
+
+  // Fastest kernel the cpu and the firmware enabled state support
+  NODISCARD static auto detect() noexcept -> MemoryKernel {
+    constexpr auto osxsave_bit = uint32_t{1} << 27;
+    constexpr auto avx_bit     = uint32_t{1} << 28;
+    constexpr auto avx2_bit    = uint32_t{1} << 5;
+    constexpr auto erms_bit    = uint32_t{1} << 9;
+
+    // x87, sse and avx state enabled in xcr0
+    constexpr auto ymm_state   = uint64_t{0x6};
+
+    const auto max_leaf = cpuid(0).eax;
+    const auto leaf1    = cpuid(1);
+    const auto leaf7    = max_leaf >= 7 ? cpuid(7, 0) : CpuidResult{};
+
+    const auto avx_enabled = (leaf1.ecx & osxsave_bit) != 0 &&
+                             (leaf1.ecx & avx_bit) != 0 &&
+                             (read_xcr0() & ymm_state) == ymm_state;
+    if (avx_enabled && (leaf7.ebx & avx2_bit) != 0) {
+      return MemoryKernel::Avx2;
+    }
+    if ((leaf7.ebx & erms_bit) != 0) {
+      return MemoryKernel::RepMovsb;
+    }
+    return MemoryKernel::Sse2;
+  }
+
+  // Overrides detection, the caller must ensure the cpu supports kernel
+  static void use(MemoryKernel kernel) noexcept {
+    switch (kernel) {
+      case MemoryKernel::RepMovsb:
+        copy_ = &copy_rep_movsb;
+        set_  = &set_rep_stosb;
+        break;
+      case MemoryKernel::Sse2:
+        copy_ = &copy_sse2;
+        set_  = &set_sse2;
+        break;
+      case MemoryKernel::Avx2:
+        copy_ = &copy_avx2;
+        set_  = &set_avx2;
+        break;
+    }
+  }
+
+  FORCE_INLINE static void copy(void* destination, const void* source,
+                                uintn_t size) noexcept {
+    copy_(destination, source, size);
+  }
+
+  FORCE_INLINE static void set(void* buffer, uint8_t value,
+                               uintn_t size) noexcept {
+    set_(buffer, value, size);
+  }
+
+  FORCE_INLINE static void zero(void* buffer, uintn_t size) noexcept {
+    set_(buffer, 0, size);
+  }
+
+#pragma region Kernels
+
+  static void copy_rep_movsb(void* destination, const void* source,
+                             uintn_t size) noexcept {
+#ifdef _WINDOWS
+    __movsb(static_cast<unsigned char*>(destination),
+            static_cast<const unsigned char*>(source), size);
+#else
+    asm volatile("rep movsb"
+                 : "+D"(destination), "+S"(source), "+c"(size)
+                 :
+                 : "memory");
+#endif
+  }
+
+  static void set_rep_stosb(void* buffer, uint8_t value,
+                            uintn_t size) noexcept {
+#ifdef _WINDOWS
+    __stosb(static_cast<unsigned char*>(buffer), value, size);
+#else
+    asm volatile("rep stosb"
+                 : "+D"(buffer), "+c"(size)
+                 : "a"(value)
+                 : "memory");
+#endif
+  }
+
+  TARGET_FEATURES("sse2")
+  static void copy_sse2(void* destination, const void* source,
+                        uintn_t size) noexcept {
+    if (size < 16) {
+      copy_rep_movsb(destination, source, size);
+      return;
+    }
+
+    auto*       dst = static_cast<uint8_t*>(destination);
+    const auto* src = static_cast<const uint8_t*>(source);
+
+    // An unaligned head store lets the loop use aligned stores
+    const auto head = (16 - (reinterpret_cast<uintn_t>(dst) & 15)) & 15;
+    store_unaligned(dst, load_unaligned(src));
+    dst  += head;
+    src  += head;
+    size -= head;
+
+    const auto stream = size >= non_temporal_threshold;
+    while (size >= 64) {
+      const auto a = load_unaligned(src);
+      const auto b = load_unaligned(src + 16);
+      const auto c = load_unaligned(src + 32);
+      const auto d = load_unaligned(src + 48);
+      if (stream) {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), a);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 48), d);
+      } else {
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst), a);
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + 16), b);
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + 32), c);
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + 48), d);
+      }
+      dst  += 64;
+      src  += 64;
+      size -= 64;
+    }
+    if (stream) {
+      _mm_sfence();
+    }
+
+    while (size >= 16) {
+      _mm_store_si128(reinterpret_cast<__m128i*>(dst), load_unaligned(src));
+      dst  += 16;
+      src  += 16;
+      size -= 16;
+    }
+
+    // The tail overlaps bytes already written
+    if (size != 0) {
+      store_unaligned(dst + size - 16, load_unaligned(src + size - 16));
+    }
+  }
+
+  TARGET_FEATURES("sse2")
+  static void set_sse2(void* buffer, uint8_t value, uintn_t size) noexcept {
+    if (size < 16) {
+      set_rep_stosb(buffer, value, size);
+      return;
+    }
+
+    auto*      dst  = static_cast<uint8_t*>(buffer);
+    const auto fill = _mm_set1_epi8(static_cast<char>(value));
+
+    const auto head = (16 - (reinterpret_cast<uintn_t>(dst) & 15)) & 15;
+    store_unaligned(dst, fill);
+    dst  += head;
+    size -= head;
+
+    const auto stream = size >= non_temporal_threshold;
+    while (size >= 64) {
+      if (stream) {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), fill);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 16), fill);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 32), fill);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 48), fill);
+      } else {
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst), fill);
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + 16), fill);
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + 32), fill);
+        _mm_store_si128(reinterpret_cast<__m128i*>(dst + 48), fill);
+      }
+      dst  += 64;
+      size -= 64;
+    }
+    if (stream) {
+      _mm_sfence();
+    }
+
+    while (size >= 16) {
+      _mm_store_si128(reinterpret_cast<__m128i*>(dst), fill);
+      dst  += 16;
+      size -= 16;
+    }
+
+    if (size != 0) {
+      store_unaligned(dst + size - 16, fill);
+    }
+  }
+
+  TARGET_FEATURES("avx2")
+  static void copy_avx2(void* destination, const void* source,
+                        uintn_t size) noexcept {
+    if (size < 32) {
+      copy_sse2(destination, source, size);
+      return;
+    }
+
+    auto*       dst = static_cast<uint8_t*>(destination);
+    const auto* src = static_cast<const uint8_t*>(source);
+
+    const auto head = (32 - (reinterpret_cast<uintn_t>(dst) & 31)) & 31;
+    store_unaligned(dst, load_unaligned_256(src));
+    dst  += head;
+    src  += head;
+    size -= head;
+
+    const auto stream = size >= non_temporal_threshold;
+    while (size >= 128) {
+      const auto a = load_unaligned_256(src);
+      const auto b = load_unaligned_256(src + 32);
+      const auto c = load_unaligned_256(src + 64);
+      const auto d = load_unaligned_256(src + 96);
+      if (stream) {
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst), a);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 32), b);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 64), c);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 96), d);
+      } else {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst), a);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + 32), b);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + 64), c);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + 96), d);
+      }
+      dst  += 128;
+      src  += 128;
+      size -= 128;
+    }
+    if (stream) {
+      _mm_sfence();
+    }
+
+    while (size >= 32) {
+      _mm256_store_si256(reinterpret_cast<__m256i*>(dst),
+                         load_unaligned_256(src));
+      dst  += 32;
+      src  += 32;
+      size -= 32;
+    }
+
+    if (size != 0) {
+      store_unaligned(dst + size - 32, load_unaligned_256(src + size - 32));
+    }
+
+    // Avoids the avx to sse transition penalty in the caller
+    _mm256_zeroupper();
+  }
+
+  TARGET_FEATURES("avx2")
+  static void set_avx2(void* buffer, uint8_t value, uintn_t size) noexcept {
+    if (size < 32) {
+      set_sse2(buffer, value, size);
+      return;
+    }
+
+    auto*      dst  = static_cast<uint8_t*>(buffer);
+    const auto fill = _mm256_set1_epi8(static_cast<char>(value));
+
+    const auto head = (32 - (reinterpret_cast<uintn_t>(dst) & 31)) & 31;
+    store_unaligned(dst, fill);
+    dst  += head;
+    size -= head;
+
+    const auto stream = size >= non_temporal_threshold;
+    while (size >= 128) {
+      if (stream) {
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst), fill);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 32), fill);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 64), fill);
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + 96), fill);
+      } else {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst), fill);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + 32), fill);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + 64), fill);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(dst + 96), fill);
+      }
+      dst  += 128;
+      size -= 128;
+    }
+    if (stream) {
+      _mm_sfence();
+    }
+
+    while (size >= 32) {
+      _mm256_store_si256(reinterpret_cast<__m256i*>(dst), fill);
+      dst  += 32;
+      size -= 32;
+    }
+
+    if (size != 0) {
+      store_unaligned(dst + size - 32, fill);
+    }
+
+    _mm256_zeroupper();
+  }
+
+#pragma endregion
+
+ private:
+  TARGET_FEATURES("sse2")
+  FORCE_INLINE static auto load_unaligned(const uint8_t* source) noexcept
+      -> __m128i {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+  }
+
+  TARGET_FEATURES("sse2")
+  FORCE_INLINE static void store_unaligned(uint8_t* destination,
+                                           __m128i  value) noexcept {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), value);
+  }
+
+  TARGET_FEATURES("avx2")
+  FORCE_INLINE static auto load_unaligned_256(const uint8_t* source) noexcept
+      -> __m256i {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source));
+  }
+
+  TARGET_FEATURES("avx2")
+  FORCE_INLINE static void store_unaligned(uint8_t* destination,
+                                           __m256i  value) noexcept {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), value);
+  }
+
+  static void resolve_copy(void* destination, const void* source,
+                           uintn_t size) noexcept {
+    use(detect());
+    copy_(destination, source, size);
+  }
+
+  static void resolve_set(void* buffer, uint8_t value, uintn_t size) noexcept {
+    use(detect());
+    set_(buffer, value, size);
+  }
+};
+
+inline MemoryKernels::CopyFn MemoryKernels::copy_ =
+    &MemoryKernels::resolve_copy;
+
+inline MemoryKernels::SetFn MemoryKernels::set_ = &MemoryKernels::resolve_set;
+
+}  // namespace efi
@@ -0,0 +1,374 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include "../boot_services.hpp"
+#include "../memory_map.hpp"
+#include "x64.hpp"
+
+namespace efi {
+
+enum class PageFlags : uint64_t {
+  None         = 0,
+  Present      = 0x001,
+  Writable     = 0x002,
+  User         = 0x004,
+  WriteThrough = 0x008,
+  CacheDisable = 0x010,
+  Accessed     = 0x020,
+  Dirty        = 0x040,
+  PageSize     = 0x080,
+  Global       = 0x100,
+  NoExecute    = uint64_t{1} << 63,
+};
+
+ENUM_FLAGS(PageFlags);
+
+// Builds 4 level x64 page tables in LoaderData pages, so the tables survive
+// exit_boot_services and can be loaded into cr3 by the kernel.
+//
+// Every range is mapped with the largest page the alignment of both addresses
+// and the remaining size allow. Tables are written through their physical
+// address, relying on the firmware identity map.
+class PageTableBuilder final {
+ public:
+  static constexpr auto page_size_2m = uint64_t{1} << 21;
+  static constexpr auto page_size_1g = uint64_t{1} << 30;
+
+  struct Stats {
+    uint64_t table_pages;
+    uint64_t pages_1g;
+    uint64_t pages_2m;
+    uint64_t pages_4k;
+
+    // Large pages broken up because a smaller mapping landed inside them
+    uint64_t splits;
+    uint64_t cycles;
+
+    NODISCARD auto table_bytes() const noexcept -> uint64_t {
+      return table_pages * page_size;
+    }
+  };
+
+  static constexpr auto default_run_pages = uintn_t{16};
+
+ private:
+  static constexpr auto entry_count  = uintn_t{512};
+  static constexpr auto address_mask = uint64_t{0x000ffffffffff000};
+  static constexpr auto levels       = uintn_t{4};
+
+  // Shift of the address bits indexing each level, pml4 first
+  static constexpr uintn_t level_shift[levels] = {39, 30, 21, 12};
+
+  // Intermediate entries grant everything, leaves restrict
+  static constexpr auto table_flags =
+      PageFlags::Present | PageFlags::Writable | PageFlags::User;
+
+  BootServices* const boot_services_;
+  const bool          allow_1g_;
+  const uintn_t       run_pages_;
+
+  uint64_t* root_      = nullptr;
+  uint8_t*  run_       = nullptr;
+  uintn_t   run_used_  = 0;
+  uintn_t   run_total_ = 0;
+  Stats     stats_{};
+
+ public:
+  // allow_1g must only be set when cpuid reports 1GiB page support
+  explicit PageTableBuilder(BootServices* boot_services, bool allow_1g = true,
+                            uintn_t run_pages = default_run_pages) noexcept
+      : boot_services_{boot_services},
+        allow_1g_{allow_1g},
+        run_pages_{run_pages != 0 ? run_pages : 1} {}
+
+  PageTableBuilder()                                           = delete;
+  PageTableBuilder(PageTableBuilder&&)                         = delete;
+  PageTableBuilder(const PageTableBuilder&)                    = delete;
+  auto operator=(PageTableBuilder&&) -> PageTableBuilder&      = delete;
+  auto operator=(const PageTableBuilder&) -> PageTableBuilder& = delete;
+
+  // Maps size bytes at virtual_address to physical_address, all three must be
+  // page aligned. Present is implied.
+  auto map(VirtualAddress virtual_address, PhysicalAddress physical_address,
+           uint64_t size, PageFlags flags) noexcept -> Status {
+    if ((virtual_address | physical_address | size) % page_size != 0) {
+      return Status::InvalidParameter;
+    }
+
+    const auto start = read_tsc();
+    auto       status = Status::Success;
+
+    if (root_ == nullptr) {
+      root_ = allocate_table();
+      if (root_ == nullptr) {
+        status = Status::OutOfResources;
+      }
+    }
+
+    while (status == Status::Success && size != 0) {
+      auto depth = leaf_depth(virtual_address, physical_address, size);
+
+      // A table already below the slot keeps its finer mappings
+      auto placed = false;
+      while (!placed) {
+        status = set_leaf(virtual_address, physical_address, depth, flags,
+                          &placed);
+        if (status != Status::Success) {
+          break;
+        }
+        if (!placed) {
+          ++depth;
+        }
+      }
+
+      const auto step   = uint64_t{1} << level_shift[depth];
+      virtual_address  += step;
+      physical_address += step;
+      size             -= step;
+    }
+
+    stats_.cycles += read_tsc() - start;
+    return status;
+  }
+
+  // Maps every descriptor at physical_start + offset, offset 0 gives an
+  // identity map. Contiguous descriptors with the same flags are mapped as
+  // one range so they can share large pages. Sorts memory_map in place.
+  auto map_memory_map(MemoryMapView memory_map, VirtualAddress offset,
+                      PageFlags flags = PageFlags::Writable) noexcept
+      -> Status {
+    memory_map.sort();
+
+    auto range_start = PhysicalAddress{0};
+    auto range_end   = PhysicalAddress{0};
+    auto range_flags = PageFlags::None;
+
+    for (const auto& descriptor : memory_map) {
+      const auto descriptor_flags = flags | cache_flags(descriptor);
+
+      if (range_end == descriptor.physical_start() &&
+          range_flags == descriptor_flags && range_end != range_start) {
+        range_end = descriptor.physical_end();
+        continue;
+      }
+
+      if (range_end != range_start) {
+        if (auto status = map(range_start + offset, range_start,
+                              range_end - range_start, range_flags);
+            status != Status::Success) {
+          return status;
+        }
+      }
+
+      range_start = descriptor.physical_start();
+      range_end   = descriptor.physical_end();
+      range_flags = descriptor_flags;
+    }
+
+    if (range_end != range_start) {
+      return map(range_start + offset, range_start, range_end - range_start,
+                 range_flags);
+    }
+    return Status::Success;
+  }
+
+  // Walks the tables like the MMU would
+  auto translate(VirtualAddress virtual_address,
+                 PhysicalAddress* physical_address,
+                 PageFlags*       flags = nullptr) const noexcept -> Status {
+    if (physical_address == nullptr) {
+      return Status::InvalidParameter;
+    }
+    if (root_ == nullptr) {
+      return Status::NotFound;
+    }
+
+    const auto* table = root_;
+    for (auto depth = uintn_t{0}; depth < levels; ++depth) {
+      const auto entry = table[index(virtual_address, depth)];
+      if ((entry & static_cast<uint64_t>(PageFlags::Present)) == 0) {
+        return Status::NotFound;
+      }
+
+      const auto leaf = depth == levels - 1 ||
+                        (entry & static_cast<uint64_t>(PageFlags::PageSize));
+      if (leaf) {
+        const auto span    = uint64_t{1} << level_shift[depth];
+        *physical_address  = (entry & address_mask & ~(span - 1)) |
+                             (virtual_address & (span - 1));
+        if (flags != nullptr) {
+          *flags = static_cast<PageFlags>(entry & ~address_mask);
+        }
+        return Status::Success;
+      }
+
+      table = reinterpret_cast<const uint64_t*>(entry & address_mask);
+    }
+
+    return Status::NotFound;
+  }
+
+  // Value for cr3
+  NODISCARD auto root() const noexcept {
+    return reinterpret_cast<PhysicalAddress>(root_);
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  NODISCARD static auto index(VirtualAddress address, uintn_t depth) noexcept
+      -> uintn_t {
+    return (address >> level_shift[depth]) & (entry_count - 1);
+  }
+
+  NODISCARD static auto cache_flags(const MemoryDescriptor& descriptor) noexcept
+      -> PageFlags {
+    constexpr auto attribute_uc = uint64_t{0x1};
+    constexpr auto attribute_wb = uint64_t{0x8};
+
+    const auto type = descriptor.type();
+    if (type == MemoryType::MemoryMappedIO ||
+        type == MemoryType::MemoryMappedIOPortSpace ||
+        ((descriptor.attribute() & attribute_wb) == 0 &&
+         (descriptor.attribute() & attribute_uc) != 0)) {
+      return PageFlags::CacheDisable;
+    }
+    return PageFlags::None;
+  }
+
+  // Depth of the largest leaf usable for the next step of a mapping
+  NODISCARD auto leaf_depth(VirtualAddress  virtual_address,
+                            PhysicalAddress physical_address,
+                            uint64_t        size) const noexcept -> uintn_t {
+    const auto alignment = virtual_address | physical_address;
+    if (allow_1g_ && alignment % page_size_1g == 0 && size >= page_size_1g) {
+      return 1;
+    }
+    if (alignment % page_size_2m == 0 && size >= page_size_2m) {
+      return 2;
+    }
+    return 3;
+  }
+
+  auto set_leaf(VirtualAddress virtual_address,
+                PhysicalAddress physical_address, uintn_t depth,
+                PageFlags flags, bool* placed) noexcept -> Status {
+    auto* table = root_;
+    for (auto level = uintn_t{0}; level < depth; ++level) {
+      auto& entry = table[index(virtual_address, level)];
+
+      if ((entry & static_cast<uint64_t>(PageFlags::Present)) == 0) {
+        auto* next = allocate_table();
+        if (next == nullptr) {
+          return Status::OutOfResources;
+        }
+        entry = reinterpret_cast<uint64_t>(next) |
+                static_cast<uint64_t>(table_flags);
+      } else if (entry & static_cast<uint64_t>(PageFlags::PageSize)) {
+        if (auto status = split(&entry, level); status != Status::Success) {
+          return status;
+        }
+      }
+
+      table = reinterpret_cast<uint64_t*>(entry & address_mask);
+    }
+
+    auto& entry = table[index(virtual_address, depth)];
+    if (depth < levels - 1 &&
+        (entry & static_cast<uint64_t>(PageFlags::Present)) != 0 &&
+        (entry & static_cast<uint64_t>(PageFlags::PageSize)) == 0) {
+      *placed = false;
+      return Status::Success;
+    }
+
+    auto leaf = flags | PageFlags::Present;
+    if (depth < levels - 1) {
+      leaf = leaf | PageFlags::PageSize;
+    }
+    entry   = physical_address | static_cast<uint64_t>(leaf);
+    *placed = true;
+
+    switch (depth) {
+      case 1:
+        stats_.pages_1g++;
+        break;
+      case 2:
+        stats_.pages_2m++;
+        break;
+      default:
+        stats_.pages_4k++;
+        break;
+    }
+    return Status::Success;
+  }
+
+  // Replaces a large leaf with a table of leaves one level down
+  auto split(uint64_t* entry, uintn_t level) noexcept -> Status {
+    auto* table = allocate_table();
+    if (table == nullptr) {
+      return Status::OutOfResources;
+    }
+
+    const auto child_span = uint64_t{1} << level_shift[level + 1];
+    const auto base       = *entry & address_mask;
+    auto       flags      = *entry & ~address_mask;
+    if (level + 1 == levels - 1) {
+      flags &= ~static_cast<uint64_t>(PageFlags::PageSize);
+    }
+
+    for (auto i = uintn_t{0}; i < entry_count; ++i) {
+      table[i] = (base + i * child_span) | flags;
+    }
+
+    *entry = reinterpret_cast<uint64_t>(table) |
+             static_cast<uint64_t>(table_flags);
+    stats_.splits++;
+    return Status::Success;
+  }
+
+  // Hands out zeroed pages from runs of LoaderData pages
+  NODISCARD auto allocate_table() noexcept -> uint64_t* {
+    if (run_used_ == run_total_) {
+      auto memory = PhysicalAddress{};
+      if (boot_services_->allocate_pages(AllocateType::AnyPages,
+                                         MemoryType::LoaderData, run_pages_,
+                                         &memory) != Status::Success) {
+        return nullptr;
+      }
+      run_       = reinterpret_cast<uint8_t*>(memory);
+      run_used_  = 0;
+      run_total_ = run_pages_;
+    }
+
+    auto* table = reinterpret_cast<uint64_t*>(run_ + run_used_ * page_size);
+    for (auto i = uintn_t{0}; i < entry_count; ++i) {
+      table[i] = 0;
+    }
+
+    run_used_++;
+    stats_.table_pages++;
+    return table;
+  }
+};
+
+}  // namespace efi
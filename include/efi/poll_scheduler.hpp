@@ -0,0 +1,232 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <bit>
+#include <concepts>
+
+#include "core.hpp"
+
+namespace efi {
+
+// Protocols whose progress depends on being polled, such as Tcp4Protocol,
+// Ipv4Protocol, ManagedNetworkProtocol and DNS4Protocol. Their poll returns
+// Success when it moved data, NotReady when there was nothing to do and
+// Timeout when data was dropped from a queue.
+template <typename T>
+concept Pollable = requires(T* protocol) {
+  { protocol->poll() } -> std::same_as<Status>;
+};
+
+// Polls a set of protocol instances at rates adapted to their activity.
+//
+// Time is counted in rounds, one per call to run. An instance whose poll
+// did work is polled again the next round; each idle poll doubles its
+// interval up to max_interval. While tokens are outstanding on an instance,
+// as reported through expect and complete, the interval stays at or below
+// busy_interval so completions are not left waiting on a backed off poll.
+//
+// An Id carries a generation next to its slot, so an Id kept past its
+// remove never matches a later instance added in that slot.
+class PollScheduler final {
+ public:
+  using Id = uintn_t;
+
+  static constexpr auto max_pollers           = uintn_t{16};
+  static constexpr auto default_max_interval  = uint64_t{64};
+  static constexpr auto default_busy_interval = uint64_t{4};
+
+  struct Stats {
+    uint64_t polls;
+
+    // Polls returning Success or Timeout
+    uint64_t productive;
+  };
+
+ private:
+  using PollFn = auto (*)(void* protocol) noexcept -> Status;
+
+  static constexpr auto slot_mask = max_pollers - 1;
+  static_assert(std::has_single_bit(max_pollers));
+
+  struct Entry {
+    PollFn   poll;
+    void*    protocol;
+    uint64_t interval;
+    uint64_t due;
+    uint64_t outstanding;
+    Stats    stats;
+  };
+
+  const uint64_t max_interval_;
+  const uint64_t busy_interval_;
+
+  std::array<Entry, max_pollers> entries_{};
+  uint64_t                       round_ = 0;
+  Stats                          stats_{};
+
+  // Id of the current or next instance in each slot
+  std::array<Id, max_pollers> ids_{};
+
+ public:
+  explicit PollScheduler(
+      uint64_t max_interval  = default_max_interval,
+      uint64_t busy_interval = default_busy_interval) noexcept
+      : max_interval_{max_interval != 0 ? max_interval : 1},
+        busy_interval_{busy_interval != 0 && busy_interval < max_interval_
+                           ? busy_interval
+                           : max_interval_} {
+    for (auto i = uintn_t{0}; i < max_pollers; ++i) {
+      ids_[i] = i;
+    }
+  }
+
+  PollScheduler(PollScheduler&&)                         = delete;
+  PollScheduler(const PollScheduler&)                    = delete;
+  auto operator=(PollScheduler&&) -> PollScheduler&      = delete;
+  auto operator=(const PollScheduler&) -> PollScheduler& = delete;
+
+  // The protocol stays owned by the caller and is first polled next round
+  template <Pollable P>
+  auto add(P* protocol, Id* id) noexcept -> Status {
+    if (protocol == nullptr || id == nullptr) {
+      return Status::InvalidParameter;
+    }
+
+    for (auto i = uintn_t{0}; i < max_pollers; ++i) {
+      if (entries_[i].poll == nullptr) {
+        entries_[i] = Entry{&poll_thunk<P>, protocol, 1, round_, 0, {}};
+        *id         = ids_[i];
+        return Status::Success;
+      }
+    }
+    return Status::OutOfResources;
+  }
+
+  // Safe to call between runs only
+  auto remove(Id id) noexcept -> Status {
+    if (!contains(id)) {
+      return Status::NotFound;
+    }
+    entries_[slot(id)] = Entry{};
+    ids_[slot(id)]     = id + max_pollers;
+    return Status::Success;
+  }
+
+  NODISCARD auto contains(Id id) const noexcept -> bool {
+    return entries_[slot(id)].poll != nullptr && ids_[slot(id)] == id;
+  }
+
+  // A token was submitted on the instance, it is polled next round
+  auto expect(Id id) noexcept -> Status {
+    if (!contains(id)) {
+      return Status::NotFound;
+    }
+
+    auto& entry = entries_[slot(id)];
+    entry.outstanding++;
+    entry.interval = entry.interval < busy_interval_ ? entry.interval
+                                                     : busy_interval_;
+    entry.due      = round_;
+    return Status::Success;
+  }
+
+  // A token submitted on the instance completed or was cancelled
+  auto complete(Id id) noexcept -> Status {
+    if (!contains(id)) {
+      return Status::NotFound;
+    }
+
+    auto& entry = entries_[slot(id)];
+    if (entry.outstanding != 0) {
+      entry.outstanding--;
+    }
+    return Status::Success;
+  }
+
+  // Polls every instance that is due and returns how many did work, 0 means
+  // the caller may idle until its next event
+  auto run() noexcept -> uintn_t {
+    auto productive = uintn_t{0};
+
+    for (auto& entry : entries_) {
+      if (entry.poll == nullptr || entry.due > round_) {
+        continue;
+      }
+
+      const auto status = entry.poll(entry.protocol);
+      entry.stats.polls++;
+      stats_.polls++;
+
+      if (status == Status::Success || status == Status::Timeout) {
+        entry.stats.productive++;
+        stats_.productive++;
+        entry.interval = 1;
+        productive++;
+      } else {
+        const auto limit =
+            entry.outstanding != 0 ? busy_interval_ : max_interval_;
+        entry.interval = entry.interval * 2 < limit ? entry.interval * 2
+                                                    : limit;
+      }
+      entry.due = round_ + entry.interval;
+    }
+
+    round_++;
+    return productive;
+  }
+
+  // Rounds until the earliest instance is due, 0 when one is due now
+  NODISCARD auto next_due() const noexcept -> uint64_t {
+    auto next = max_interval_;
+    for (const auto& entry : entries_) {
+      if (entry.poll != nullptr) {
+        const auto wait = entry.due > round_ ? entry.due - round_ : 0;
+        next            = wait < next ? wait : next;
+      }
+    }
+    return next;
+  }
+
+  NODISCARD auto interval(Id id) const noexcept -> uint64_t {
+    return contains(id) ? entries_[slot(id)].interval : 0;
+  }
+
+  NODISCARD auto stats(Id id) const noexcept -> Stats {
+    return contains(id) ? entries_[slot(id)].stats : Stats{};
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  NODISCARD static auto slot(Id id) noexcept -> uintn_t {
+    return id & slot_mask;
+  }
+
+  template <Pollable P>
+  static auto poll_thunk(void* protocol) noexcept -> Status {
+    return static_cast<P*>(protocol)->poll();
+  }
+};
+
+}  // namespace efi
@@ -24,7 +24,72 @@
 namespace efi {
 
 class BlockToMedia final {
-  // todo : implement
+ private:
+  uint32_t media_id_;
+  bool     removable_media_;
+  bool     media_present_;
+  bool     logical_partition_;
+  bool     read_only_;
+  bool     write_caching_;
+  uint32_t block_size_;
+  uint32_t io_align_;
+  LBA      last_block_;
+
+  // Revision 2
+  LBA      lowest_aligned_lba_;
+  uint32_t logical_blocks_per_physical_block_;
+
+  // Revision 3
+  uint32_t optimal_transfer_length_granularity_;
+
+ public:
+  NODISCARD auto media_id() const noexcept {
+    return media_id_;
+  }
+
+  NODISCARD auto removable_media() const noexcept {
+    return removable_media_;
+  }
+
+  NODISCARD auto media_present() const noexcept {
+    return media_present_;
+  }
+
+  NODISCARD auto logical_partition() const noexcept {
+    return logical_partition_;
+  }
+
+  NODISCARD auto read_only() const noexcept {
+    return read_only_;
+  }
+
+  NODISCARD auto write_caching() const noexcept {
+    return write_caching_;
+  }
+
+  NODISCARD auto block_size() const noexcept {
+    return block_size_;
+  }
+
+  NODISCARD auto io_align() const noexcept {
+    return io_align_;
+  }
+
+  NODISCARD auto last_block() const noexcept {
+    return last_block_;
+  }
+
+  NODISCARD auto lowest_aligned_lba() const noexcept {
+    return lowest_aligned_lba_;
+  }
+
+  NODISCARD auto logical_blocks_per_physical_block() const noexcept {
+    return logical_blocks_per_physical_block_;
+  }
+
+  NODISCARD auto optimal_transfer_length_granularity() const noexcept {
+    return optimal_transfer_length_granularity_;
+  }
 };
 
 class BlockIOProtocol final {
@@ -57,6 +122,8 @@ class BlockIOProtocol final {
   const WriteBlocksFn       write_blocks_;
   const FlushBlocksFn       flush_blocks_;
 
+  friend class Tracer;
+
  public:
   BlockIOProtocol()                                          = delete;
   BlockIOProtocol(BlockIOProtocol&&)                         = delete;
@@ -106,6 +173,15 @@ class BlockIO2Protocol final {
 class EraseBlockToken {
   Event  event_;
   Status transaction_status_;
+
+ public:
+  NODISCARD auto event() const noexcept {
+    return event_;
+  }
+
+  NODISCARD auto status() const noexcept {
+    return transaction_status_;
+  }
 };
 
 class EraseBlockProtocol final {
@@ -117,6 +117,15 @@ class Dhcp4TransmitReceiveToken final {
   Dhcp4Packet      *packet_;
   uint32_t          response_count_;
   Dhcp4Packet      *response_list_;
+
+ public:
+  NODISCARD auto event() const noexcept {
+    return completion_event_;
+  }
+
+  NODISCARD auto status() const noexcept {
+    return status_;
+  }
 };
 
 class Dhcp4ConfigData {
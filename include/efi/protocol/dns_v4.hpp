@@ -256,7 +256,7 @@ class DNS4Protocol final {
     return cancel_(this, token);
   }
 
-  static constexpr auto Guid =
+  static constexpr auto guid =
       ::efi::Guid{0xae3d28cc,
                   0xe05b,
                   0x4fa1,
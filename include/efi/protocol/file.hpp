@@ -186,6 +186,23 @@ class FileIOToken final {
   const Status  status_;
   const uintn_t buffer_size_;
   void* const   buffer_;
+
+ public:
+  NODISCARD auto event() const noexcept {
+    return event_;
+  }
+
+  NODISCARD auto status() const noexcept {
+    return status_;
+  }
+
+  NODISCARD auto buffer_size() const noexcept {
+    return buffer_size_;
+  }
+
+  NODISCARD auto* buffer() const noexcept {
+    return buffer_;
+  }
 };
 
 class FileProtocol2 : public FileProtocol {
@@ -75,6 +75,15 @@ class Tcp4ConfigData final {
 class Tcp4CompletionToken {
   Event  event_;
   Status status_;
+
+ public:
+  NODISCARD auto event() const noexcept {
+    return event_;
+  }
+
+  NODISCARD auto status() const noexcept {
+    return status_;
+  }
 };
 
 class Tcp4ConnectionToken : public Tcp4CompletionToken {};
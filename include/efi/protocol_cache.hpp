@@ -0,0 +1,243 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <atomic>
+#include <bit>
+
+#include "boot_services.hpp"
+
+namespace efi {
+
+// Memoized handle_protocol and locate_protocol results, keyed by handle and
+// protocol guid, locate_protocol under a null handle.
+//
+// Entries live in a set associative table of 32 sets of 4, evicted round
+// robin within a set. The first time a guid is cached a protocol notify is
+// registered for it; an install or reinstall of that protocol anywhere
+// drops every entry for it before the next lookup. Notifications only mark
+// the guid, lookups never raise the TPL.
+//
+// The firmware does not report uninstalls: whoever uninstalls an interface
+// that may be cached must call invalidate. Failed lookups are not cached.
+class ProtocolCache final {
+ public:
+  static constexpr auto set_bits    = uintn_t{5};
+  static constexpr auto set_count   = uintn_t{1} << set_bits;
+  static constexpr auto ways        = uintn_t{4};
+  static constexpr auto max_watches = uintn_t{32};
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+
+    // Entries dropped by notifications and invalidate calls
+    uint64_t invalidations;
+  };
+
+ private:
+  struct Entry {
+    Handle handle    = nullptr;
+    Guid   guid      = Guid{Guid::Bytes{}};
+    void*  interface = nullptr;
+    bool   valid     = false;
+  };
+
+  struct Watch {
+    ProtocolCache* cache        = nullptr;
+    Guid           guid         = Guid{Guid::Bytes{}};
+    Event          event        = nullptr;
+    void*          registration = nullptr;
+  };
+
+  BootServices* const boot_services_;
+
+  std::array<std::array<Entry, ways>, set_count> sets_{};
+  std::array<uint8_t, set_count>                 victims_{};
+
+  std::array<Watch, max_watches> watches_{};
+  uintn_t                        watch_count_ = 0;
+
+  // One bit per watch notified since the last lookup
+  std::atomic<uint32_t> pending_{0};
+
+  Stats stats_{};
+
+ public:
+  explicit ProtocolCache(BootServices* boot_services) noexcept
+      : boot_services_{boot_services} {}
+
+  ~ProtocolCache() {
+    for (auto i = uintn_t{0}; i < watch_count_; ++i) {
+      boot_services_->close_event(watches_[i].event);
+    }
+  }
+
+  ProtocolCache()                                        = delete;
+  ProtocolCache(ProtocolCache&&)                         = delete;
+  ProtocolCache(const ProtocolCache&)                    = delete;
+  auto operator=(ProtocolCache&&) -> ProtocolCache&      = delete;
+  auto operator=(const ProtocolCache&) -> ProtocolCache& = delete;
+
+  auto handle_protocol(Handle handle, const Guid& protocol,
+                       void** interface) noexcept -> Status {
+    if (handle == nullptr || interface == nullptr) {
+      return Status::InvalidParameter;
+    }
+    return lookup(handle, protocol, interface);
+  }
+
+  auto locate_protocol(const Guid& protocol, void** interface) noexcept
+      -> Status {
+    if (interface == nullptr) {
+      return Status::InvalidParameter;
+    }
+    return lookup(nullptr, protocol, interface);
+  }
+
+  // Drops every entry of handle
+  void invalidate(Handle handle) noexcept {
+    for (auto& set : sets_) {
+      for (auto& entry : set) {
+        if (entry.valid && entry.handle == handle) {
+          drop(&entry);
+        }
+      }
+    }
+  }
+
+  // Drops every entry of protocol, including its locate_protocol result
+  void invalidate(const Guid& protocol) noexcept {
+    for (auto& set : sets_) {
+      for (auto& entry : set) {
+        if (entry.valid && entry.guid == protocol) {
+          drop(&entry);
+        }
+      }
+    }
+  }
+
+  void clear() noexcept {
+    for (auto& set : sets_) {
+      for (auto& entry : set) {
+        if (entry.valid) {
+          drop(&entry);
+        }
+      }
+    }
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  static EFI_CALL void on_notify(Event /*event*/, void* context) noexcept {
+    auto*      watch = static_cast<Watch*>(context);
+    auto*      cache = watch->cache;
+    const auto bit   = uint32_t{1} << (watch - cache->watches_.data());
+    cache->pending_.fetch_or(bit, std::memory_order_release);
+  }
+
+  NODISCARD static auto set_of(Handle handle, const Guid& guid) noexcept
+      -> uintn_t {
+    const auto key = guid.hash() ^ reinterpret_cast<uint64_t>(handle);
+    return static_cast<uintn_t>((key * 0x9e37'79b9'7f4a'7c15) >>
+                                (64 - set_bits));
+  }
+
+  auto lookup(Handle handle, const Guid& protocol, void** interface) noexcept
+      -> Status {
+    sync();
+
+    const auto index = set_of(handle, protocol);
+    for (const auto& entry : sets_[index]) {
+      if (entry.valid && entry.handle == handle && entry.guid == protocol) {
+        stats_.hits++;
+        *interface = entry.interface;
+        return Status::Success;
+      }
+    }
+
+    stats_.misses++;
+    const auto status =
+        handle != nullptr
+            ? boot_services_->handle_protocol(handle, protocol, interface)
+            : boot_services_->locate_protocol(protocol, nullptr, interface);
+
+    // Without a watch the entry could go stale unnoticed
+    if (status == Status::Success && watch(protocol)) {
+      auto& victim = victims_[index];
+      auto& entry  = sets_[index][victim];
+      entry        = Entry{handle, protocol, *interface, true};
+      victim       = static_cast<uint8_t>((victim + 1) % ways);
+    }
+    return status;
+  }
+
+  // Applies notifications that arrived since the last lookup
+  void sync() noexcept {
+    auto pending = pending_.exchange(0, std::memory_order_acquire);
+    while (pending != 0) {
+      const auto index = std::countr_zero(pending);
+      pending         &= pending - 1;
+      invalidate(watches_[index].guid);
+    }
+  }
+
+  auto watch(const Guid& protocol) noexcept -> bool {
+    for (auto i = uintn_t{0}; i < watch_count_; ++i) {
+      if (watches_[i].guid == protocol) {
+        return true;
+      }
+    }
+    if (watch_count_ == max_watches) {
+      return false;
+    }
+
+    auto& watch = watches_[watch_count_];
+    watch       = Watch{this, protocol, nullptr, nullptr};
+
+    auto status = boot_services_->create_event(
+        EventType::NotifySignal, TplCallback, &on_notify, &watch,
+        &watch.event);
+    if (status != Status::Success) {
+      return false;
+    }
+
+    status = boot_services_->register_protocol_notify(protocol, watch.event,
+                                                      &watch.registration);
+    if (status != Status::Success) {
+      boot_services_->close_event(watch.event);
+      return false;
+    }
+
+    watch_count_++;
+    return true;
+  }
+
+  void drop(Entry* entry) noexcept {
+    *entry = Entry{};
+    stats_.invalidations++;
+  }
+};
+
+}  // namespace efi
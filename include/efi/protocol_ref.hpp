@@ -0,0 +1,183 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <utility>
+
+#include "boot_services.hpp"
+
+namespace efi {
+
+// An open_protocol that is closed with the same handles when the reference
+// is destroyed or reassigned, so ByDriver and Exclusive opens cannot leak.
+// Moves transfer the open, copies are not allowed.
+template <IsProtocol P>
+class ProtocolRef final {
+ private:
+  BootServices* boot_services_ = nullptr;
+  P*            interface_     = nullptr;
+  Handle        handle_        = nullptr;
+  Handle        agent_         = nullptr;
+  Handle        controller_    = nullptr;
+
+ public:
+  ProtocolRef() noexcept = default;
+
+  ProtocolRef(ProtocolRef&& other) noexcept
+      : boot_services_{std::exchange(other.boot_services_, nullptr)},
+        interface_{std::exchange(other.interface_, nullptr)},
+        handle_{other.handle_},
+        agent_{other.agent_},
+        controller_{other.controller_} {}
+
+  ~ProtocolRef() {
+    close();
+  }
+
+  ProtocolRef(const ProtocolRef&)                    = delete;
+  auto operator=(const ProtocolRef&) -> ProtocolRef& = delete;
+
+  auto operator=(ProtocolRef&& other) noexcept -> ProtocolRef& {
+    if (this != &other) {
+      close();
+      boot_services_ = std::exchange(other.boot_services_, nullptr);
+      interface_     = std::exchange(other.interface_, nullptr);
+      handle_        = other.handle_;
+      agent_         = other.agent_;
+      controller_    = other.controller_;
+    }
+    return *this;
+  }
+
+  // Closes what the reference held first. Attributes other than
+  // GetProtocol belong here, GetProtocolRef covers that one.
+  auto open(BootServices* boot_services, Handle handle, Handle agent,
+            Handle controller, OpenProtocolAttribute attributes) noexcept
+      -> Status {
+    close();
+
+    auto*      interface = static_cast<P*>(nullptr);
+    const auto status    = boot_services->open_protocol(
+        handle, &interface, agent, controller, attributes);
+    if (status != Status::Success) {
+      return status;
+    }
+
+    boot_services_ = boot_services;
+    interface_     = interface;
+    handle_        = handle;
+    agent_         = agent;
+    controller_    = controller;
+    return Status::Success;
+  }
+
+  // NotStarted when nothing is open
+  auto close() noexcept -> Status {
+    if (boot_services_ == nullptr) {
+      return Status::NotStarted;
+    }
+    auto* boot_services = std::exchange(boot_services_, nullptr);
+    interface_          = nullptr;
+    return boot_services->close_protocol<P>(handle_, agent_, controller_);
+  }
+
+  // Gives up the open without closing it
+  auto release() noexcept -> P* {
+    boot_services_ = nullptr;
+    return std::exchange(interface_, nullptr);
+  }
+
+  NODISCARD auto get() const noexcept -> P* {
+    return interface_;
+  }
+
+  NODISCARD auto handle() const noexcept -> Handle {
+    return handle_;
+  }
+
+  NODISCARD auto agent() const noexcept -> Handle {
+    return agent_;
+  }
+
+  NODISCARD auto controller() const noexcept -> Handle {
+    return controller_;
+  }
+
+  NODISCARD auto operator->() const noexcept -> P* {
+    return interface_;
+  }
+
+  NODISCARD auto operator*() const noexcept -> P& {
+    return *interface_;
+  }
+
+  NODISCARD explicit operator bool() const noexcept {
+    return interface_ != nullptr;
+  }
+};
+
+// An open_protocol with GetProtocol, which the firmware does not need to see
+// closed. It holds only the interface and its handle.
+template <IsProtocol P>
+class GetProtocolRef final {
+ private:
+  P*     interface_ = nullptr;
+  Handle handle_    = nullptr;
+
+ public:
+  GetProtocolRef() noexcept = default;
+
+  auto open(BootServices* boot_services, Handle handle, Handle agent,
+            Handle controller) noexcept -> Status {
+    auto*      interface = static_cast<P*>(nullptr);
+    const auto status    = boot_services->open_protocol(
+        handle, &interface, agent, controller,
+        OpenProtocolAttribute::GetProtocol);
+    if (status != Status::Success) {
+      return status;
+    }
+
+    interface_ = interface;
+    handle_    = handle;
+    return Status::Success;
+  }
+
+  NODISCARD auto get() const noexcept -> P* {
+    return interface_;
+  }
+
+  NODISCARD auto handle() const noexcept -> Handle {
+    return handle_;
+  }
+
+  NODISCARD auto operator->() const noexcept -> P* {
+    return interface_;
+  }
+
+  NODISCARD auto operator*() const noexcept -> P& {
+    return *interface_;
+  }
+
+  NODISCARD explicit operator bool() const noexcept {
+    return interface_ != nullptr;
+  }
+};
+
+}  // namespace efi
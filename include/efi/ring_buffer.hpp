@@ -0,0 +1,227 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <concepts>
+#include <utility>
+
+#include "core.hpp"
+
+namespace efi {
+
+constexpr auto cache_line_size = uintn_t{64};
+
+// Fixed capacity rings for handing data from EventNotify callbacks to the
+// main loop without raising the TPL.
+//
+// A notify function preempts whatever runs below its TPL, so neither side
+// ever waits for the other: a push or pop either completes or reports the
+// ring full or empty. Indices touched by different sides live on separate
+// cache lines.
+
+template <typename T>
+concept RingElement = std::default_initializable<T> &&
+                      std::is_nothrow_move_assignable_v<T>;
+
+#pragma region Single Producer
+
+// One producer, one consumer, for example a notify function feeding the
+// main loop
+template <RingElement T, uintn_t Capacity>
+class SpscRing final {
+  static_assert(Capacity >= 2 && std::has_single_bit(Capacity),
+                "Capacity must be a power of two");
+
+ private:
+  static constexpr auto mask = Capacity - 1;
+
+  // Consumer side
+  alignas(cache_line_size) std::atomic<uintn_t> head_{0};
+
+  // Producer side, head_cache_ spares a read of the consumer line per push
+  alignas(cache_line_size) std::atomic<uintn_t> tail_{0};
+  uintn_t               head_cache_ = 0;
+  std::atomic<uint64_t> dropped_{0};
+
+  alignas(cache_line_size) std::array<T, Capacity> slots_{};
+
+ public:
+  constexpr SpscRing() noexcept = default;
+
+  SpscRing(SpscRing&&)                         = delete;
+  SpscRing(const SpscRing&)                    = delete;
+  auto operator=(SpscRing&&) -> SpscRing&      = delete;
+  auto operator=(const SpscRing&) -> SpscRing& = delete;
+
+  // Producer only, false when full
+  auto push(T value) noexcept -> bool {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ == Capacity) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ == Capacity) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+
+    slots_[tail & mask] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only, false when empty
+  auto pop(T* value) noexcept -> bool {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    *value = std::move(slots_[head & mask]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  NODISCARD auto size() const noexcept -> uintn_t {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  NODISCARD auto empty() const noexcept {
+    return size() == 0;
+  }
+
+  NODISCARD static constexpr auto capacity() noexcept {
+    return Capacity;
+  }
+
+  // Pushes rejected because the ring was full
+  NODISCARD auto dropped() const noexcept {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+};
+
+#pragma endregion
+
+#pragma region Multi Producer
+
+// Any number of producers, one consumer, for example notify functions at
+// different TPLs preempting each other. Each slot carries a sequence number
+// telling whose turn it is, as in Vyukov's bounded queue, so a producer
+// preempted between claiming and filling a slot only delays the consumer.
+template <RingElement T, uintn_t Capacity>
+class MpscRing final {
+  static_assert(Capacity >= 2 && std::has_single_bit(Capacity),
+                "Capacity must be a power of two");
+
+ private:
+  static constexpr auto mask = Capacity - 1;
+
+  struct Slot {
+    std::atomic<uintn_t> sequence;
+    T                    value;
+  };
+
+  // Producer side
+  alignas(cache_line_size) std::atomic<uintn_t> tail_{0};
+  std::atomic<uint64_t> dropped_{0};
+
+  // Consumer side
+  alignas(cache_line_size) uintn_t head_ = 0;
+
+  alignas(cache_line_size) std::array<Slot, Capacity> slots_;
+
+ public:
+  MpscRing() noexcept {
+    for (auto i = uintn_t{0}; i < Capacity; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpscRing(MpscRing&&)                         = delete;
+  MpscRing(const MpscRing&)                    = delete;
+  auto operator=(MpscRing&&) -> MpscRing&      = delete;
+  auto operator=(const MpscRing&) -> MpscRing& = delete;
+
+  // Any producer, false when full
+  auto push(T value) noexcept -> bool {
+    auto  position = tail_.load(std::memory_order_relaxed);
+    Slot* slot     = nullptr;
+
+    for (;;) {
+      slot = &slots_[position & mask];
+      const auto sequence = slot->sequence.load(std::memory_order_acquire);
+      const auto distance =
+          static_cast<intn_t>(sequence) - static_cast<intn_t>(position);
+
+      if (distance == 0) {
+        if (tail_.compare_exchange_weak(position, position + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (distance < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        position = tail_.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->value = std::move(value);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only, false when empty or the oldest slot is still being filled
+  auto pop(T* value) noexcept -> bool {
+    auto& slot = slots_[head_ & mask];
+    if (slot.sequence.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+
+    *value = std::move(slot.value);
+    slot.sequence.store(head_ + Capacity, std::memory_order_release);
+    head_++;
+    return true;
+  }
+
+  // Claimed slots, including ones still being filled
+  NODISCARD auto size() const noexcept -> uintn_t {
+    return tail_.load(std::memory_order_acquire) - head_;
+  }
+
+  NODISCARD auto empty() const noexcept {
+    return size() == 0;
+  }
+
+  NODISCARD static constexpr auto capacity() noexcept {
+    return Capacity;
+  }
+
+  NODISCARD auto dropped() const noexcept {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+};
+
+#pragma endregion
+
+}  // namespace efi
@@ -123,6 +123,8 @@ class RuntimeServices final : public Table {
 
   const QueryVariableInfoFn query_variable_info_;
 
+  friend class Tracer;
+
  public:
   RuntimeServices()                                          = delete;
   RuntimeServices(RuntimeServices&&)                         = delete;
@@ -0,0 +1,249 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <cstddef>
+
+#include "boot_services.hpp"
+
+namespace efi {
+
+// Size class allocator in front of allocate_pool / free_pool. Each class keeps
+// an intrusive free list refilled from page runs, so once a class is warm
+// allocate / deallocate never enter the firmware. Requests larger than the
+// biggest class fall through to the pool.
+//
+// Deallocation is sized, the caller passes back the size it allocated with.
+class SlabAllocator final {
+ public:
+  static constexpr auto class_sizes =
+      std::array<uintn_t, 8>{16, 32, 64, 128, 256, 512, 1024, 2048};
+
+  static constexpr auto class_count = class_sizes.size();
+  static constexpr auto max_size    = class_sizes.back();
+
+  // Every block is aligned to at least this, independent of its class
+  static constexpr auto alignment   = uintn_t{16};
+
+  struct ClassStats {
+    uintn_t hits;
+    uintn_t refills;
+    uintn_t live_blocks;
+    uintn_t free_blocks;
+    uintn_t pages_reserved;
+  };
+
+  struct Stats {
+    std::array<ClassStats, class_count> classes;
+
+    uintn_t pool_allocations;
+    uintn_t pool_frees;
+
+    // Sum of the sizes callers asked for, versus the class sized blocks
+    // handed out to satisfy them
+    uintn_t bytes_requested;
+    uintn_t bytes_allocated;
+
+    // Class rounding lost inside live blocks
+    NODISCARD auto internal_fragmentation() const noexcept -> uintn_t {
+      return bytes_allocated - bytes_requested;
+    }
+
+    // Bytes sitting on free lists, reserved from the firmware but unused
+    NODISCARD auto external_fragmentation() const noexcept -> uintn_t {
+      auto bytes = uintn_t{0};
+      for (auto i = uintn_t{0}; i < class_count; ++i) {
+        bytes += classes[i].free_blocks * class_sizes[i];
+      }
+      return bytes;
+    }
+  };
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // Lives at the start of every run, padded so blocks stay aligned
+  struct alignas(alignment) Run {
+    Run*    next;
+    uintn_t pages;
+  };
+
+  static constexpr auto min_blocks_per_refill = uintn_t{16};
+
+  BootServices* const boot_services_;
+  const MemoryType    memory_type_;
+
+  std::array<FreeBlock*, class_count> free_lists_{};
+  Run*                                runs_ = nullptr;
+  Stats                               stats_{};
+
+ public:
+  explicit SlabAllocator(
+      BootServices* boot_services,
+      MemoryType    memory_type = MemoryType::LoaderData) noexcept
+      : boot_services_{boot_services}, memory_type_{memory_type} {}
+
+  // Blocks still allocated from the slabs become invalid, pool fallbacks
+  // remain owned by the caller
+  ~SlabAllocator() {
+    while (runs_ != nullptr) {
+      auto* run = runs_;
+      runs_     = run->next;
+      boot_services_->free_pages(reinterpret_cast<PhysicalAddress>(run),
+                                 run->pages);
+    }
+  }
+
+  SlabAllocator()                                        = delete;
+  SlabAllocator(SlabAllocator&&)                         = delete;
+  SlabAllocator(const SlabAllocator&)                    = delete;
+  auto operator=(SlabAllocator&&) -> SlabAllocator&      = delete;
+  auto operator=(const SlabAllocator&) -> SlabAllocator& = delete;
+
+  // Returns nullptr when the firmware is out of memory
+  NODISCARD auto allocate(uintn_t size) noexcept -> void* {
+    if (size > max_size) {
+      return allocate_pool(size);
+    }
+
+    const auto index = class_index(size);
+    auto&      stats = stats_.classes[index];
+
+    if (free_lists_[index] != nullptr) {
+      stats.hits++;
+    } else if (!refill(index)) {
+      return nullptr;
+    }
+
+    auto* block        = free_lists_[index];
+    free_lists_[index] = block->next;
+    stats.free_blocks--;
+    stats.live_blocks++;
+    stats_.bytes_requested += size;
+    stats_.bytes_allocated += class_sizes[index];
+    return block;
+  }
+
+  template <typename T>
+  NODISCARD auto allocate() noexcept -> T* {
+    static_assert(alignof(T) <= alignment);
+    return static_cast<T*>(allocate(sizeof(T)));
+  }
+
+  // size must match the size passed to allocate
+  void deallocate(void* memory, uintn_t size) noexcept {
+    if (memory == nullptr) {
+      return;
+    }
+
+    if (size > max_size) {
+      stats_.pool_frees++;
+      boot_services_->free_pool(static_cast<void**>(memory)[-1]);
+      return;
+    }
+
+    const auto index   = class_index(size);
+    auto*      block   = static_cast<FreeBlock*>(memory);
+    block->next        = free_lists_[index];
+    free_lists_[index] = block;
+
+    auto& stats = stats_.classes[index];
+    stats.live_blocks--;
+    stats.free_blocks++;
+    stats_.bytes_requested -= size;
+    stats_.bytes_allocated -= class_sizes[index];
+  }
+
+  template <typename T>
+  void deallocate(T* memory) noexcept {
+    deallocate(memory, sizeof(T));
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  NODISCARD static constexpr auto class_index(uintn_t size) noexcept
+      -> uintn_t {
+    auto index = uintn_t{0};
+    while (class_sizes[index] < size) {
+      ++index;
+    }
+    return index;
+  }
+
+  // The pool only guarantees 8 bytes, so the block is over allocated, moved
+  // up to alignment and the pool address kept in the word before it
+  NODISCARD auto allocate_pool(uintn_t size) noexcept -> void* {
+    void* memory = nullptr;
+    if (boot_services_->allocate_pool(memory_type_, size + alignment,
+                                      &memory) != Status::Success) {
+      return nullptr;
+    }
+    stats_.pool_allocations++;
+
+    const auto address = reinterpret_cast<uintn_t>(memory);
+    auto*      block   = reinterpret_cast<void**>(
+        (address + alignment) & ~(alignment - 1));
+    block[-1] = memory;
+    return block;
+  }
+
+  // Carves a fresh run into blocks and pushes them onto the class free list
+  NODISCARD auto refill(uintn_t index) noexcept -> bool {
+    const auto block_size = class_sizes[index];
+    const auto bytes      = sizeof(Run) + block_size * min_blocks_per_refill;
+    const auto pages      = (bytes + page_size - 1) / page_size;
+
+    auto memory = PhysicalAddress{};
+    if (boot_services_->allocate_pages(AllocateType::AnyPages, memory_type_,
+                                       pages, &memory) != Status::Success) {
+      return false;
+    }
+
+    auto* run  = reinterpret_cast<Run*>(memory);
+    run->next  = runs_;
+    run->pages = pages;
+    runs_      = run;
+
+    auto*      cursor = reinterpret_cast<uint8_t*>(run + 1);
+    const auto blocks = (pages * page_size - sizeof(Run)) / block_size;
+
+    // Pushed in reverse so blocks are handed out in address order
+    for (auto i = blocks; i > 0; --i) {
+      auto* block        = reinterpret_cast<FreeBlock*>(cursor +
+                                                        (i - 1) * block_size);
+      block->next        = free_lists_[index];
+      free_lists_[index] = block;
+    }
+
+    auto& stats           = stats_.classes[index];
+    stats.refills++;
+    stats.free_blocks    += blocks;
+    stats.pages_reserved += pages;
+    return true;
+  }
+};
+
+}  // namespace efi
@@ -0,0 +1,498 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "boot_services.hpp"
+#include "slab_allocator.hpp"
+#include "platform/x64.hpp"
+
+namespace efi {
+
+class Executor;
+
+template <typename T>
+class Task;
+
+// Anything carrying a completion event and the status the firmware writes
+// before signaling it
+template <typename T>
+concept CompletionToken = requires(const T& token) {
+  { token.event() } -> std::convertible_to<Event>;
+  { token.status() } -> std::convertible_to<Status>;
+};
+
+struct TaskStats {
+  uint64_t waits;
+
+  // Time spent suspended on events, in tsc cycles
+  uint64_t wait_cycles;
+  uint64_t max_wait_cycles;
+
+  NODISCARD auto wait_microseconds(uint64_t tsc_frequency) const noexcept
+      -> uint64_t {
+    return tsc_frequency != 0 ? wait_cycles * 1'000'000 / tsc_frequency : 0;
+  }
+};
+
+#pragma region Promise
+
+class TaskPromiseBase {
+ private:
+  std::coroutine_handle<> continuation_ = std::noop_coroutine();
+  TaskPromiseBase*        parent_       = nullptr;
+  TaskStats               stats_{};
+
+  // Returns to whoever awaited the task, or to the executor for a root task
+  class FinalAwaiter final {
+   public:
+    NODISCARD auto await_ready() const noexcept -> bool {
+      return false;
+    }
+
+    // Waits of a child count towards the task that awaited it
+    template <typename Promise>
+    auto await_suspend(std::coroutine_handle<Promise> handle) const noexcept
+        -> std::coroutine_handle<> {
+      auto& promise = static_cast<TaskPromiseBase&>(handle.promise());
+      if (promise.parent_ != nullptr) {
+        auto& parent = promise.parent_->stats_;
+        parent.waits       += promise.stats_.waits;
+        parent.wait_cycles += promise.stats_.wait_cycles;
+        if (promise.stats_.max_wait_cycles > parent.max_wait_cycles) {
+          parent.max_wait_cycles = promise.stats_.max_wait_cycles;
+        }
+      }
+      return promise.continuation_;
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+ public:
+  // Frames come from the slabs of the live executor, a coroutine called
+  // without one yields an invalid task
+  static auto operator new(size_t size) noexcept -> void*;
+  static void operator delete(void* frame, size_t size) noexcept;
+
+  // Tasks are lazy, they run once spawned or awaited
+  NODISCARD auto initial_suspend() const noexcept {
+    return std::suspend_always{};
+  }
+
+  NODISCARD auto final_suspend() const noexcept {
+    return FinalAwaiter{};
+  }
+
+  void unhandled_exception() const noexcept {
+    std::terminate();
+  }
+
+  friend class Executor;
+
+  template <typename T>
+  friend class Task;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+ private:
+  std::optional<T> result_;
+
+ public:
+  template <typename U>
+  void return_value(U&& value) noexcept {
+    result_.emplace(std::forward<U>(value));
+  }
+
+  template <typename U>
+  friend class Task;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+ public:
+  void return_void() const noexcept {}
+};
+
+#pragma endregion
+
+// Lazily started coroutine. Awaiting a task runs it to completion and
+// resumes the awaiting coroutine with its result, spawning it on an Executor
+// runs it as a root. The Task object owns the frame and must outlive it.
+template <typename T = void>
+class Task final {
+ public:
+  class promise_type final : public TaskPromise<T> {
+   public:
+    NODISCARD auto get_return_object() noexcept -> Task {
+      return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+
+    NODISCARD static auto get_return_object_on_allocation_failure() noexcept
+        -> Task {
+      return Task{};
+    }
+  };
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+
+  class Awaiter final {
+   private:
+    std::coroutine_handle<promise_type> handle_;
+
+   public:
+    explicit Awaiter(std::coroutine_handle<promise_type> handle) noexcept
+        : handle_{handle} {}
+
+    NODISCARD auto await_ready() const noexcept -> bool {
+      return !handle_ || handle_.done();
+    }
+
+    template <typename Promise>
+    auto await_suspend(std::coroutine_handle<Promise> awaiting) const noexcept
+        -> std::coroutine_handle<> {
+      auto& promise         = handle_.promise();
+      promise.continuation_ = awaiting;
+      if constexpr (std::derived_from<Promise, TaskPromiseBase>) {
+        promise.parent_ = &awaiting.promise();
+      }
+      return handle_;
+    }
+
+    auto await_resume() const noexcept -> T {
+      if constexpr (!std::is_void_v<T>) {
+        return std::move(*handle_.promise().result_);
+      }
+    }
+  };
+
+  explicit Task(std::coroutine_handle<promise_type> handle) noexcept
+      : handle_{handle} {}
+
+ public:
+  Task() noexcept = default;
+
+  Task(Task&& other) noexcept : handle_{std::exchange(other.handle_, {})} {}
+
+  ~Task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  Task(const Task&)                    = delete;
+  auto operator=(const Task&) -> Task& = delete;
+
+  auto operator=(Task&& other) noexcept -> Task& {
+    if (this != &other) {
+      if (handle_) {
+        handle_.destroy();
+      }
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+
+  // False when the frame could not be allocated, such a task must not be
+  // awaited or spawned
+  NODISCARD auto valid() const noexcept -> bool {
+    return static_cast<bool>(handle_);
+  }
+
+  NODISCARD auto done() const noexcept -> bool {
+    return handle_ && handle_.done();
+  }
+
+  // Includes the waits of every task it awaited
+  NODISCARD auto& stats() const noexcept {
+    return handle_.promise().stats_;
+  }
+
+  // Only valid once done
+  NODISCARD auto& result() const noexcept
+    requires(!std::is_void_v<T>)
+  {
+    return *handle_.promise().result_;
+  }
+
+  NODISCARD auto operator co_await() const noexcept {
+    return Awaiter{handle_};
+  }
+
+  friend class Executor;
+};
+
+// Single threaded executor for Tasks that suspend on firmware events.
+//
+// Runnable coroutines sit in a ring, suspended ones in an array parallel to
+// the event array handed to wait_for_events, so the index it returns maps to
+// the waiter directly and the waiter is swap-removed in constant time.
+//
+// run must be called at TPL_APPLICATION, and waited events must not be of
+// type NotifySignal, as wait_for_events requires. One executor may exist at a
+// time, coroutine frames are carved from its slabs and must be destroyed
+// before it.
+class Executor final {
+ public:
+  static constexpr auto max_tasks = uintn_t{64};
+
+  struct Stats {
+    uint64_t resumes;
+    uint64_t wakeups;
+
+    // Time blocked in wait_for_events, in tsc cycles
+    uint64_t idle_cycles;
+    uintn_t  peak_waiting;
+  };
+
+  class EventAwaiter {
+   private:
+    Executor* const         executor_;
+    const Event             event_;
+    std::coroutine_handle<> handle_;
+    TaskStats*              stats_  = nullptr;
+    uint64_t                start_  = 0;
+    Status                  status_ = Status::Success;
+
+   public:
+    EventAwaiter(Executor* executor, Event event) noexcept
+        : executor_{executor}, event_{event} {}
+
+    NODISCARD auto await_ready() const noexcept -> bool {
+      return false;
+    }
+
+    // Resumes immediately with OutOfResources when every waiter slot is
+    // taken, or AccessDenied when another task waits on the event
+    template <typename Promise>
+    auto await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        -> bool {
+      handle_ = handle;
+      stats_  = &static_cast<TaskPromiseBase&>(handle.promise()).stats_;
+      start_  = read_tsc();
+      status_ = executor_->park(this);
+      return status_ == Status::Success;
+    }
+
+    auto await_resume() const noexcept -> Status {
+      if (status_ == Status::Success) {
+        const auto cycles     = read_tsc() - start_;
+        stats_->waits++;
+        stats_->wait_cycles  += cycles;
+        if (cycles > stats_->max_wait_cycles) {
+          stats_->max_wait_cycles = cycles;
+        }
+      }
+      return status_;
+    }
+
+    friend class Executor;
+  };
+
+  // Yields the status the firmware left in the token
+  template <CompletionToken Token>
+  class TokenAwaiter final : public EventAwaiter {
+   private:
+    const Token& token_;
+
+   public:
+    TokenAwaiter(Executor* executor, const Token& token) noexcept
+        : EventAwaiter{executor, token.event()}, token_{token} {}
+
+    auto await_resume() const noexcept -> Status {
+      const auto status = EventAwaiter::await_resume();
+      return status == Status::Success ? static_cast<Status>(token_.status())
+                                       : status;
+    }
+  };
+
+ private:
+  static inline Executor* current_ = nullptr;
+
+  BootServices* const boot_services_;
+  SlabAllocator       frames_;
+
+  std::array<std::coroutine_handle<>, max_tasks> ready_{};
+  uintn_t                                        ready_head_  = 0;
+  uintn_t                                        ready_count_ = 0;
+
+  std::array<Event, max_tasks>         events_{};
+  std::array<EventAwaiter*, max_tasks> waiters_{};
+  uintn_t                              waiting_ = 0;
+
+  bool  running_ = false;
+  Stats stats_{};
+
+ public:
+  explicit Executor(BootServices* boot_services) noexcept
+      : boot_services_{boot_services}, frames_{boot_services} {
+    current_ = this;
+  }
+
+  ~Executor() {
+    if (current_ == this) {
+      current_ = nullptr;
+    }
+  }
+
+  Executor()                                   = delete;
+  Executor(Executor&&)                         = delete;
+  Executor(const Executor&)                    = delete;
+  auto operator=(Executor&&) -> Executor&      = delete;
+  auto operator=(const Executor&) -> Executor& = delete;
+
+  // Queues a task as a root, it starts on the next run. The task is not
+  // owned by the executor.
+  template <typename T>
+  auto spawn(Task<T>& task) noexcept -> Status {
+    if (!task.valid() || task.done()) {
+      return Status::InvalidParameter;
+    }
+
+    // Every live root is either ready, waiting or the one running
+    if (ready_count_ + waiting_ + (running_ ? 1 : 0) >= max_tasks) {
+      return Status::OutOfResources;
+    }
+
+    push_ready(task.handle_);
+    return Status::Success;
+  }
+
+  // A signal wakes a single waiter, so the await yields AccessDenied when
+  // another task already waits on event; it would never be woken
+  NODISCARD auto wait(Event event) noexcept {
+    return EventAwaiter{this, event};
+  }
+
+  // Same as waiting on the token event
+  template <CompletionToken Token>
+  NODISCARD auto wait(const Token& token) noexcept {
+    return TokenAwaiter<Token>{this, token};
+  }
+
+  // Runs until every spawned task has finished. A wait_for_events failure
+  // naming a single event is handed to the task waiting on it, any other
+  // failure is returned with the remaining tasks still suspended.
+  auto run() noexcept -> Status {
+    while (ready_count_ != 0 || waiting_ != 0) {
+      while (ready_count_ != 0) {
+        auto handle = pop_ready();
+        stats_.resumes++;
+        running_ = true;
+        handle.resume();
+        running_ = false;
+      }
+
+      if (waiting_ == 0) {
+        break;
+      }
+
+      const auto start  = read_tsc();
+      auto       index  = uintn_t{0};
+      const auto status =
+          boot_services_->wait_for_events(waiting_, events_.data(), &index);
+      stats_.idle_cycles += read_tsc() - start;
+
+      if (status != Status::Success &&
+          (status != Status::InvalidParameter || index >= waiting_)) {
+        return status;
+      }
+
+      wake(index, status);
+    }
+
+    return Status::Success;
+  }
+
+  NODISCARD auto waiting() const noexcept {
+    return waiting_;
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  void push_ready(std::coroutine_handle<> handle) noexcept {
+    ready_[(ready_head_ + ready_count_) % max_tasks] = handle;
+    ready_count_++;
+  }
+
+  NODISCARD auto pop_ready() noexcept -> std::coroutine_handle<> {
+    auto handle  = ready_[ready_head_];
+    ready_head_  = (ready_head_ + 1) % max_tasks;
+    ready_count_--;
+    return handle;
+  }
+
+  auto park(EventAwaiter* awaiter) noexcept -> Status {
+    if (waiting_ == max_tasks) {
+      return Status::OutOfResources;
+    }
+    for (auto i = uintn_t{0}; i < waiting_; ++i) {
+      if (events_[i] == awaiter->event_) {
+        return Status::AccessDenied;
+      }
+    }
+
+    events_[waiting_]  = awaiter->event_;
+    waiters_[waiting_] = awaiter;
+    waiting_++;
+    if (waiting_ > stats_.peak_waiting) {
+      stats_.peak_waiting = waiting_;
+    }
+    return Status::Success;
+  }
+
+  void wake(uintn_t index, Status status) noexcept {
+    auto* awaiter    = waiters_[index];
+    awaiter->status_ = status;
+
+    waiting_--;
+    events_[index]  = events_[waiting_];
+    waiters_[index] = waiters_[waiting_];
+
+    stats_.wakeups++;
+    push_ready(awaiter->handle_);
+  }
+
+  friend class TaskPromiseBase;
+};
+
+inline auto TaskPromiseBase::operator new(size_t size) noexcept -> void* {
+  return Executor::current_ != nullptr
+             ? Executor::current_->frames_.allocate(size)
+             : nullptr;
+}
+
+inline void TaskPromiseBase::operator delete(void* frame,
+                                             size_t size) noexcept {
+  Executor::current_->frames_.deallocate(frame, size);
+}
+
+}  // namespace efi
@@ -0,0 +1,360 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+
+#include "boot_services.hpp"
+#include "platform/x64.hpp"
+
+namespace efi {
+
+// Software timers multiplexed onto one periodic firmware timer event.
+//
+// Timers are intrusive and owned by the caller, so arming never allocates.
+// Four levels of 64 slots cover 2^24 ticks; a timer lands in the level its
+// distance selects and cascades down as the wheel turns, making arm and
+// cancel O(1). Callbacks run from the event notify function at
+// TPL_CALLBACK, arm and cancel raise to it while touching the wheel. They
+// may also be called above TPL_CALLBACK, which they then keep.
+class TimerWheel final {
+ public:
+  class Timer;
+
+  using Callback = void (*)(Timer* timer, void* context) noexcept;
+
+  class Timer final {
+   private:
+    Timer*         next_      = nullptr;
+    Timer**        link_      = nullptr;
+    const Callback callback_;
+    void* const    context_;
+    uint64_t       expires_   = 0;
+    uint64_t       period_    = 0;
+    uint64_t       delay_     = 0;
+    uint64_t       armed_tsc_ = 0;
+
+   public:
+    Timer(Callback callback, void* context) noexcept
+        : callback_{callback}, context_{context} {}
+
+    Timer()                                = delete;
+    Timer(Timer&&)                         = delete;
+    Timer(const Timer&)                    = delete;
+    auto operator=(Timer&&) -> Timer&      = delete;
+    auto operator=(const Timer&) -> Timer& = delete;
+
+    NODISCARD auto armed() const noexcept {
+      return link_ != nullptr;
+    }
+
+    // Tick the timer fires on
+    NODISCARD auto expires() const noexcept {
+      return expires_;
+    }
+
+    friend class TimerWheel;
+  };
+
+  struct Stats {
+    uint64_t ticks;
+    uint64_t fired;
+    uint64_t cascaded;
+
+    // Cycles spent in the tick handler, callbacks included
+    uint64_t tick_cycles;
+    uint64_t max_tick_cycles;
+
+    // Cycles between consecutive ticks, as the firmware delivered them
+    uint64_t interval_cycles;
+
+    // How much later than requested timers fired, in cycles
+    uint64_t lag_cycles;
+    uint64_t max_lag_cycles;
+
+    NODISCARD auto cycles_per_tick() const noexcept -> uint64_t {
+      return ticks > 1 ? interval_cycles / (ticks - 1) : 0;
+    }
+
+    NODISCARD auto average_lag_cycles() const noexcept -> uint64_t {
+      return fired != 0 ? lag_cycles / fired : 0;
+    }
+  };
+
+  static constexpr auto level_bits = uintn_t{6};
+  static constexpr auto slot_count = uintn_t{1} << level_bits;
+  static constexpr auto levels     = uintn_t{4};
+  static constexpr auto max_delay  = (uint64_t{1} << (level_bits * levels)) - 1;
+
+  // 10ms in 100ns units
+  static constexpr auto default_tick_period = uint64_t{100'000};
+
+ private:
+  static constexpr auto notify_tpl = TplCallback;
+  static constexpr auto slot_mask  = slot_count - 1;
+
+  BootServices* const boot_services_;
+  const uint64_t      tick_period_;
+
+  std::array<std::array<Timer*, slot_count>, levels> slots_{};
+
+  Event    event_    = nullptr;
+  uint64_t current_  = 0;
+  uint64_t last_tsc_ = 0;
+  Stats    stats_{};
+
+ public:
+  // tick_period is in 100ns units like set_timer
+  explicit TimerWheel(BootServices* boot_services,
+                      uint64_t tick_period = default_tick_period) noexcept
+      : boot_services_{boot_services},
+        tick_period_{tick_period != 0 ? tick_period : 1} {}
+
+  // Armed timers are left armed but never fire
+  ~TimerWheel() {
+    stop();
+  }
+
+  TimerWheel()                                     = delete;
+  TimerWheel(TimerWheel&&)                         = delete;
+  TimerWheel(const TimerWheel&)                    = delete;
+  auto operator=(TimerWheel&&) -> TimerWheel&      = delete;
+  auto operator=(const TimerWheel&) -> TimerWheel& = delete;
+
+  auto start() noexcept -> Status {
+    if (event_ != nullptr) {
+      return Status::AlreadyStarted;
+    }
+
+    auto status = boot_services_->create_event(
+        EventType::Timer | EventType::NotifySignal, notify_tpl, &on_tick, this,
+        &event_);
+    if (status != Status::Success) {
+      event_ = nullptr;
+      return status;
+    }
+
+    status = boot_services_->set_timer(event_, TimerDelay::Periodic,
+                                       tick_period_);
+    if (status != Status::Success) {
+      stop();
+    }
+    return status;
+  }
+
+  void stop() noexcept {
+    if (event_ != nullptr) {
+      boot_services_->close_event(event_);
+      event_ = nullptr;
+    }
+  }
+
+  // Smallest tick count covering time, in 100ns units
+  NODISCARD auto ticks_for(uint64_t time) const noexcept -> uint64_t {
+    return (time + tick_period_ - 1) / tick_period_;
+  }
+
+  // Fires timer after ticks, then every period ticks when period is not 0.
+  // Rearming an armed timer moves it. Delays beyond max_delay are clamped.
+  auto arm(Timer* timer, uint64_t ticks, uint64_t period = 0) noexcept
+      -> Status {
+    if (timer == nullptr || timer->callback_ == nullptr) {
+      return Status::InvalidParameter;
+    }
+
+    const auto guard = TplGuard{boot_services_, TplHighLevel};
+    boot_services_->restore_tpl(lock_tpl(guard.previous()));
+    if (timer->armed()) {
+      unlink(timer);
+    }
+
+    ticks             = ticks < max_delay ? ticks : max_delay;
+    timer->expires_   = current_ + ticks;
+    timer->period_    = period < max_delay ? period : max_delay;
+    timer->delay_     = ticks;
+    timer->armed_tsc_ = read_tsc();
+    insert(timer);
+    return Status::Success;
+  }
+
+  // Returns NotFound when the timer was not armed
+  auto cancel(Timer* timer) noexcept -> Status {
+    if (timer == nullptr) {
+      return Status::InvalidParameter;
+    }
+
+    const auto guard = TplGuard{boot_services_, TplHighLevel};
+    boot_services_->restore_tpl(lock_tpl(guard.previous()));
+    if (!timer->armed()) {
+      return Status::NotFound;
+    }
+    unlink(timer);
+    return Status::Success;
+  }
+
+  // Next tick to be processed
+  NODISCARD auto now() const noexcept {
+    return current_;
+  }
+
+  NODISCARD auto tick_period() const noexcept {
+    return tick_period_;
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  static EFI_CALL void on_tick(Event /*event*/, void* context) noexcept {
+    static_cast<TimerWheel*>(context)->advance();
+  }
+
+  // The TPL the wheel is touched at. raise_tpl must not lower the TPL, so
+  // arm and cancel raise to TPL_HIGH_LEVEL to learn the caller's TPL and
+  // come back down to this.
+  NODISCARD static auto lock_tpl(TPL previous) noexcept -> TPL {
+    return previous > notify_tpl ? previous : notify_tpl;
+  }
+
+  NODISCARD static auto slot(uint64_t tick, uintn_t level) noexcept
+      -> uintn_t {
+    return (tick >> (level * level_bits)) & slot_mask;
+  }
+
+  void insert(Timer* timer) noexcept {
+    const auto delta = timer->expires_ > current_
+                           ? timer->expires_ - current_
+                           : uint64_t{0};
+
+    // Already due timers go in the slot processed next
+    auto level = uintn_t{0};
+    while (level < levels - 1 &&
+           delta >= (uint64_t{1} << ((level + 1) * level_bits))) {
+      ++level;
+    }
+    const auto index =
+        delta == 0 ? slot(current_, 0) : slot(timer->expires_, level);
+
+    auto& head   = slots_[level][index];
+    timer->next_ = head;
+    timer->link_ = &head;
+    if (head != nullptr) {
+      head->link_ = &timer->next_;
+    }
+    head = timer;
+  }
+
+  static void unlink(Timer* timer) noexcept {
+    *timer->link_ = timer->next_;
+    if (timer->next_ != nullptr) {
+      timer->next_->link_ = timer->link_;
+    }
+    timer->next_ = nullptr;
+    timer->link_ = nullptr;
+  }
+
+  // Moves a slot into a local list callbacks may still cancel from
+  static void detach(Timer*& head, Timer*& list) noexcept {
+    list = head;
+    head = nullptr;
+    if (list != nullptr) {
+      list->link_ = &list;
+    }
+  }
+
+  // Re-files the timers of an upper level slot closer to expiry
+  auto cascade(uintn_t level) noexcept -> uintn_t {
+    const auto index = slot(current_, level);
+    Timer*     list  = nullptr;
+    detach(slots_[level][index], list);
+
+    while (list != nullptr) {
+      auto* timer = list;
+      unlink(timer);
+      insert(timer);
+      stats_.cascaded++;
+    }
+    return index;
+  }
+
+  void advance() noexcept {
+    const auto start = read_tsc();
+    if (stats_.ticks != 0) {
+      stats_.interval_cycles += start - last_tsc_;
+    }
+    last_tsc_ = start;
+    stats_.ticks++;
+
+    const auto index = slot(current_, 0);
+    if (index == 0) {
+      for (auto level = uintn_t{1}; level < levels; ++level) {
+        if (cascade(level) != 0) {
+          break;
+        }
+      }
+    }
+
+    Timer* list = nullptr;
+    detach(slots_[0][index], list);
+    current_++;
+
+    while (list != nullptr) {
+      auto* timer = list;
+      unlink(timer);
+      record_lag(timer, start);
+      stats_.fired++;
+
+      if (timer->period_ != 0) {
+        timer->expires_   = current_ - 1 + timer->period_;
+        timer->delay_     = timer->period_;
+        timer->armed_tsc_ = start;
+        insert(timer);
+      }
+      timer->callback_(timer, timer->context_);
+    }
+
+    const auto cycles   = read_tsc() - start;
+    stats_.tick_cycles += cycles;
+    if (cycles > stats_.max_tick_cycles) {
+      stats_.max_tick_cycles = cycles;
+    }
+  }
+
+  // Lateness against the requested delay, using the observed tick length,
+  // which is unknown until two ticks have arrived
+  void record_lag(const Timer* timer, uint64_t now) noexcept {
+    const auto per_tick = stats_.cycles_per_tick();
+    if (per_tick == 0) {
+      return;
+    }
+
+    const auto expected = timer->delay_ * per_tick;
+    const auto elapsed  = now - timer->armed_tsc_;
+    const auto lag      = elapsed > expected ? elapsed - expected : 0;
+
+    stats_.lag_cycles += lag;
+    if (lag > stats_.max_lag_cycles) {
+      stats_.max_lag_cycles = lag;
+    }
+  }
+};
+
+}  // namespace efi
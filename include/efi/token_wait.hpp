@@ -0,0 +1,220 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <array>
+#include <concepts>
+#include <type_traits>
+
+#include "boot_services.hpp"
+#include "clock.hpp"
+#include "task.hpp"
+
+namespace efi {
+
+// How an expired token is taken back from the firmware: a protocol with a
+// cancel(token) member, such as Tcp4Protocol or DNS4Protocol, or a callable
+// taking the token, for protocols like Dhcp4Protocol that only have stop.
+template <typename C, typename T>
+concept TokenCanceller =
+    (std::is_pointer_v<C> && requires(C protocol, T* token) {
+      { protocol->cancel(token) } -> std::convertible_to<Status>;
+    }) ||
+    std::is_nothrow_invocable_r_v<Status, C, T*>;
+
+// Bounded waits on completion tokens.
+//
+// The token events are waited on together with one timer event, created on
+// first use and rearmed for every wait. When the timer wins, every token is
+// cancelled. The event of a token the cancel succeeded on is waited for, at
+// most drain_timeout, so the firmware is normally done with the token when
+// the wait returns Timeout. Token events must not be NotifySignal and waits
+// must happen at TPL_APPLICATION.
+class TokenWaiter final {
+ public:
+  static constexpr auto max_tokens = uintn_t{16};
+
+  // How long a cancelled token's event is waited for, 10ms in 100ns units
+  static constexpr auto drain_timeout = uint64_t{100'000};
+
+  struct Stats {
+    uint64_t waits;
+    uint64_t completed;
+    uint64_t timeouts;
+
+    // Cancelled tokens whose event was not signaled within drain_timeout
+    uint64_t undrained;
+  };
+
+ private:
+  BootServices* const boot_services_;
+  Event               timer_ = nullptr;
+  Stats               stats_{};
+
+ public:
+  explicit TokenWaiter(BootServices* boot_services) noexcept
+      : boot_services_{boot_services} {}
+
+  ~TokenWaiter() {
+    if (timer_ != nullptr) {
+      boot_services_->close_event(timer_);
+    }
+  }
+
+  TokenWaiter()                                      = delete;
+  TokenWaiter(TokenWaiter&&)                         = delete;
+  TokenWaiter(const TokenWaiter&)                    = delete;
+  auto operator=(TokenWaiter&&) -> TokenWaiter&      = delete;
+  auto operator=(const TokenWaiter&) -> TokenWaiter& = delete;
+
+  // Success once the token completed, its own status tells how. timeout is
+  // in 100ns units like set_timer.
+  template <CompletionToken T, TokenCanceller<T> C>
+  auto wait_for(T* token, uint64_t timeout, C cancel) noexcept -> Status {
+    auto index = uintn_t{0};
+    return wait_any(&token, 1, timeout, cancel, &index);
+  }
+
+  // Needs a calibrated Clock, NotStarted otherwise
+  template <CompletionToken T, TokenCanceller<T> C>
+  auto wait_until(T* token, Clock::time_point deadline, C cancel) noexcept
+      -> Status {
+    if (!Clock::calibrated()) {
+      return Status::NotStarted;
+    }
+    return wait_for(token, timeout_until(deadline), cancel);
+  }
+
+  // Stores the index of the first token to complete, the others are left
+  // pending. All of them are cancelled on expiry.
+  template <CompletionToken T, TokenCanceller<T> C>
+  auto wait_any(T* const* tokens, uintn_t count, uint64_t timeout, C cancel,
+                uintn_t* index) noexcept -> Status {
+    if (tokens == nullptr || count == 0 || count > max_tokens ||
+        index == nullptr) {
+      return Status::InvalidParameter;
+    }
+
+    std::array<Event, max_tokens + 1> events;
+    for (auto i = uintn_t{0}; i < count; ++i) {
+      if (tokens[i] == nullptr) {
+        return Status::InvalidParameter;
+      }
+      events[i] = tokens[i]->event();
+    }
+
+    if (auto status = arm(timeout); status != Status::Success) {
+      return status;
+    }
+    events[count] = timer_;
+
+    auto       signaled = uintn_t{0};
+    const auto status =
+        boot_services_->wait_for_events(count + 1, events.data(), &signaled);
+    disarm();
+    stats_.waits++;
+
+    if (status != Status::Success) {
+      return status;
+    }
+    if (signaled < count) {
+      stats_.completed++;
+      *index = signaled;
+      return Status::Success;
+    }
+
+    stats_.timeouts++;
+    for (auto i = uintn_t{0}; i < count; ++i) {
+      abort(tokens[i], cancel);
+    }
+    return Status::Timeout;
+  }
+
+  template <CompletionToken T, TokenCanceller<T> C>
+  auto wait_any_until(T* const* tokens, uintn_t count,
+                      Clock::time_point deadline, C cancel,
+                      uintn_t* index) noexcept -> Status {
+    if (!Clock::calibrated()) {
+      return Status::NotStarted;
+    }
+    return wait_any(tokens, count, timeout_until(deadline), cancel, index);
+  }
+
+  NODISCARD auto& stats() const noexcept {
+    return stats_;
+  }
+
+ private:
+  // In 100ns units, 0 once the deadline passed
+  NODISCARD static auto timeout_until(Clock::time_point deadline) noexcept
+      -> uint64_t {
+    const auto remaining = (deadline - Clock::now()).count();
+    return remaining > 0 ? static_cast<uint64_t>(remaining) / 100 : 0;
+  }
+
+  auto arm(uint64_t timeout) noexcept -> Status {
+    if (timer_ == nullptr) {
+      const auto status = boot_services_->create_event(
+          EventType::Timer, TplCallback, nullptr, nullptr, &timer_);
+      if (status != Status::Success) {
+        timer_ = nullptr;
+        return status;
+      }
+    }
+    return boot_services_->set_timer(timer_, TimerDelay::Relative, timeout);
+  }
+
+  // A timer that fired while a token won stays signaled, check_event clears
+  // it for the next wait
+  void disarm() noexcept {
+    boot_services_->set_timer(timer_, TimerDelay::Cancel, 0);
+    boot_services_->check_event(timer_);
+  }
+
+  // A successful cancel should signal the token event, but a callable such
+  // as a protocol stop need not, so the wait is bounded by the timer. A
+  // failed cancel, NotFound included, means the token already completed or
+  // was never submitted: nothing more will be signaled and only a pending
+  // signal is cleared, so a later submission does not see it.
+  template <CompletionToken T, TokenCanceller<T> C>
+  void abort(T* token, C& cancel) noexcept {
+    auto status = Status::Success;
+    if constexpr (std::is_nothrow_invocable_r_v<Status, C, T*>) {
+      status = cancel(token);
+    } else {
+      status = cancel->cancel(token);
+    }
+
+    const auto event = token->event();
+    if (status == Status::Success && arm(drain_timeout) == Status::Success) {
+      auto events = std::array<Event, 2>{event, timer_};
+      auto index  = uintn_t{0};
+      if (boot_services_->wait_for_events(events.size(), events.data(),
+                                          &index) != Status::Success ||
+          index != 0) {
+        stats_.undrained++;
+      }
+      disarm();
+    }
+    boot_services_->check_event(event);
+  }
+};
+
+}  // namespace efi
@@ -0,0 +1,610 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+#include <algorithm>
+#include <array>
+#include <tuple>
+#include <type_traits>
+
+#include "boot_services.hpp"
+#include "clock.hpp"
+#include "crc32.hpp"
+#include "runtime_services.hpp"
+#include "platform/x64.hpp"
+#include "efi/protocol/block_io.hpp"
+#include "efi/protocol/file.hpp"
+#include "efi/protocol/serial.hpp"
+#include "efi/protocol/simple_text.hpp"
+
+namespace efi {
+
+// Per service call counts and timings, gathered by replacing the function
+// pointers of a service table with shims that time the original.
+//
+// Nothing is patched until install, so an image that never calls it pays
+// nothing. Once installed a call costs two read_tsc and a few adds on top of
+// the service. Cycles are inclusive: notify functions the firmware runs
+// inside a service count towards it. Service tables are resealed after
+// patching so verify_tables keeps passing.
+//
+// Each shim belongs to one table slot, so only one instance of a protocol is
+// traced at a time. The shims live in the image: uninstall before
+// exit_boot_services if the OS may reclaim it, and before
+// set_virtual_address_map in any case. The C variadic
+// install/uninstall_multiple_protocol_interfaces are left untouched.
+class Tracer final {
+ public:
+  struct Record {
+    const char* name;
+    uint64_t    calls;
+    uint64_t    cycles;
+    uint64_t    max_cycles;
+
+    // Sizes passed to services taking a buffer length or a page count
+    uint64_t bytes;
+  };
+
+  // Receives one line of a dump at a time, ending in "\r\n"
+  using Sink = auto (*)(const char* line, uintn_t length,
+                        void* context) noexcept -> Status;
+
+ private:
+  template <const auto& Names, auto... Members>
+  struct ServiceList {
+    static constexpr auto size = sizeof...(Members);
+  };
+
+  template <typename T>
+  struct MemberTraits;
+
+  template <typename Class, typename T>
+  struct MemberTraits<T Class::*> {
+    using Type = std::remove_const_t<T>;
+  };
+
+  template <auto Member>
+  using ServiceFn = typename MemberTraits<decltype(Member)>::Type;
+
+  template <auto A, auto B>
+  struct SameMember : std::false_type {};
+
+  template <auto A>
+  struct SameMember<A, A> : std::true_type {};
+
+  template <auto A, auto B>
+  static constexpr bool same_member = SameMember<A, B>::value;
+
+  static constexpr const char* boot_services_names[] = {
+      "raise_tpl",
+      "restore_tpl",
+      "allocate_pages",
+      "free_pages",
+      "get_memory_map",
+      "allocate_pool",
+      "free_pool",
+      "create_event",
+      "set_timer",
+      "wait_for_event",
+      "signal_event",
+      "close_event",
+      "check_event",
+      "install_protocol_interface",
+      "reinstall_protocol_interface",
+      "uninstall_protocol_interface",
+      "handle_protocol",
+      "register_protocol_notify",
+      "locate_handle",
+      "locate_device_path",
+      "install_configuration_table",
+      "load_image",
+      "start_image",
+      "exit",
+      "unload_image",
+      "exit_boot_services",
+      "get_next_monotonic_count",
+      "stall",
+      "set_watchdog_timer",
+      "connect_controller",
+      "disconnect_controller",
+      "open_protocol",
+      "close_protocol",
+      "open_protocol_information",
+      "protocols_per_handle",
+      "locate_handle_buffer",
+      "locate_protocol",
+      "calculate_crc32",
+      "copy_mem",
+      "set_mem",
+      "create_event_ex",
+  };
+
+  using BootServicesList = ServiceList<
+      boot_services_names, &BootServices::raise_tpl_,
+      &BootServices::restore_tpl_, &BootServices::allocate_pages_,
+      &BootServices::free_pages_, &BootServices::get_memory_map_,
+      &BootServices::allocate_pool_, &BootServices::free_pool_,
+      &BootServices::create_event_, &BootServices::set_timer_,
+      &BootServices::wait_for_event_, &BootServices::signal_event_,
+      &BootServices::close_event_, &BootServices::check_event_,
+      &BootServices::install_protocol_interface_,
+      &BootServices::reinstall_protocol_interface_,
+      &BootServices::uninstall_protocol_interface_,
+      &BootServices::handle_protocol_,
+      &BootServices::register_protocol_notify_,
+      &BootServices::locate_handle_, &BootServices::locate_device_path_,
+      &BootServices::install_configuration_table_, &BootServices::load_image_,
+      &BootServices::image_start_, &BootServices::exit_,
+      &BootServices::unload_image_, &BootServices::exit_boot_services_,
+      &BootServices::get_next_monotonic_count_, &BootServices::stall_,
+      &BootServices::set_watchdog_timer_, &BootServices::connect_controller_,
+      &BootServices::disconnect_controller_, &BootServices::open_protocol_,
+      &BootServices::close_protocol_,
+      &BootServices::open_protocol_information_,
+      &BootServices::protocols_per_handle_,
+      &BootServices::locate_handle_buffer_, &BootServices::locate_protocol_,
+      &BootServices::calculate_crc32_, &BootServices::copy_mem_,
+      &BootServices::set_mem_, &BootServices::create_event_ex_>;
+
+  static constexpr const char* runtime_services_names[] = {
+      "get_time",
+      "set_time",
+      "get_wakeup_time",
+      "set_wakeup_time",
+      "set_virtual_address_map",
+      "convert_pointer",
+      "get_variable",
+      "get_next_variable_name",
+      "set_variable",
+      "get_next_high_monotonic_count",
+      "reset_system",
+      "update_capsule",
+      "query_capsule_capabilities",
+      "query_variable_info",
+  };
+
+  using RuntimeServicesList = ServiceList<
+      runtime_services_names, &RuntimeServices::get_time_,
+      &RuntimeServices::set_time_, &RuntimeServices::get_wakeup_time_,
+      &RuntimeServices::set_wakeup_time_,
+      &RuntimeServices::set_virtual_address_map_,
+      &RuntimeServices::convert_pointer_, &RuntimeServices::get_variable_,
+      &RuntimeServices::get_next_variable_name_,
+      &RuntimeServices::set_variable_,
+      &RuntimeServices::get_next_high_monotonic_count_,
+      &RuntimeServices::reset_system_, &RuntimeServices::update_capsule_,
+      &RuntimeServices::query_capsule_capabilities_,
+      &RuntimeServices::query_variable_info_>;
+
+  static constexpr const char* block_io_names[] = {
+      "block_io.reset",
+      "block_io.read_blocks",
+      "block_io.write_blocks",
+      "block_io.flush_blocks",
+  };
+
+  using BlockIOList =
+      ServiceList<block_io_names, &BlockIOProtocol::reset_,
+                  &BlockIOProtocol::read_blocks_,
+                  &BlockIOProtocol::write_blocks_,
+                  &BlockIOProtocol::flush_blocks_>;
+
+  static constexpr auto max_services =
+      BootServicesList::size + RuntimeServicesList::size + BlockIOList::size;
+
+  template <auto Member>
+  static inline Record record_{};
+
+  // Set while the slot is patched
+  template <auto Member>
+  static inline ServiceFn<Member> original_ = nullptr;
+
+  template <auto Member, typename Fn = ServiceFn<Member>>
+  struct Shim;
+
+  template <auto Member, typename R, typename... A, bool NoExcept>
+  struct Shim<Member, R(EFI_CALL*)(A...) noexcept(NoExcept)> {
+    static EFI_CALL auto call(A... args) noexcept(NoExcept) -> R {
+      auto& record = record_<Member>;
+
+      // Counted up front, exit and reset_system never return
+      record.calls++;
+      record.bytes += bytes<Member>(args...);
+
+      const auto start = read_tsc();
+      if constexpr (std::is_void_v<R>) {
+        original_<Member>(args...);
+        add_cycles(&record, read_tsc() - start);
+      } else {
+        const auto result = original_<Member>(args...);
+        add_cycles(&record, read_tsc() - start);
+        return result;
+      }
+    }
+  };
+
+ public:
+  Tracer()                                 = delete;
+  Tracer(Tracer&&)                         = delete;
+  Tracer(const Tracer&)                    = delete;
+  ~Tracer()                                = delete;
+  auto operator=(Tracer&&) -> Tracer&      = delete;
+  auto operator=(const Tracer&) -> Tracer& = delete;
+
+  // Patches every service of a BootServices, RuntimeServices or
+  // BlockIOProtocol and clears their records
+  template <typename T>
+  static auto install(T* table) noexcept -> Status {
+    if (table == nullptr) {
+      return Status::InvalidParameter;
+    }
+    return patch(table, services(table));
+  }
+
+  // Restores the original services, the records are kept for dump
+  template <typename T>
+  static auto uninstall(T* table) noexcept -> Status {
+    if (table == nullptr) {
+      return Status::InvalidParameter;
+    }
+    return unpatch(table, services(table));
+  }
+
+  // Both service tables of the system table, or neither
+  static auto install(SystemTable* system_table) noexcept -> Status {
+    if (system_table == nullptr) {
+      return Status::InvalidParameter;
+    }
+    if (auto status = install(system_table->boot_services());
+        status != Status::Success) {
+      return status;
+    }
+    if (auto status = install(system_table->runtime_services());
+        status != Status::Success) {
+      uninstall(system_table->boot_services());
+      return status;
+    }
+    return Status::Success;
+  }
+
+  static auto uninstall(SystemTable* system_table) noexcept -> Status {
+    if (system_table == nullptr) {
+      return Status::InvalidParameter;
+    }
+    const auto status = uninstall(system_table->runtime_services());
+    const auto boot   = uninstall(system_table->boot_services());
+    return status != Status::Success ? status : boot;
+  }
+
+  // Zeroes every record, installed or not
+  static void reset() noexcept {
+    clear(BootServicesList{});
+    clear(RuntimeServicesList{});
+    clear(BlockIOList{});
+  }
+
+  // nullptr for an unknown name
+  NODISCARD static auto find(const char* name) noexcept -> const Record* {
+    std::array<const Record*, max_services> records;
+    const auto count = collect(records.data(), true);
+    for (auto i = uintn_t{0}; i < count; ++i) {
+      if (equal(records[i]->name, name)) {
+        return records[i];
+      }
+    }
+    return nullptr;
+  }
+
+  // Writes a table of every service called so far, most cycles first,
+  // stopping at the first error of the sink
+  static auto dump(Sink sink, void* context) noexcept -> Status {
+    if (sink == nullptr) {
+      return Status::InvalidParameter;
+    }
+
+    std::array<const Record*, max_services> records;
+    const auto count = collect(records.data(), false);
+    std::sort(records.begin(), records.begin() + count,
+              [](const Record* a, const Record* b) noexcept {
+                return a->cycles > b->cycles;
+              });
+
+    auto total = Record{"total", 0, 0, 0, 0};
+    for (auto i = uintn_t{0}; i < count; ++i) {
+      total.calls  += records[i]->calls;
+      total.cycles += records[i]->cycles;
+      total.bytes  += records[i]->bytes;
+      total.max_cycles = std::max(total.max_cycles, records[i]->max_cycles);
+    }
+
+    auto line = Line{};
+    line.text("service", name_width);
+    line.text("calls", number_width, true);
+    line.text("cycles", cycles_width, true);
+    line.text("max cycles", number_width, true);
+    line.text("us", number_width, true);
+    line.text("bytes", number_width, true);
+    if (auto status = line.flush(sink, context); status != Status::Success) {
+      return status;
+    }
+
+    for (auto i = uintn_t{0}; i < count; ++i) {
+      if (auto status = write_record(*records[i], sink, context);
+          status != Status::Success) {
+        return status;
+      }
+    }
+    return write_record(total, sink, context);
+  }
+
+  static auto dump(SimpleTextOutputProtocol* console) noexcept -> Status {
+    if (console == nullptr) {
+      return Status::InvalidParameter;
+    }
+    return dump(&console_sink, console);
+  }
+
+  static auto dump(FileProtocol* file) noexcept -> Status {
+    if (file == nullptr) {
+      return Status::InvalidParameter;
+    }
+    return dump(&write_sink<FileProtocol>, file);
+  }
+
+  static auto dump(SerialIOProtocol* serial) noexcept -> Status {
+    if (serial == nullptr) {
+      return Status::InvalidParameter;
+    }
+    return dump(&write_sink<SerialIOProtocol>, serial);
+  }
+
+ private:
+  static void add_cycles(Record* record, uint64_t cycles) noexcept {
+    record->cycles += cycles;
+    if (cycles > record->max_cycles) {
+      record->max_cycles = cycles;
+    }
+  }
+
+  // Bytes moved or allocated by a call, 0 where no size is passed in
+  template <auto Member, typename... A>
+  static auto bytes(A... args) noexcept -> uint64_t {
+    const auto arguments = std::forward_as_tuple(args...);
+    if constexpr (same_member<Member, &BootServices::allocate_pages_>) {
+      return std::get<2>(arguments) * page_size;
+    } else if constexpr (same_member<Member, &BootServices::free_pages_>) {
+      return std::get<1>(arguments) * page_size;
+    } else if constexpr (same_member<Member, &BootServices::allocate_pool_> ||
+                         same_member<Member, &BootServices::set_mem_> ||
+                         same_member<Member,
+                                     &BootServices::calculate_crc32_>) {
+      return std::get<1>(arguments);
+    } else if constexpr (same_member<Member, &BootServices::copy_mem_>) {
+      return std::get<2>(arguments);
+    } else if constexpr (same_member<Member, &RuntimeServices::set_variable_> ||
+                         same_member<Member, &BlockIOProtocol::read_blocks_> ||
+                         same_member<Member,
+                                     &BlockIOProtocol::write_blocks_>) {
+      return std::get<3>(arguments);
+    } else {
+      return 0;
+    }
+  }
+
+  NODISCARD static auto services(BootServices* /*table*/) noexcept {
+    return BootServicesList{};
+  }
+
+  NODISCARD static auto services(RuntimeServices* /*table*/) noexcept {
+    return RuntimeServicesList{};
+  }
+
+  NODISCARD static auto services(BlockIOProtocol* /*protocol*/) noexcept {
+    return BlockIOList{};
+  }
+
+  template <auto Member, typename T>
+  NODISCARD static auto slot(T* table) noexcept -> ServiceFn<Member>& {
+    return const_cast<ServiceFn<Member>&>(table->*Member);
+  }
+
+  template <typename T, const auto& Names, auto... Members>
+  static auto patch(T* table, ServiceList<Names, Members...> /*list*/) noexcept
+      -> Status {
+    if (((original_<Members> != nullptr) || ...)) {
+      return Status::AlreadyStarted;
+    }
+
+    auto index = uintn_t{0};
+    ((record_<Members>     = Record{Names[index++], 0, 0, 0, 0},
+      original_<Members>   = slot<Members>(table),
+      slot<Members>(table) = &Shim<Members>::call),
+     ...);
+
+    if constexpr (std::is_base_of_v<Table, T>) {
+      return seal_table(table);
+    } else {
+      return Status::Success;
+    }
+  }
+
+  template <typename T, const auto& Names, auto... Members>
+  static auto unpatch(T* table,
+                      ServiceList<Names, Members...> /*list*/) noexcept
+      -> Status {
+    if (((slot<Members>(table) != &Shim<Members>::call) || ...)) {
+      return Status::NotStarted;
+    }
+
+    ((slot<Members>(table) = original_<Members>,
+      original_<Members>   = nullptr),
+     ...);
+
+    if constexpr (std::is_base_of_v<Table, T>) {
+      return seal_table(table);
+    } else {
+      return Status::Success;
+    }
+  }
+
+  template <const auto& Names, auto... Members>
+  static void clear(ServiceList<Names, Members...> /*list*/) noexcept {
+    auto index = uintn_t{0};
+    ((record_<Members> = Record{Names[index++], 0, 0, 0, 0}), ...);
+  }
+
+  template <const auto& Names, auto... Members>
+  static void collect(ServiceList<Names, Members...> /*list*/,
+                      const Record** records, uintn_t* count,
+                      bool uncalled) noexcept {
+    (((uncalled || record_<Members>.calls != 0)
+          ? void(records[(*count)++] = &record_<Members>)
+          : void()),
+     ...);
+  }
+
+  static auto collect(const Record** records, bool uncalled) noexcept
+      -> uintn_t {
+    auto count = uintn_t{0};
+    collect(BootServicesList{}, records, &count, uncalled);
+    collect(RuntimeServicesList{}, records, &count, uncalled);
+    collect(BlockIOList{}, records, &count, uncalled);
+    return count;
+  }
+
+  // Records never installed have no name yet
+  NODISCARD static auto equal(const char* a, const char* b) noexcept -> bool {
+    if (a == nullptr || b == nullptr) {
+      return false;
+    }
+    while (*a != '\0' && *a == *b) {
+      ++a;
+      ++b;
+    }
+    return *a == *b;
+  }
+
+#pragma region Formatting
+
+  static constexpr auto name_width   = uintn_t{30};
+  static constexpr auto number_width = uintn_t{12};
+  static constexpr auto cycles_width = uintn_t{16};
+
+  class Line final {
+   private:
+    std::array<char, 128> text_{};
+    uintn_t               length_ = 0;
+
+   public:
+    // Left aligned unless right is set, truncated to width
+    void text(const char* value, uintn_t width, bool right = false) noexcept {
+      auto size = uintn_t{0};
+      while (value[size] != '\0' && size < width) {
+        ++size;
+      }
+      if (right) {
+        pad(width - size);
+      }
+      for (auto i = uintn_t{0}; i < size; ++i) {
+        text_[length_++] = value[i];
+      }
+      if (!right) {
+        pad(width - size);
+      }
+    }
+
+    void number(uint64_t value, uintn_t width) noexcept {
+      std::array<char, 21> digits{};
+      auto                 first = digits.size() - 1;
+      do {
+        digits[--first] = static_cast<char>('0' + value % 10);
+        value /= 10;
+      } while (value != 0);
+      text(digits.data() + first, width, true);
+    }
+
+    auto flush(Sink sink, void* context) noexcept -> Status {
+      text_[length_++]  = '\r';
+      text_[length_++]  = '\n';
+      const auto status = sink(text_.data(), length_, context);
+      length_           = 0;
+      return status;
+    }
+
+   private:
+    void pad(uintn_t count) noexcept {
+      for (auto i = uintn_t{0}; i < count; ++i) {
+        text_[length_++] = ' ';
+      }
+    }
+  };
+
+  static auto write_record(const Record& record, Sink sink,
+                           void* context) noexcept -> Status {
+    auto line = Line{};
+    line.text(record.name, name_width);
+    line.number(record.calls, number_width);
+    line.number(record.cycles, cycles_width);
+    line.number(record.max_cycles, number_width);
+    if (Clock::calibrated()) {
+      line.number(Clock::microseconds(record.cycles), number_width);
+    } else {
+      line.text("-", number_width, true);
+    }
+    line.number(record.bytes, number_width);
+    return line.flush(sink, context);
+  }
+
+  static auto console_sink(const char* line, uintn_t length,
+                           void* context) noexcept -> Status {
+    std::array<char16_t, 128> text;
+    for (auto i = uintn_t{0}; i < length; ++i) {
+      text[i] = static_cast<char16_t>(line[i]);
+    }
+    text[length] = u'\0';
+    return static_cast<SimpleTextOutputProtocol*>(context)->output_string(
+        text.data());
+  }
+
+  // Writes until the whole line went out, a short write without progress
+  // counts as a timeout
+  template <typename T>
+  static auto write_sink(const char* line, uintn_t length,
+                         void* context) noexcept -> Status {
+    auto* target = static_cast<T*>(context);
+    while (length != 0) {
+      auto       written = length;
+      const auto status  = target->write(&written, line);
+      if (status != Status::Success) {
+        return status;
+      }
+      if (written == 0) {
+        return Status::Timeout;
+      }
+      line   += written;
+      length -= written;
+    }
+    return Status::Success;
+  }
+
+#pragma endregion
+};
+
+}  // namespace efi
@@ -0,0 +1,194 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include "state.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "efi/protocol/block_io.hpp"
+
+namespace efi::mock::detail {
+
+namespace {
+
+struct MediaImage {
+  uint32_t media_id;
+  bool     removable_media;
+  bool     media_present;
+  bool     logical_partition;
+  bool     read_only;
+  bool     write_caching;
+  uint32_t block_size;
+  uint32_t io_align;
+  LBA      last_block;
+  LBA      lowest_aligned_lba;
+  uint32_t logical_blocks_per_physical_block;
+  uint32_t optimal_transfer_length_granularity;
+};
+
+static_assert(sizeof(MediaImage) == sizeof(BlockToMedia));
+
+struct BlockIOImage {
+  BlockIOProtocol::Revision revision;
+  const MediaImage*         media;
+  void*                     entries[4];
+};
+
+static_assert(sizeof(BlockIOImage) == sizeof(BlockIOProtocol));
+
+struct BlockDevice {
+  BlockIOImage image;
+  MediaImage   media;
+  int          fd = -1;
+
+  ~BlockDevice() {
+    if (fd >= 0) ::close(fd);
+  }
+};
+
+auto device(BlockIOProtocol* self) noexcept {
+  return reinterpret_cast<BlockDevice*>(self);
+}
+
+auto check_request(const BlockDevice& device, uint32_t media_id, LBA lba,
+                   uintn_t buffer_size, const void* buffer) noexcept -> Status {
+  const auto& media = device.media;
+
+  if (media_id != media.media_id) return Status::MediaChanged;
+  if (buffer == nullptr) return Status::InvalidParameter;
+  if (buffer_size % media.block_size != 0) return Status::BadBufferSize;
+  if (lba > media.last_block) return Status::InvalidParameter;
+
+  const auto blocks = buffer_size / media.block_size;
+  if (blocks > media.last_block - lba + 1) return Status::InvalidParameter;
+
+  return Status::Success;
+}
+
+EFI_CALL auto reset(BlockIOProtocol*, bool) noexcept -> Status {
+  return Status::Success;
+}
+
+EFI_CALL auto read_blocks(BlockIOProtocol* self, uint32_t media_id, LBA lba,
+                          uintn_t buffer_size, void* buffer) noexcept
+    -> Status {
+  auto& block = *device(self);
+  if (auto status = check_request(block, media_id, lba, buffer_size, buffer);
+      status != Status::Success) {
+    return status;
+  }
+
+  auto* out    = static_cast<uint8_t*>(buffer);
+  auto  offset = static_cast<off_t>(lba * block.media.block_size);
+  while (buffer_size > 0) {
+    const auto count = ::pread(block.fd, out, buffer_size, offset);
+    if (count <= 0) return Status::DeviceError;
+    out         += count;
+    offset      += count;
+    buffer_size -= static_cast<uintn_t>(count);
+  }
+
+  return Status::Success;
+}
+
+EFI_CALL auto write_blocks(BlockIOProtocol* self, uint32_t media_id, LBA lba,
+                           uintn_t buffer_size, const void* buffer) noexcept
+    -> Status {
+  auto& block = *device(self);
+  if (block.media.read_only) return Status::WriteProtected;
+  if (auto status = check_request(block, media_id, lba, buffer_size, buffer);
+      status != Status::Success) {
+    return status;
+  }
+
+  const auto* in     = static_cast<const uint8_t*>(buffer);
+  auto        offset = static_cast<off_t>(lba * block.media.block_size);
+  while (buffer_size > 0) {
+    const auto count = ::pwrite(block.fd, in, buffer_size, offset);
+    if (count <= 0) return Status::DeviceError;
+    in          += count;
+    offset      += count;
+    buffer_size -= static_cast<uintn_t>(count);
+  }
+
+  return Status::Success;
+}
+
+EFI_CALL auto flush_blocks(BlockIOProtocol* self) noexcept -> Status {
+  return ::fdatasync(device(self)->fd) == 0 ? Status::Success
+                                            : Status::DeviceError;
+}
+
+}  // namespace
+
+auto create_block_device(State& state, const char* path, uint32_t block_size,
+                         Handle* handle) -> Status {
+  if (path == nullptr || handle == nullptr || block_size == 0) {
+    return Status::InvalidParameter;
+  }
+
+  auto read_only = false;
+  auto fd        = ::open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    read_only = true;
+    fd        = ::open(path, O_RDONLY | O_CLOEXEC);
+  }
+  if (fd < 0) return Status::NotFound;
+
+  auto  device = std::make_unique<DeviceOf<BlockDevice>>();
+  auto* block  = &device->instance;
+  block->fd    = fd;
+
+  struct stat info {};
+  if (::fstat(fd, &info) != 0 ||
+      static_cast<uint64_t>(info.st_size) < block_size) {
+    return Status::VolumeCorrupted;
+  }
+
+  block->media = MediaImage{
+      .media_id                            = 1,
+      .removable_media                     = false,
+      .media_present                       = true,
+      .logical_partition                   = false,
+      .read_only                           = read_only,
+      .write_caching                       = false,
+      .block_size                          = block_size,
+      .io_align                            = 0,
+      .last_block = static_cast<uint64_t>(info.st_size) / block_size - 1,
+      .lowest_aligned_lba                  = 0,
+      .logical_blocks_per_physical_block   = 1,
+      .optimal_transfer_length_granularity = 0};
+
+  block->image = BlockIOImage{
+      .revision = BlockIOProtocol::Revision::Rev3,
+      .media    = &block->media,
+      .entries  = {reinterpret_cast<void*>(&reset),
+                   reinterpret_cast<void*>(&read_blocks),
+                   reinterpret_cast<void*>(&write_blocks),
+                   reinterpret_cast<void*>(&flush_blocks)}};
+
+  if (auto status =
+          state.install_protocol(handle, BlockIOProtocol::guid, &block->image);
+      status != Status::Success) {
+    return status;
+  }
+
+  state.devices.push_back(std::move(device));
+  return Status::Success;
+}
+
+}  // namespace efi::mock::detail
@@ -0,0 +1,445 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include "state.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "efi/protocol/file_system.hpp"
+
+namespace efi::mock::detail {
+
+namespace {
+
+struct FileInfoImage {
+  uint64_t      size;
+  uint64_t      file_size;
+  uint64_t      physical_size;
+  Time          create_time;
+  Time          last_access_time;
+  Time          modification_time;
+  FileAttribute attribute;
+};
+
+static_assert(sizeof(FileInfoImage) == sizeof(FileInfo));
+
+struct FileSystemInfoImage {
+  uint64_t size;
+  bool     read_only;
+  uint64_t volume_size;
+  uint64_t free_space;
+  uint32_t block_size;
+};
+
+constexpr auto file_system_info_header = uintn_t{36};
+
+static_assert(offsetof(FileSystemInfoImage, block_size) + sizeof(uint32_t) ==
+              file_system_info_header);
+
+struct FileImage {
+  FileProtocol::Revision revision;
+  void*                  entries[10];
+};
+
+static_assert(sizeof(FileImage) == sizeof(FileProtocol));
+
+struct FileSystemImage {
+  uint64_t revision;
+  void*    open_volume;
+};
+
+static_assert(sizeof(FileSystemImage) == sizeof(SimpleFileSystemProtocol));
+
+constexpr char16_t volume_label[] = u"MOCK";
+
+struct Node {
+  std::u16string                     name;
+  bool                               directory;
+  std::vector<uint8_t>               data;
+  std::vector<std::shared_ptr<Node>> children;
+  std::weak_ptr<Node>                parent;
+};
+
+struct MemoryFileSystem;
+
+struct OpenFile {
+  FileImage             image;
+  std::shared_ptr<Node> node;
+  uint64_t              position;
+  bool                  writable;
+  MemoryFileSystem*     file_system;
+};
+
+struct MemoryFileSystem {
+  FileSystemImage                        image;
+  std::shared_ptr<Node>                  root;
+  std::vector<std::unique_ptr<OpenFile>> open_files;
+};
+
+auto file(FileProtocol* self) noexcept {
+  return reinterpret_cast<OpenFile*>(self);
+}
+
+auto name_equals(const std::u16string& a, std::u16string_view b) {
+  const auto lower = [](char16_t c) -> char16_t {
+    return c >= u'A' && c <= u'Z' ? c + (u'a' - u'A') : c;
+  };
+
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [&](auto x, auto y) {
+           return lower(x) == lower(y);
+         });
+}
+
+auto find_child(const Node& directory, std::u16string_view name)
+    -> std::shared_ptr<Node> {
+  for (auto& child : directory.children) {
+    if (name_equals(child->name, name)) return child;
+  }
+  return nullptr;
+}
+
+// Resolves path relative to start, optionally creating missing components
+auto resolve(MemoryFileSystem& file_system, const std::shared_ptr<Node>& start,
+             std::u16string_view path, bool create, bool directory)
+    -> std::shared_ptr<Node> {
+  auto node = start;
+  if (!path.empty() && path.front() == u'\\') {
+    node = file_system.root;
+    path.remove_prefix(1);
+  }
+
+  while (!path.empty()) {
+    const auto split     = path.find(u'\\');
+    const auto component = path.substr(0, split);
+    const auto last      = split == std::u16string_view::npos;
+    path.remove_prefix(last ? path.size() : split + 1);
+
+    if (component.empty() || component == u".") continue;
+
+    if (component == u"..") {
+      if (auto parent = node->parent.lock()) node = std::move(parent);
+      continue;
+    }
+
+    if (!node->directory) return nullptr;
+
+    auto child = find_child(*node, component);
+    if (child == nullptr) {
+      if (!create) return nullptr;
+      child = std::make_shared<Node>(Node{.name      = std::u16string{component},
+                                          .directory = !last || directory,
+                                          .data      = {},
+                                          .children  = {},
+                                          .parent    = node});
+      node->children.push_back(child);
+    }
+
+    node = std::move(child);
+  }
+
+  return node;
+}
+
+auto fill_file_info(const Node& node, uintn_t* buffer_size, void* buffer)
+    -> Status {
+  const auto& name     = node.name;
+  const auto  required = sizeof(FileInfoImage) + (name.size() + 1) * 2;
+  if (*buffer_size < required) {
+    *buffer_size = required;
+    return Status::BufferTooSmall;
+  }
+
+  if (buffer == nullptr) return Status::InvalidParameter;
+
+  const auto info = FileInfoImage{
+      .size              = required,
+      .file_size         = node.data.size(),
+      .physical_size     = node.data.size(),
+      .create_time       = {},
+      .last_access_time  = {},
+      .modification_time = {},
+      .attribute = node.directory ? FileAttribute::Directory
+                                  : FileAttribute::Archive};
+
+  auto* out = static_cast<uint8_t*>(buffer);
+  std::memcpy(out, &info, sizeof(info));
+  std::memcpy(out + sizeof(info), name.c_str(), (name.size() + 1) * 2);
+  *buffer_size = required;
+  return Status::Success;
+}
+
+auto open_node(MemoryFileSystem& file_system, std::shared_ptr<Node> node,
+               bool writable) -> FileProtocol*;
+
+EFI_CALL auto open(FileProtocol* self, FileProtocol** new_handle,
+                   const char16_t* file_name, FileOpenMode open_mode,
+                   FileAttribute attributes) noexcept -> Status {
+  if (new_handle == nullptr || file_name == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  const auto mode     = static_cast<uint64_t>(open_mode);
+  const auto read     = static_cast<uint64_t>(FileOpenMode::Read);
+  const auto write    = static_cast<uint64_t>(FileOpenMode::Write);
+  const auto create   = static_cast<uint64_t>(FileOpenMode::Create);
+  if (mode != read && mode != (read | write) &&
+      mode != (read | write | create)) {
+    return Status::InvalidParameter;
+  }
+
+  auto& current   = *file(self);
+  auto  directory = (static_cast<uint64_t>(attributes) &
+                    static_cast<uint64_t>(FileAttribute::Directory)) != 0;
+
+  auto node = resolve(*current.file_system, current.node, file_name,
+                      (mode & create) != 0, directory);
+  if (node == nullptr) return Status::NotFound;
+
+  *new_handle = open_node(*current.file_system, std::move(node),
+                          (mode & write) != 0);
+  return Status::Success;
+}
+
+EFI_CALL auto close(FileProtocol* self) noexcept -> Status {
+  auto& open_files = file(self)->file_system->open_files;
+  std::erase_if(open_files, [self](const auto& open_file) {
+    return open_file.get() == file(self);
+  });
+  return Status::Success;
+}
+
+EFI_CALL auto delete_file(FileProtocol* self) noexcept -> Status {
+  auto& current = *file(self);
+  auto  parent  = current.node->parent.lock();
+  if (parent != nullptr) {
+    std::erase(parent->children, current.node);
+    current.node->parent.reset();
+  }
+
+  close(self);
+  return parent != nullptr ? Status::Success : Status::WarnDeleteFailure;
+}
+
+EFI_CALL auto read(FileProtocol* self, uintn_t* buffer_size,
+                   void* buffer) noexcept -> Status {
+  auto& current = *file(self);
+  if (buffer_size == nullptr) return Status::InvalidParameter;
+
+  const auto& node = *current.node;
+  if (node.directory) {
+    if (current.position >= node.children.size()) {
+      *buffer_size = 0;
+      return Status::Success;
+    }
+
+    auto status =
+        fill_file_info(*node.children[current.position], buffer_size, buffer);
+    if (status == Status::Success) ++current.position;
+    return status;
+  }
+
+  if (current.position > node.data.size()) return Status::DeviceError;
+
+  const auto count =
+      std::min<uint64_t>(*buffer_size, node.data.size() - current.position);
+  if (count > 0 && buffer == nullptr) return Status::InvalidParameter;
+
+  std::memcpy(buffer, node.data.data() + current.position, count);
+  current.position += count;
+  *buffer_size      = count;
+  return Status::Success;
+}
+
+EFI_CALL auto write(FileProtocol* self, uintn_t* buffer_size,
+                    const void* buffer) noexcept -> Status {
+  auto& current = *file(self);
+  if (buffer_size == nullptr) return Status::InvalidParameter;
+  if (current.node->directory) return Status::Unsupported;
+  if (!current.writable) return Status::AccessDenied;
+  if (*buffer_size > 0 && buffer == nullptr) return Status::InvalidParameter;
+
+  auto& data = current.node->data;
+  if (data.size() < current.position + *buffer_size) {
+    data.resize(current.position + *buffer_size);
+  }
+
+  std::memcpy(data.data() + current.position, buffer, *buffer_size);
+  current.position += *buffer_size;
+  return Status::Success;
+}
+
+EFI_CALL auto get_position(FileProtocol* self, uint64_t* position) noexcept
+    -> Status {
+  auto& current = *file(self);
+  if (position == nullptr) return Status::InvalidParameter;
+  if (current.node->directory) return Status::Unsupported;
+
+  *position = current.position;
+  return Status::Success;
+}
+
+EFI_CALL auto set_position(FileProtocol* self, uint64_t position) noexcept
+    -> Status {
+  auto& current = *file(self);
+  if (current.node->directory) {
+    if (position != 0) return Status::Unsupported;
+    current.position = 0;
+    return Status::Success;
+  }
+
+  current.position = position == UINT64_MAX ? current.node->data.size()
+                                             : position;
+  return Status::Success;
+}
+
+EFI_CALL auto get_info(FileProtocol* self, const Guid& information_type,
+                       uintn_t* buffer_size, void* buffer) noexcept -> Status {
+  auto& current = *file(self);
+  if (buffer_size == nullptr) return Status::InvalidParameter;
+
+  if (information_type == FileInfo::guid) {
+    return fill_file_info(*current.node, buffer_size, buffer);
+  }
+
+  if (information_type == FileSystemInfo::guid) {
+    const auto required = file_system_info_header + sizeof(volume_label);
+    if (*buffer_size < required) {
+      *buffer_size = required;
+      return Status::BufferTooSmall;
+    }
+    if (buffer == nullptr) return Status::InvalidParameter;
+
+    const auto info = FileSystemInfoImage{.size        = required,
+                                          .read_only   = false,
+                                          .volume_size = 0,
+                                          .free_space  = 0,
+                                          .block_size  = 512};
+
+    auto* out = static_cast<uint8_t*>(buffer);
+    std::memcpy(out, &info, file_system_info_header);
+    std::memcpy(out + file_system_info_header, volume_label,
+                sizeof(volume_label));
+    *buffer_size = required;
+    return Status::Success;
+  }
+
+  return Status::Unsupported;
+}
+
+EFI_CALL auto set_info(FileProtocol* self, const Guid& information_type,
+                       uintn_t buffer_size, const void* buffer) noexcept
+    -> Status {
+  auto& current = *file(self);
+  if (buffer == nullptr) return Status::InvalidParameter;
+  if (!(information_type == FileInfo::guid)) return Status::Unsupported;
+  if (buffer_size < sizeof(FileInfoImage)) return Status::BadBufferSize;
+  if (!current.writable) return Status::AccessDenied;
+
+  auto info = FileInfoImage{};
+  std::memcpy(&info, buffer, sizeof(info));
+  if (!current.node->directory) current.node->data.resize(info.file_size);
+  return Status::Success;
+}
+
+EFI_CALL auto flush(FileProtocol*) noexcept -> Status {
+  return Status::Success;
+}
+
+auto open_node(MemoryFileSystem& file_system, std::shared_ptr<Node> node,
+               bool writable) -> FileProtocol* {
+  file_system.open_files.push_back(std::make_unique<OpenFile>(OpenFile{
+      .image       = {.revision = FileProtocol::Revision::Rev1,
+                      .entries  = {reinterpret_cast<void*>(&open),
+                                   reinterpret_cast<void*>(&close),
+                                   reinterpret_cast<void*>(&delete_file),
+                                   reinterpret_cast<void*>(&read),
+                                   reinterpret_cast<void*>(&write),
+                                   reinterpret_cast<void*>(&get_position),
+                                   reinterpret_cast<void*>(&set_position),
+                                   reinterpret_cast<void*>(&get_info),
+                                   reinterpret_cast<void*>(&set_info),
+                                   reinterpret_cast<void*>(&flush)}},
+      .node        = std::move(node),
+      .position    = 0,
+      .writable    = writable,
+      .file_system = &file_system}));
+
+  return reinterpret_cast<FileProtocol*>(&file_system.open_files.back()->image);
+}
+
+EFI_CALL auto open_volume(SimpleFileSystemProtocol* self,
+                          FileProtocol** root) noexcept -> Status {
+  if (root == nullptr) return Status::InvalidParameter;
+
+  auto& file_system = *reinterpret_cast<MemoryFileSystem*>(self);
+  *root             = open_node(file_system, file_system.root, true);
+  return Status::Success;
+}
+
+}  // namespace
+
+auto create_file_system(State& state, Handle* handle) -> Status {
+  if (handle == nullptr) return Status::InvalidParameter;
+
+  auto  device      = std::make_unique<DeviceOf<MemoryFileSystem>>();
+  auto& file_system = device->instance;
+
+  file_system.image = FileSystemImage{
+      .revision    = 0x00010000,
+      .open_volume = reinterpret_cast<void*>(&open_volume)};
+  file_system.root = std::make_shared<Node>(Node{.name      = u"",
+                                                 .directory = true,
+                                                 .data      = {},
+                                                 .children  = {},
+                                                 .parent    = {}});
+
+  if (auto status = state.install_protocol(
+          handle, SimpleFileSystemProtocol::guid, &file_system.image);
+      status != Status::Success) {
+    return status;
+  }
+
+  state.devices.push_back(std::move(device));
+  return Status::Success;
+}
+
+auto add_file(State& state, Handle file_system, const char16_t* path,
+              const void* data, uintn_t size) -> Status {
+  if (path == nullptr || (size > 0 && data == nullptr)) {
+    return Status::InvalidParameter;
+  }
+
+  auto* object = state.find_handle(file_system);
+  if (object == nullptr) return Status::InvalidParameter;
+
+  for (auto& entry : object->interfaces) {
+    if (!(entry->guid == SimpleFileSystemProtocol::guid)) continue;
+
+    auto& memory = *static_cast<MemoryFileSystem*>(entry->interface);
+    auto  node   = resolve(memory, memory.root, path, true, false);
+    if (node == nullptr || node->directory) return Status::AccessDenied;
+
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    node->data.assign(bytes, bytes + size);
+    return Status::Success;
+  }
+
+  return Status::Unsupported;
+}
+
+}  // namespace efi::mock::detail
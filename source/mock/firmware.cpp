@@ -0,0 +1,1759 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include "state.hpp"
+
+#include "efi/crc32.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <thread>
+
+#include <sys/mman.h>
+
+namespace efi::mock::detail {
+
+namespace {
+
+State* current_state = nullptr;
+
+constexpr auto memory_attribute_wb         = uint64_t{0x0000000000000008};
+constexpr auto memory_attribute_runtime    = uint64_t{0x8000000000000000};
+
+constexpr auto firmware_reserved_pages     = uint64_t{16};
+
+constexpr auto image_protocol_guid         =
+    Guid{0x4d6f636b,
+         0x496d,
+         0x6167,
+         {0x65, 0x48, 0x61, 0x6e, 0x64, 0x6c, 0x65, 0x00}};
+
+constexpr char16_t firmware_vendor[]       = u"MuchCool Mock Firmware";
+
+auto type_bits(EventType type) noexcept {
+  return static_cast<uint32_t>(type);
+}
+
+auto has_type(EventType type, EventType flag) noexcept {
+  return (type_bits(type) & type_bits(flag)) == type_bits(flag);
+}
+
+auto to_entry(auto function) noexcept {
+  return reinterpret_cast<void*>(function);
+}
+
+#pragma region Console
+
+struct TextOutputModeImage {
+  int32_t  max_mode;
+  int32_t  mode;
+  uint32_t attribute;
+  int32_t  cursor_column;
+  int32_t  cursor_row;
+  bool     visible;
+};
+
+static_assert(sizeof(TextOutputModeImage) == sizeof(TextOutputMode));
+
+struct TextOutputImage {
+  void*                entries[9];
+  TextOutputModeImage* mode;
+};
+
+static_assert(sizeof(TextOutputImage) == sizeof(SimpleTextOutputProtocol));
+
+struct TextInputImage {
+  void* entries[2];
+  Event wait_for_key;
+};
+
+static_assert(sizeof(TextInputImage) == sizeof(SimpleTextInputProtocol));
+
+class Console final : public Device {
+ public:
+  TextOutputImage     output{};
+  TextOutputImage     error{};
+  TextOutputModeImage mode{};
+  TextInputImage      input{};
+  Handle              output_handle = nullptr;
+  Handle              input_handle  = nullptr;
+};
+
+EFI_CALL auto text_reset(SimpleTextOutputProtocol*, bool) noexcept -> Status {
+  return Status::Success;
+}
+
+EFI_CALL auto text_output_string(SimpleTextOutputProtocol* self,
+                                 const char16_t* str) noexcept -> Status {
+  if (str == nullptr) return Status::InvalidParameter;
+
+  auto& state = *current_state;
+  auto  start = state.console.size();
+  append_utf8(state.console, str);
+
+  if (state.config.echo_console) {
+    auto* stream = static_cast<void*>(self) == state.system_table.std_err
+                       ? stderr
+                       : stdout;
+    std::fwrite(state.console.data() + start, 1, state.console.size() - start,
+                stream);
+  }
+
+  return Status::Success;
+}
+
+EFI_CALL auto text_test_string(SimpleTextOutputProtocol*,
+                               const char16_t*) noexcept -> Status {
+  return Status::Success;
+}
+
+EFI_CALL auto text_query_mode(SimpleTextOutputProtocol*, uintn_t mode_number,
+                              uintn_t* out_columns, uintn_t* out_rows) noexcept
+    -> Status {
+  if (mode_number != 0) return Status::Unsupported;
+  *out_columns = 80;
+  *out_rows    = 25;
+  return Status::Success;
+}
+
+EFI_CALL auto text_set_mode(SimpleTextOutputProtocol*,
+                            uintn_t mode_number) noexcept -> Status {
+  return mode_number == 0 ? Status::Success : Status::Unsupported;
+}
+
+EFI_CALL auto text_set_attribute(SimpleTextOutputProtocol* self,
+                                 TextAttribute attribute) noexcept -> Status {
+  reinterpret_cast<TextOutputImage*>(self)->mode->attribute =
+      static_cast<uint32_t>(attribute);
+  return Status::Success;
+}
+
+EFI_CALL auto text_clear_screen(SimpleTextOutputProtocol* self) noexcept
+    -> Status {
+  auto* mode          = reinterpret_cast<TextOutputImage*>(self)->mode;
+  mode->cursor_column = 0;
+  mode->cursor_row    = 0;
+  return Status::Success;
+}
+
+EFI_CALL auto text_set_cursor_position(SimpleTextOutputProtocol* self,
+                                       uintn_t column, uintn_t row) noexcept
+    -> Status {
+  if (column >= 80 || row >= 25) return Status::Unsupported;
+  auto* mode          = reinterpret_cast<TextOutputImage*>(self)->mode;
+  mode->cursor_column = static_cast<int32_t>(column);
+  mode->cursor_row    = static_cast<int32_t>(row);
+  return Status::Success;
+}
+
+EFI_CALL auto text_enable_cursor(SimpleTextOutputProtocol* self,
+                                 bool visible) noexcept -> Status {
+  reinterpret_cast<TextOutputImage*>(self)->mode->visible = visible;
+  return Status::Success;
+}
+
+EFI_CALL auto text_input_reset(SimpleTextInputProtocol*, bool) noexcept
+    -> Status {
+  return Status::Success;
+}
+
+EFI_CALL auto text_read_key_stroke(SimpleTextInputProtocol*,
+                                   InputKey* out_key) noexcept -> Status {
+  if (out_key == nullptr) return Status::InvalidParameter;
+  return Status::NotReady;
+}
+
+void build_text_output(TextOutputImage& image, TextOutputModeImage* mode) {
+  image = TextOutputImage{
+      .entries = {to_entry(&text_reset), to_entry(&text_output_string),
+                  to_entry(&text_test_string), to_entry(&text_query_mode),
+                  to_entry(&text_set_mode), to_entry(&text_set_attribute),
+                  to_entry(&text_clear_screen),
+                  to_entry(&text_set_cursor_position),
+                  to_entry(&text_enable_cursor)},
+      .mode    = mode};
+}
+
+#pragma endregion
+
+#pragma region Boot Services
+
+EFI_CALL auto raise_tpl(TPL new_tpl) noexcept -> TPL {
+  auto& state = *current_state;
+  auto  old   = state.tpl;
+  state.tpl   = new_tpl;
+  return old;
+}
+
+EFI_CALL void restore_tpl(TPL old_tpl) noexcept {
+  auto& state = *current_state;
+  state.tpl   = old_tpl;
+  state.service_timers();
+}
+
+EFI_CALL auto allocate_pages(AllocateType type, MemoryType memory_type,
+                             uintn_t pages, PhysicalAddress* memory) noexcept
+    -> Status {
+  return current_state->allocate_pages(type, memory_type, pages, memory);
+}
+
+EFI_CALL auto free_pages(PhysicalAddress memory, uintn_t pages) noexcept
+    -> Status {
+  return current_state->free_pages(memory, pages);
+}
+
+EFI_CALL auto get_memory_map(uintn_t* memory_map_size,
+                             MemoryDescriptor* memory_map, uintn_t* map_key,
+                             uintn_t*  descriptor_size,
+                             uint32_t* descriptor_version) noexcept -> Status {
+  auto& state = *current_state;
+  if (memory_map_size == nullptr) return Status::InvalidParameter;
+
+  const auto stride =
+      sizeof(MemoryDescriptorImage) + state.config.descriptor_padding;
+  const auto required = state.regions.size() * stride;
+
+  if (descriptor_size != nullptr) *descriptor_size = stride;
+  if (descriptor_version != nullptr) *descriptor_version = 1;
+
+  if (*memory_map_size < required) {
+    *memory_map_size = required;
+    return Status::BufferTooSmall;
+  }
+
+  if (memory_map == nullptr || map_key == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  auto* out = reinterpret_cast<uint8_t*>(memory_map);
+  for (const auto& [start, region] : state.regions) {
+    auto attribute = memory_attribute_wb;
+    if (region.type == MemoryType::RuntimeServicesCode ||
+        region.type == MemoryType::RuntimeServicesData) {
+      attribute |= memory_attribute_runtime;
+    }
+
+    const auto descriptor =
+        MemoryDescriptorImage{.type            = region.type,
+                              .physical_start  = start,
+                              .virtual_start   = 0,
+                              .number_of_pages = region.pages,
+                              .attribute       = attribute};
+
+    std::memset(out, 0, stride);
+    std::memcpy(out, &descriptor, sizeof(descriptor));
+    out += stride;
+  }
+
+  *memory_map_size = required;
+  *map_key         = state.map_key;
+  return Status::Success;
+}
+
+EFI_CALL auto allocate_pool(MemoryType, uintn_t size, void** buffer) noexcept
+    -> Status {
+  return current_state->allocate_pool(size, buffer);
+}
+
+EFI_CALL auto free_pool(void* buffer) noexcept -> Status {
+  return current_state->free_pool(buffer);
+}
+
+EFI_CALL auto create_event(EventType type, TPL notify_tpl,
+                           EventNotify notify_function, void* context,
+                           Event* event) noexcept -> Status {
+  if (event == nullptr) return Status::InvalidParameter;
+
+  const auto notify = has_type(type, EventType::NotifyWait) ||
+                      has_type(type, EventType::NotifySignal);
+  if (notify && notify_function == nullptr) return Status::InvalidParameter;
+
+  const Guid* group = nullptr;
+  if (type == EventType::SignalExitBootServices) {
+    group = &EventGroupExitBootServices;
+  }
+
+  *event = current_state->create_event(type, notify_tpl, notify_function,
+                                       context, group);
+  return Status::Success;
+}
+
+EFI_CALL auto create_event_ex(EventType type, TPL notify_tpl,
+                              EventNotify notify_function, void* context,
+                              const Guid* event_group, Event* event) noexcept
+    -> Status {
+  if (event_group == nullptr) {
+    return create_event(type, notify_tpl, notify_function, context, event);
+  }
+
+  if (event == nullptr) return Status::InvalidParameter;
+  if (type == EventType::SignalExitBootServices ||
+      type == EventType::SignalVirtualAddressChange) {
+    return Status::InvalidParameter;
+  }
+
+  *event = current_state->create_event(type, notify_tpl, notify_function,
+                                       context, event_group);
+  return Status::Success;
+}
+
+EFI_CALL auto set_timer(Event event, TimerDelay type,
+                        uint64_t trigger_time) noexcept -> Status {
+  auto* object = current_state->find_event(event);
+  if (object == nullptr || !has_type(object->type, EventType::Timer)) {
+    return Status::InvalidParameter;
+  }
+
+  object->timer_type   = type;
+  object->timer_period = trigger_time;
+
+  // Trigger time is in 100ns units
+  object->timer_deadline = std::chrono::steady_clock::now() +
+                           std::chrono::nanoseconds{trigger_time * 100};
+
+  if (type == TimerDelay::Periodic && trigger_time == 0) {
+    object->timer_period = 1;
+  }
+
+  return Status::Success;
+}
+
+EFI_CALL auto wait_for_event(uintn_t num_of_events, const Event* event,
+                             uintn_t* index) noexcept -> Status {
+  auto& state = *current_state;
+  if (num_of_events == 0 || event == nullptr || index == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  if (state.tpl != TplApplication) return Status::Unsupported;
+
+  auto objects = std::vector<EventObject*>(num_of_events);
+  for (uintn_t i = 0; i < num_of_events; ++i) {
+    objects[i] = state.find_event(event[i]);
+    if (objects[i] == nullptr ||
+        has_type(objects[i]->type, EventType::NotifySignal)) {
+      *index = i;
+      return Status::InvalidParameter;
+    }
+  }
+
+  for (;;) {
+    state.service_timers();
+
+    for (uintn_t i = 0; i < num_of_events; ++i) {
+      auto* object = objects[i];
+      if (!object->signaled &&
+          has_type(object->type, EventType::NotifyWait)) {
+        object->notify_function(object, object->notify_context);
+      }
+
+      if (object->signaled) {
+        object->signaled = false;
+        *index           = i;
+        return Status::Success;
+      }
+    }
+
+    std::this_thread::sleep_for(std::chrono::microseconds{10});
+  }
+}
+
+EFI_CALL auto signal_event(Event event) noexcept -> Status {
+  auto* object = current_state->find_event(event);
+  if (object == nullptr) return Status::InvalidParameter;
+
+  if (object->has_group) {
+    current_state->signal_group(object->group);
+  } else {
+    current_state->signal_event(object);
+  }
+
+  current_state->dispatch_notifies();
+  return Status::Success;
+}
+
+EFI_CALL auto close_event(Event event) noexcept -> Status {
+  auto& state = *current_state;
+  auto* object = state.find_event(event);
+  if (object == nullptr) return Status::InvalidParameter;
+
+  std::erase_if(state.registrations, [object](const auto& registration) {
+    return registration->event == object;
+  });
+
+  std::erase_if(state.events,
+                [object](const auto& entry) { return entry.get() == object; });
+  return Status::Success;
+}
+
+EFI_CALL auto check_event(Event event) noexcept -> Status {
+  auto& state  = *current_state;
+  auto* object = state.find_event(event);
+  if (object == nullptr || has_type(object->type, EventType::NotifySignal)) {
+    return Status::InvalidParameter;
+  }
+
+  state.service_timers();
+
+  if (!object->signaled && has_type(object->type, EventType::NotifyWait)) {
+    object->notify_function(object, object->notify_context);
+  }
+
+  if (object->signaled) {
+    object->signaled = false;
+    return Status::Success;
+  }
+
+  return Status::NotReady;
+}
+
+EFI_CALL auto install_protocol_interface(Handle* handle, const Guid* protocol,
+                                         InterfaceType interface_type,
+                                         const void* interface) noexcept
+    -> Status {
+  if (protocol == nullptr || interface_type != InterfaceType::Native) {
+    return Status::InvalidParameter;
+  }
+
+  return current_state->install_protocol(handle, *protocol,
+                                         const_cast<void*>(interface));
+}
+
+EFI_CALL auto uninstall_protocol_interface(Handle handle, const Guid* protocol,
+                                           const void* interface) noexcept
+    -> Status {
+  if (protocol == nullptr) return Status::InvalidParameter;
+  return current_state->uninstall_protocol(handle, *protocol,
+                                           const_cast<void*>(interface));
+}
+
+EFI_CALL auto reinstall_protocol_interface(Handle handle, const Guid* protocol,
+                                           const void* old_interface,
+                                           const void* new_interface) noexcept
+    -> Status {
+  auto& state  = *current_state;
+  auto* object = state.find_handle(handle);
+  if (object == nullptr || protocol == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  for (auto& entry : object->interfaces) {
+    if (entry->guid == *protocol && entry->interface == old_interface) {
+      entry->interface = const_cast<void*>(new_interface);
+      state.notify_registrations(handle, *protocol);
+      return Status::Success;
+    }
+  }
+
+  return Status::NotFound;
+}
+
+EFI_CALL auto open_protocol(Handle handle, const Guid& protocol,
+                            void** interface, Handle agent_handle,
+                            Handle                controller_handle,
+                            OpenProtocolAttribute attributes) noexcept
+    -> Status {
+  auto& state = *current_state;
+  if (attributes != OpenProtocolAttribute::TestProtocol &&
+      interface == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  auto* object = state.find_handle(handle);
+  if (object == nullptr) return Status::InvalidParameter;
+
+  auto entry = std::find_if(
+      object->interfaces.begin(), object->interfaces.end(),
+      [&protocol](const auto& entry) { return entry->guid == protocol; });
+
+  if (entry == object->interfaces.end()) {
+    if (interface != nullptr) *interface = nullptr;
+    return Status::Unsupported;
+  }
+
+  auto& opens         = (*entry)->opens;
+  const auto bits     = static_cast<uint32_t>(attributes);
+  const auto by_driver =
+      (bits & static_cast<uint32_t>(OpenProtocolAttribute::ByDriver)) != 0;
+  const auto exclusive =
+      (bits & static_cast<uint32_t>(OpenProtocolAttribute::Exclusive)) != 0;
+
+  if (by_driver || exclusive) {
+    for (const auto& open : opens) {
+      const auto open_bits = static_cast<uint32_t>(open.attributes);
+      const auto open_exclusive =
+          (open_bits & static_cast<uint32_t>(OpenProtocolAttribute::Exclusive));
+      const auto open_driver =
+          (open_bits & static_cast<uint32_t>(OpenProtocolAttribute::ByDriver));
+
+      if (!open_exclusive && !(by_driver && open_driver)) continue;
+
+      if (open.agent_handle == agent_handle && open.attributes == attributes) {
+        *interface = (*entry)->interface;
+        return Status::AlreadyStarted;
+      }
+      return Status::AccessDenied;
+    }
+  }
+
+  if (interface != nullptr) *interface = (*entry)->interface;
+  if (attributes == OpenProtocolAttribute::TestProtocol) {
+    return Status::Success;
+  }
+
+  for (auto& open : opens) {
+    if (open.agent_handle == agent_handle &&
+        open.controller_handle == controller_handle &&
+        open.attributes == attributes) {
+      ++open.open_count;
+      return Status::Success;
+    }
+  }
+
+  opens.push_back(OpenRecord{.agent_handle      = agent_handle,
+                             .controller_handle = controller_handle,
+                             .attributes        = attributes,
+                             .open_count        = 1});
+  return Status::Success;
+}
+
+EFI_CALL auto handle_protocol(Handle handle, const Guid& protocol,
+                              void** interface) noexcept -> Status {
+  return open_protocol(handle, protocol, interface, current_state->image_handle,
+                       nullptr, OpenProtocolAttribute::ByHandleProtocol);
+}
+
+EFI_CALL auto close_protocol(Handle handle, const Guid& protocol,
+                             Handle agent_handle,
+                             Handle controller_handle) noexcept -> Status {
+  auto* object = current_state->find_handle(handle);
+  if (object == nullptr || agent_handle == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  for (auto& entry : object->interfaces) {
+    if (!(entry->guid == protocol)) continue;
+
+    const auto removed = std::erase_if(entry->opens, [&](const auto& open) {
+      return open.agent_handle == agent_handle &&
+             open.controller_handle == controller_handle;
+    });
+    return removed > 0 ? Status::Success : Status::NotFound;
+  }
+
+  return Status::NotFound;
+}
+
+EFI_CALL auto open_protocol_information(
+    Handle handle, const Guid* protocol,
+    OpenProtocolInformationEntry** entry_buffer, uintn_t* entry_count) noexcept
+    -> Status {
+  auto& state  = *current_state;
+  auto* object = state.find_handle(handle);
+  if (object == nullptr || protocol == nullptr || entry_buffer == nullptr ||
+      entry_count == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  for (auto& entry : object->interfaces) {
+    if (!(entry->guid == *protocol)) continue;
+
+    void* buffer = nullptr;
+    const auto size =
+        std::max<uintn_t>(1, entry->opens.size()) *
+        sizeof(OpenProtocolInformationImage);
+    if (auto status = state.allocate_pool(size, &buffer);
+        status != Status::Success) {
+      return status;
+    }
+
+    auto* out = static_cast<OpenProtocolInformationImage*>(buffer);
+    for (const auto& open : entry->opens) {
+      *out++ = OpenProtocolInformationImage{
+          .agent_handle      = open.agent_handle,
+          .controller_handle = open.controller_handle,
+          .attributes        = open.attributes,
+          .open_count        = open.open_count};
+    }
+
+    *entry_buffer = static_cast<OpenProtocolInformationEntry*>(buffer);
+    *entry_count  = entry->opens.size();
+    return Status::Success;
+  }
+
+  return Status::NotFound;
+}
+
+EFI_CALL auto register_protocol_notify(const Guid* protocol, Event event,
+                                       void** registration) noexcept
+    -> Status {
+  auto& state  = *current_state;
+  auto* object = state.find_event(event);
+  if (protocol == nullptr || object == nullptr || registration == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  state.registrations.push_back(std::make_unique<Registration>(
+      Registration{.guid = *protocol, .event = object, .pending = {}}));
+  *registration = state.registrations.back().get();
+  return Status::Success;
+}
+
+auto find_registration(const void* search_key) -> Registration* {
+  for (auto& registration : current_state->registrations) {
+    if (registration.get() == search_key) return registration.get();
+  }
+  return nullptr;
+}
+
+// Drops the notification returned by a successful ByRegisterNotify search
+void consume_notify(LocateSearchType search_type, const void* search_key) {
+  if (search_type != LocateSearchType::ByRegisterNotify) return;
+  auto* registration = find_registration(search_key);
+  if (registration != nullptr && !registration->pending.empty()) {
+    registration->pending.pop_front();
+  }
+}
+
+auto collect_handles(LocateSearchType search_type, const Guid* protocol,
+                     const void* search_key, std::vector<Handle>* out)
+    -> Status {
+  auto& state = *current_state;
+
+  switch (search_type) {
+    case LocateSearchType::AllHandles:
+      for (auto& handle : state.handles) out->push_back(handle.get());
+      break;
+
+    case LocateSearchType::ByProtocol:
+      if (protocol == nullptr) return Status::InvalidParameter;
+      for (auto& handle : state.handles) {
+        for (auto& entry : handle->interfaces) {
+          if (entry->guid == *protocol) {
+            out->push_back(handle.get());
+            break;
+          }
+        }
+      }
+      break;
+
+    case LocateSearchType::ByRegisterNotify: {
+      auto* registration = find_registration(search_key);
+      if (registration == nullptr) return Status::InvalidParameter;
+      // Only peeked, the caller consumes it once it was handed out
+      if (!registration->pending.empty()) {
+        out->push_back(registration->pending.front());
+      }
+      break;
+    }
+
+    default:
+      return Status::InvalidParameter;
+  }
+
+  return out->empty() ? Status::NotFound : Status::Success;
+}
+
+EFI_CALL auto locate_handle(LocateSearchType search_type, const Guid& protocol,
+                            const void* search_key, uintn_t* buffer_size,
+                            Handle* buffer) noexcept -> Status {
+  if (buffer_size == nullptr) return Status::InvalidParameter;
+
+  auto handles = std::vector<Handle>{};
+  auto status  = collect_handles(search_type, &protocol, search_key, &handles);
+  if (status != Status::Success) return status;
+
+  const auto required = handles.size() * sizeof(Handle);
+  if (*buffer_size < required) {
+    *buffer_size = required;
+    return Status::BufferTooSmall;
+  }
+
+  if (buffer == nullptr) return Status::InvalidParameter;
+
+  std::copy(handles.begin(), handles.end(), buffer);
+  *buffer_size = required;
+  consume_notify(search_type, search_key);
+  return Status::Success;
+}
+
+EFI_CALL auto locate_handle_buffer(LocateSearchType search_type,
+                                   const Guid* protocol, const void* search_key,
+                                   uintn_t* num_handles,
+                                   Handle** buffer) noexcept -> Status {
+  if (num_handles == nullptr || buffer == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  auto handles = std::vector<Handle>{};
+  auto status  = collect_handles(search_type, protocol, search_key, &handles);
+  if (status != Status::Success) {
+    *num_handles = 0;
+    *buffer      = nullptr;
+    return status;
+  }
+
+  void* memory = nullptr;
+  status = current_state->allocate_pool(handles.size() * sizeof(Handle),
+                                        &memory);
+  if (status != Status::Success) return status;
+
+  *buffer = static_cast<Handle*>(memory);
+  std::copy(handles.begin(), handles.end(), *buffer);
+  *num_handles = handles.size();
+  consume_notify(search_type, search_key);
+  return Status::Success;
+}
+
+EFI_CALL auto locate_device_path(const Guid&, DevicePathProtocol**,
+                                 Handle*) noexcept -> Status {
+  return Status::NotFound;
+}
+
+EFI_CALL auto locate_protocol(const Guid& protocol, const void* registration,
+                              void** interface) noexcept -> Status {
+  auto& state = *current_state;
+  if (interface == nullptr) return Status::InvalidParameter;
+  *interface = nullptr;
+
+  auto handles = std::vector<Handle>{};
+  if (registration != nullptr) {
+    auto status = collect_handles(LocateSearchType::ByRegisterNotify, nullptr,
+                                  registration, &handles);
+    if (status != Status::Success) return status;
+    consume_notify(LocateSearchType::ByRegisterNotify, registration);
+  } else {
+    for (auto& handle : state.handles) handles.push_back(handle.get());
+  }
+
+  for (auto handle : handles) {
+    auto* object = state.find_handle(handle);
+    if (object == nullptr) continue;
+
+    for (auto& entry : object->interfaces) {
+      if (entry->guid == protocol) {
+        *interface = entry->interface;
+        return Status::Success;
+      }
+    }
+  }
+
+  return Status::NotFound;
+}
+
+EFI_CALL auto protocols_per_handle(Handle controller_handle,
+                                   Guid*** protocol_buffer,
+                                   uintn_t* protocol_buffer_count) noexcept
+    -> Status {
+  auto& state  = *current_state;
+  auto* object = state.find_handle(controller_handle);
+  if (object == nullptr || protocol_buffer == nullptr ||
+      protocol_buffer_count == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  void* memory = nullptr;
+  auto  status =
+      state.allocate_pool(object->interfaces.size() * sizeof(Guid*), &memory);
+  if (status != Status::Success) return status;
+
+  auto* guids = static_cast<Guid**>(memory);
+  for (auto& entry : object->interfaces) *guids++ = &entry->guid;
+
+  *protocol_buffer       = static_cast<Guid**>(memory);
+  *protocol_buffer_count = object->interfaces.size();
+  return Status::Success;
+}
+
+EFI_CALL auto install_configuration_table(const Guid* guid,
+                                          void* table) noexcept -> Status {
+  auto& state = *current_state;
+  if (guid == nullptr) return Status::InvalidParameter;
+
+  auto& tables = state.configuration_tables;
+  auto  entry  = std::find_if(tables.begin(), tables.end(), [guid](auto& e) {
+    return e.vendor_guid == *guid;
+  });
+
+  if (table == nullptr) {
+    if (entry == tables.end()) return Status::NotFound;
+    tables.erase(entry);
+  } else if (entry != tables.end()) {
+    entry->vendor_table = table;
+  } else {
+    tables.push_back(
+        ConfigurationTableImage{.vendor_guid = *guid, .vendor_table = table});
+  }
+
+  state.seal_system_table();
+  return Status::Success;
+}
+
+EFI_CALL auto load_image(bool, Handle, const DevicePathProtocol*, const void*,
+                         uintn_t, Handle*) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto start_image(Handle, uintn_t*, char16_t**) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto exit(Handle, Status, uintn_t, const char16_t*) noexcept
+    -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto unload_image(Handle) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto exit_boot_services(Handle image_handle, uintn_t map_key) noexcept
+    -> Status {
+  auto& state = *current_state;
+  if (image_handle != state.image_handle) return Status::InvalidParameter;
+  if (map_key != state.map_key) return Status::InvalidParameter;
+
+  state.tpl = TplHighLevel;
+  state.signal_group(EventGroupExitBootServices);
+
+  // A notify may close events, so look for the next one after every call
+  for (;;) {
+    auto pending = std::find_if(
+        state.events.begin(), state.events.end(),
+        [](const auto& event) { return event->notify_pending; });
+    if (pending == state.events.end()) break;
+
+    auto* event           = pending->get();
+    event->notify_pending = false;
+    event->notify_function(event, event->notify_context);
+  }
+  state.tpl = TplApplication;
+
+  state.exited                       = true;
+  state.system_table.con_in_handle   = nullptr;
+  state.system_table.con_in          = nullptr;
+  state.system_table.con_out_handle  = nullptr;
+  state.system_table.con_out         = nullptr;
+  state.system_table.std_err_handle  = nullptr;
+  state.system_table.std_err         = nullptr;
+  state.system_table.boot_services   = nullptr;
+  seal_table(&state.system_table.header);
+  return Status::Success;
+}
+
+EFI_CALL auto get_next_monotonic_count(uint64_t* count) noexcept -> Status {
+  if (count == nullptr) return Status::InvalidParameter;
+  *count = current_state->monotonic_count++;
+  return Status::Success;
+}
+
+EFI_CALL auto stall(uintn_t microseconds) -> Status {
+  std::this_thread::sleep_for(std::chrono::microseconds{microseconds});
+  current_state->service_timers();
+  return Status::Success;
+}
+
+EFI_CALL auto set_watchdog_timer(uintn_t, uint64_t watchdog_code, uintn_t,
+                                 const char16_t*) noexcept -> Status {
+  if (watchdog_code <= 0xFFFF) return Status::InvalidParameter;
+  return Status::Success;
+}
+
+EFI_CALL auto connect_controller(Handle, Handle*, DevicePathProtocol*,
+                                 bool) noexcept -> Status {
+  return Status::NotFound;
+}
+
+EFI_CALL auto disconnect_controller(Handle, Handle, Handle) noexcept
+    -> Status {
+  return Status::Success;
+}
+
+EFI_CALL auto install_multiple_protocol_interfaces(Handle* handle,
+                                                   ...) noexcept -> Status {
+  auto& state = *current_state;
+  if (handle == nullptr) return Status::InvalidParameter;
+
+  auto installed = std::vector<std::pair<const Guid*, void*>>{};
+
+  __builtin_ms_va_list args;
+  __builtin_ms_va_start(args, handle);
+
+  auto status = Status::Success;
+  for (;;) {
+    auto* guid = __builtin_va_arg(args, const Guid*);
+    if (guid == nullptr) break;
+    auto* interface = __builtin_va_arg(args, void*);
+
+    status = state.install_protocol(handle, *guid, interface);
+    if (status != Status::Success) break;
+    installed.emplace_back(guid, interface);
+  }
+
+  __builtin_ms_va_end(args);
+
+  if (status != Status::Success) {
+    for (auto& [guid, interface] : installed) {
+      state.uninstall_protocol(*handle, *guid, interface);
+    }
+  }
+
+  return status;
+}
+
+EFI_CALL auto uninstall_multiple_protocol_interfaces(Handle handle,
+                                                     ...) noexcept -> Status {
+  auto& state = *current_state;
+
+  auto pairs = std::vector<std::pair<const Guid*, void*>>{};
+
+  __builtin_ms_va_list args;
+  __builtin_ms_va_start(args, handle);
+  for (;;) {
+    auto* guid = __builtin_va_arg(args, const Guid*);
+    if (guid == nullptr) break;
+    pairs.emplace_back(guid, __builtin_va_arg(args, void*));
+  }
+  __builtin_ms_va_end(args);
+
+  auto* object = state.find_handle(handle);
+  if (object == nullptr) return Status::InvalidParameter;
+
+  for (auto& [guid, interface] : pairs) {
+    auto found = std::any_of(
+        object->interfaces.begin(), object->interfaces.end(), [&](auto& e) {
+          return e->guid == *guid && e->interface == interface;
+        });
+    if (!found) return Status::InvalidParameter;
+  }
+
+  for (auto& [guid, interface] : pairs) {
+    state.uninstall_protocol(handle, *guid, interface);
+  }
+
+  return Status::Success;
+}
+
+EFI_CALL auto calculate_crc32(const void* data, uintn_t data_size,
+                              uint32_t* crc32_out) noexcept -> Status {
+  if (data == nullptr || data_size == 0 || crc32_out == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  *crc32_out = crc32(data, data_size);
+  return Status::Success;
+}
+
+EFI_CALL void copy_mem(void* destination, const void* source,
+                       uintn_t length) noexcept {
+  std::memmove(destination, source, length);
+}
+
+EFI_CALL void set_mem(void* buffer, uintn_t size, uint8_t value) noexcept {
+  std::memset(buffer, value, size);
+}
+
+#pragma endregion
+
+#pragma region Runtime Services
+
+EFI_CALL auto get_time(Time* time, TimeCapabilities* capabilities) noexcept
+    -> Status {
+  if (time == nullptr) return Status::InvalidParameter;
+
+  auto now = timespec{};
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  auto calendar = tm{};
+  gmtime_r(&now.tv_sec, &calendar);
+
+  *time            = Time{};
+  time->year       = static_cast<uint16_t>(calendar.tm_year + 1900);
+  time->month      = static_cast<uint8_t>(calendar.tm_mon + 1);
+  time->day        = static_cast<uint8_t>(calendar.tm_mday);
+  time->hour       = static_cast<uint8_t>(calendar.tm_hour);
+  time->minute     = static_cast<uint8_t>(calendar.tm_min);
+  time->second     = static_cast<uint8_t>(calendar.tm_sec);
+  time->nanosecond = static_cast<uint32_t>(now.tv_nsec);
+  time->timezone   = 0;
+  time->daylight   = 0;
+
+  if (capabilities != nullptr) {
+    *capabilities = TimeCapabilities{
+        .resolution = 1, .accuracy = 50'000'000, .sets_to_zero = false};
+  }
+
+  return Status::Success;
+}
+
+EFI_CALL auto set_time(const Time&) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto get_wakeup_time(bool*, bool*, Time*) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto set_wakeup_time(bool, const Time*) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto set_virtual_address_map(uintn_t, uintn_t, uintn_t,
+                                      const MemoryDescriptor*) noexcept
+    -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto convert_pointer(uintn_t, void**) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+auto variable_key(const char16_t* name, const Guid& guid) {
+  return std::make_pair(std::u16string{name}, guid.bytes());
+}
+
+EFI_CALL auto get_variable(const char16_t* variable_name,
+                           const Guid& vendor_guid,
+                           VariableAttribute* attributes, uintn_t* data_size,
+                           void* data) noexcept -> Status {
+  if (variable_name == nullptr || data_size == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  auto& variables = current_state->variables;
+  auto  entry     = variables.find(variable_key(variable_name, vendor_guid));
+  if (entry == variables.end()) return Status::NotFound;
+
+  const auto& variable = entry->second;
+  if (attributes != nullptr) *attributes = variable.attributes;
+
+  if (*data_size < variable.data.size()) {
+    *data_size = variable.data.size();
+    return Status::BufferTooSmall;
+  }
+
+  if (data == nullptr) return Status::InvalidParameter;
+
+  std::memcpy(data, variable.data.data(), variable.data.size());
+  *data_size = variable.data.size();
+  return Status::Success;
+}
+
+EFI_CALL auto get_next_variable_name(uintn_t* variable_name_size,
+                                     char16_t* variable_name,
+                                     Guid*     vendor_guid) noexcept -> Status {
+  if (variable_name_size == nullptr || variable_name == nullptr ||
+      vendor_guid == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  auto& variables = current_state->variables;
+  auto  entry     = variables.begin();
+  if (variable_name[0] != u'\0') {
+    entry = variables.find(variable_key(variable_name, *vendor_guid));
+    if (entry == variables.end()) return Status::InvalidParameter;
+    ++entry;
+  }
+
+  if (entry == variables.end()) return Status::NotFound;
+
+  const auto& name     = entry->first.first;
+  const auto  required = (name.size() + 1) * sizeof(char16_t);
+  if (*variable_name_size < required) {
+    *variable_name_size = required;
+    return Status::BufferTooSmall;
+  }
+
+  std::memcpy(variable_name, name.c_str(), required);
+  *vendor_guid        = Guid{entry->first.second};
+  *variable_name_size = required;
+  return Status::Success;
+}
+
+EFI_CALL auto set_variable(const char16_t* variable_name,
+                           const Guid& vendor_guid,
+                           VariableAttribute attributes, uintn_t data_size,
+                           const void* data) noexcept -> Status {
+  if (variable_name == nullptr || variable_name[0] == u'\0') {
+    return Status::InvalidParameter;
+  }
+  if (data_size != 0 && data == nullptr) return Status::InvalidParameter;
+
+  auto& variables = current_state->variables;
+  auto  key       = variable_key(variable_name, vendor_guid);
+  auto  entry     = variables.find(key);
+
+  const auto append =
+      (static_cast<uint32_t>(attributes) &
+       static_cast<uint32_t>(VariableAttribute::AppendWrite)) != 0;
+
+  if (data_size == 0 && !append) {
+    if (entry == variables.end()) return Status::NotFound;
+    variables.erase(entry);
+    return Status::Success;
+  }
+
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  if (append && entry != variables.end()) {
+    entry->second.data.insert(entry->second.data.end(), bytes,
+                              bytes + data_size);
+    return Status::Success;
+  }
+
+  variables[key] = Variable{
+      .attributes = attributes,
+      .data       = std::vector<uint8_t>(bytes, bytes + data_size)};
+  return Status::Success;
+}
+
+EFI_CALL auto get_next_high_monotonic_count(uint32_t* high_count) noexcept
+    -> Status {
+  if (high_count == nullptr) return Status::InvalidParameter;
+
+  auto& count = current_state->monotonic_count;
+  *high_count = static_cast<uint32_t>(count >> 32) + 1;
+  count       = static_cast<uint64_t>(*high_count) << 32;
+  return Status::Success;
+}
+
+EFI_CALL void reset_system(ResetType, Status reset_status, uintn_t,
+                           const void*) noexcept {
+  std::fflush(stdout);
+  std::fflush(stderr);
+  std::_Exit(reset_status == Status::Success ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+EFI_CALL auto update_capsule(CapsuleHeader**, uintn_t,
+                             PhysicalAddress) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto query_capsule_capabilities(CapsuleHeader**, uintn_t, uint64_t*,
+                                         ResetType*) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto query_variable_info(uint32_t,
+                                  uint64_t* maximum_variable_storage_size,
+                                  uint64_t* remaining_variable_storage_size,
+                                  uint64_t* maximum_variable_size) noexcept
+    -> Status {
+  if (maximum_variable_storage_size == nullptr ||
+      remaining_variable_storage_size == nullptr ||
+      maximum_variable_size == nullptr) {
+    return Status::InvalidParameter;
+  }
+
+  *maximum_variable_storage_size   = 64 * 1024;
+  *remaining_variable_storage_size = 64 * 1024;
+  *maximum_variable_size           = 32 * 1024;
+  for (const auto& [key, variable] : current_state->variables) {
+    const auto used = key.first.size() * 2 + variable.data.size();
+    *remaining_variable_storage_size -=
+        std::min(*remaining_variable_storage_size, used);
+  }
+  return Status::Success;
+}
+
+#pragma endregion
+
+}  // namespace
+
+#pragma region Utilities
+
+auto crc32(const void* data, uintn_t size) noexcept -> uint32_t {
+  return Crc32::compute(data, size);
+}
+
+void seal_table(TableHeader* header) noexcept {
+  header->crc32 = 0;
+  header->crc32 = crc32(header, header->header_size);
+}
+
+void append_utf8(std::string& out, const char16_t* str) {
+  for (; *str != u'\0'; ++str) {
+    auto code = static_cast<uint32_t>(*str);
+
+    if (code >= 0xD800 && code <= 0xDBFF && str[1] >= 0xDC00 &&
+        str[1] <= 0xDFFF) {
+      code = 0x10000 + ((code - 0xD800) << 10) + (str[1] - 0xDC00);
+      ++str;
+    }
+
+    if (code < 0x80) {
+      out.push_back(static_cast<char>(code));
+    } else if (code < 0x800) {
+      out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+      out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+      out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+      out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else {
+      out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+      out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+  }
+}
+
+auto state() noexcept -> State& {
+  return *current_state;
+}
+
+#pragma endregion
+
+#pragma region State
+
+State::State(const FirmwareConfig& config)
+    : config{config},
+      system_table{},
+      boot_services{},
+      runtime_services{},
+      memory{nullptr},
+      map_key{1},
+      tpl{TplApplication},
+      monotonic_count{0},
+      exited{false},
+      image_handle{nullptr} {
+  const auto pages = std::max(config.memory_size / page_size,
+                              firmware_reserved_pages + 1);
+
+  memory = static_cast<uint8_t*>(mmap(nullptr, pages * page_size,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  assert(memory != MAP_FAILED);
+
+  const auto base = reinterpret_cast<PhysicalAddress>(memory);
+  regions[base]   = Region{.pages     = firmware_reserved_pages,
+                           .type      = MemoryType::RuntimeServicesData,
+                           .allocated = false};
+  regions[base + firmware_reserved_pages * page_size] =
+      Region{.pages     = pages - firmware_reserved_pages,
+             .type      = MemoryType::ConventionalMemory,
+             .allocated = false};
+
+  boot_services = BootServicesImage{
+      .header  = {.signature   = BootServices::Signature,
+                  .revision    = revision(2, 90),
+                  .header_size = sizeof(BootServicesImage),
+                  .crc32       = 0,
+                  .reserved    = 0},
+      .entries = {to_entry(&raise_tpl),
+                  to_entry(&restore_tpl),
+                  to_entry(&detail::allocate_pages),
+                  to_entry(&detail::free_pages),
+                  to_entry(&get_memory_map),
+                  to_entry(&detail::allocate_pool),
+                  to_entry(&detail::free_pool),
+                  to_entry(&detail::create_event),
+                  to_entry(&set_timer),
+                  to_entry(&wait_for_event),
+                  to_entry(&detail::signal_event),
+                  to_entry(&close_event),
+                  to_entry(&check_event),
+                  to_entry(&install_protocol_interface),
+                  to_entry(&reinstall_protocol_interface),
+                  to_entry(&uninstall_protocol_interface),
+                  to_entry(&handle_protocol),
+                  nullptr,
+                  to_entry(&register_protocol_notify),
+                  to_entry(&locate_handle),
+                  to_entry(&locate_device_path),
+                  to_entry(&install_configuration_table),
+                  to_entry(&load_image),
+                  to_entry(&start_image),
+                  to_entry(&exit),
+                  to_entry(&unload_image),
+                  to_entry(&exit_boot_services),
+                  to_entry(&get_next_monotonic_count),
+                  to_entry(&stall),
+                  to_entry(&set_watchdog_timer),
+                  to_entry(&connect_controller),
+                  to_entry(&disconnect_controller),
+                  to_entry(&open_protocol),
+                  to_entry(&close_protocol),
+                  to_entry(&open_protocol_information),
+                  to_entry(&protocols_per_handle),
+                  to_entry(&locate_handle_buffer),
+                  to_entry(&locate_protocol),
+                  to_entry(&install_multiple_protocol_interfaces),
+                  to_entry(&uninstall_multiple_protocol_interfaces),
+                  to_entry(&calculate_crc32),
+                  to_entry(&copy_mem),
+                  to_entry(&set_mem),
+                  to_entry(&create_event_ex)}};
+  seal_table(&boot_services.header);
+
+  runtime_services = RuntimeServicesImage{
+      .header  = {.signature   = RuntimeServices::Signature,
+                  .revision    = revision(2, 90),
+                  .header_size = sizeof(RuntimeServicesImage),
+                  .crc32       = 0,
+                  .reserved    = 0},
+      .entries = {to_entry(&get_time), to_entry(&set_time),
+                  to_entry(&get_wakeup_time), to_entry(&set_wakeup_time),
+                  to_entry(&set_virtual_address_map),
+                  to_entry(&convert_pointer), to_entry(&get_variable),
+                  to_entry(&get_next_variable_name), to_entry(&set_variable),
+                  to_entry(&get_next_high_monotonic_count),
+                  to_entry(&reset_system), to_entry(&update_capsule),
+                  to_entry(&query_capsule_capabilities),
+                  to_entry(&query_variable_info)}};
+  seal_table(&runtime_services.header);
+
+  system_table = SystemTableImage{
+      .header              = {.signature   = SystemTable::Signature,
+                              .revision    = revision(2, 90),
+                              .header_size = sizeof(SystemTableImage),
+                              .crc32       = 0,
+                              .reserved    = 0},
+      .firmware_vendor     = firmware_vendor,
+      .firmware_revision   = 0x00010000,
+      .con_in_handle       = nullptr,
+      .con_in              = nullptr,
+      .con_out_handle      = nullptr,
+      .con_out             = nullptr,
+      .std_err_handle      = nullptr,
+      .std_err             = nullptr,
+      .runtime_services    = &runtime_services,
+      .boot_services       = &boot_services,
+      .num_table_entries   = 0,
+      .configuration_table = nullptr};
+}
+
+State::~State() {
+  for (auto& [buffer, size] : pool) std::free(buffer);
+
+  const auto first = regions.begin();
+  const auto last  = std::prev(regions.end());
+  munmap(memory,
+         last->first + last->second.pages * page_size - first->first);
+}
+
+void State::set_region(PhysicalAddress start, uint64_t pages, MemoryType type,
+                       bool allocated) {
+  const auto end = start + pages * page_size;
+
+  // Split the regions straddling either boundary
+  for (auto boundary : {start, end}) {
+    auto it = regions.upper_bound(boundary);
+    if (it == regions.begin()) continue;
+    --it;
+
+    const auto region_end = it->first + it->second.pages * page_size;
+    if (it->first < boundary && boundary < region_end) {
+      auto tail         = it->second;
+      tail.pages        = (region_end - boundary) / page_size;
+      it->second.pages  = (boundary - it->first) / page_size;
+      regions[boundary] = tail;
+    }
+  }
+
+  regions.erase(regions.lower_bound(start), regions.lower_bound(end));
+  auto it = regions.emplace(start, Region{.pages     = pages,
+                                          .type      = type,
+                                          .allocated = allocated})
+                .first;
+
+  const auto mergeable = [](const Region& a, const Region& b) {
+    return a.type == b.type && a.allocated == b.allocated;
+  };
+
+  if (auto next = std::next(it); next != regions.end() &&
+                                 next->first == end &&
+                                 mergeable(it->second, next->second)) {
+    it->second.pages += next->second.pages;
+    regions.erase(next);
+  }
+
+  if (it != regions.begin()) {
+    auto previous = std::prev(it);
+    if (previous->first + previous->second.pages * page_size == start &&
+        mergeable(previous->second, it->second)) {
+      previous->second.pages += it->second.pages;
+      regions.erase(it);
+    }
+  }
+
+  ++map_key;
+}
+
+auto State::allocate_pages(AllocateType type, MemoryType memory_type,
+                           uintn_t pages, PhysicalAddress* memory) noexcept
+    -> Status {
+  if (memory == nullptr || pages == 0) return Status::InvalidParameter;
+  if (memory_type == MemoryType::ConventionalMemory ||
+      (memory_type > MemoryType::UnacceptedMemoryType &&
+       static_cast<uint32_t>(memory_type) < 0x70000000)) {
+    return Status::InvalidParameter;
+  }
+
+  const auto size = pages * page_size;
+
+  if (type == AllocateType::Address) {
+    const auto start = *memory;
+    if (start % page_size != 0) return Status::NotFound;
+
+    auto it = regions.upper_bound(start);
+    if (it == regions.begin()) return Status::NotFound;
+    --it;
+
+    const auto& region = it->second;
+    if (region.type != MemoryType::ConventionalMemory ||
+        it->first + region.pages * page_size < start + size) {
+      return Status::NotFound;
+    }
+
+    set_region(start, pages, memory_type, true);
+    return Status::Success;
+  }
+
+  const auto limit = type == AllocateType::MaxAddress
+                         ? *memory
+                         : std::numeric_limits<PhysicalAddress>::max();
+
+  // Allocate top down like most firmware does
+  for (auto it = regions.rbegin(); it != regions.rend(); ++it) {
+    const auto& region = it->second;
+    if (region.type != MemoryType::ConventionalMemory) continue;
+    if (region.pages < pages) continue;
+
+    auto end = it->first + region.pages * page_size;
+    if (limit < end) end = (limit + 1) & ~(page_size - 1);
+    if (end < it->first + size) continue;
+
+    const auto start = end - size;
+    set_region(start, pages, memory_type, true);
+    *memory = start;
+    return Status::Success;
+  }
+
+  return Status::OutOfResources;
+}
+
+auto State::free_pages(PhysicalAddress memory, uintn_t pages) noexcept
+    -> Status {
+  if (memory % page_size != 0) return Status::InvalidParameter;
+
+  const auto end = memory + pages * page_size;
+
+  auto it = regions.upper_bound(memory);
+  if (it == regions.begin()) return Status::NotFound;
+  --it;
+
+  for (auto cursor = it->first; cursor < end; ++it) {
+    if (it == regions.end() || it->first != cursor || !it->second.allocated) {
+      return Status::NotFound;
+    }
+    cursor += it->second.pages * page_size;
+  }
+
+  set_region(memory, pages, MemoryType::ConventionalMemory, false);
+  return Status::Success;
+}
+
+auto State::allocate_pool(uintn_t size, void** buffer) noexcept -> Status {
+  if (buffer == nullptr) return Status::InvalidParameter;
+
+  *buffer = std::malloc(std::max<uintn_t>(size, 1));
+  if (*buffer == nullptr) return Status::OutOfResources;
+
+  pool.emplace(*buffer, size);
+  ++map_key;
+  return Status::Success;
+}
+
+auto State::free_pool(void* buffer) noexcept -> Status {
+  auto entry = pool.find(buffer);
+  if (entry == pool.end()) return Status::InvalidParameter;
+
+  pool.erase(entry);
+  std::free(buffer);
+  ++map_key;
+  return Status::Success;
+}
+
+auto State::create_event(EventType type, TPL notify_tpl,
+                         EventNotify notify_function, void* context,
+                         const Guid* group) -> EventObject* {
+  events.push_back(std::make_unique<EventObject>(EventObject{
+      .type            = type,
+      .notify_tpl      = notify_tpl,
+      .notify_function = notify_function,
+      .notify_context  = context,
+      .has_group       = group != nullptr,
+      .group           = group != nullptr ? *group : Guid{Guid::Bytes{}},
+      .signaled        = false,
+      .notify_pending  = false,
+      .timer_type      = TimerDelay::Cancel,
+      .timer_period    = 0,
+      .timer_deadline  = {}}));
+  return events.back().get();
+}
+
+auto State::find_event(Event event) const noexcept -> EventObject* {
+  for (auto& object : events) {
+    if (object.get() == event) return object.get();
+  }
+  return nullptr;
+}
+
+void State::signal_event(EventObject* event) {
+  event->signaled = true;
+  if (has_type(event->type, EventType::NotifySignal)) {
+    event->notify_pending = true;
+  }
+}
+
+void State::signal_group(const Guid& group) {
+  for (auto& event : events) {
+    if (event->has_group && event->group == group) signal_event(event.get());
+  }
+}
+
+void State::service_timers() {
+  const auto now = std::chrono::steady_clock::now();
+
+  for (auto& event : events) {
+    if (event->timer_type == TimerDelay::Cancel) continue;
+    if (event->timer_deadline > now) continue;
+
+    signal_event(event.get());
+
+    if (event->timer_type == TimerDelay::Periodic) {
+      const auto period = std::chrono::nanoseconds{event->timer_period * 100};
+      event->timer_deadline += period;
+      if (event->timer_deadline <= now) event->timer_deadline = now + period;
+    } else {
+      event->timer_type = TimerDelay::Cancel;
+    }
+  }
+
+  dispatch_notifies();
+}
+
+void State::dispatch_notifies() {
+  for (;;) {
+    EventObject* next = nullptr;
+    for (auto& event : events) {
+      if (!event->notify_pending || event->notify_tpl <= tpl) continue;
+      if (next == nullptr || event->notify_tpl > next->notify_tpl) {
+        next = event.get();
+      }
+    }
+
+    if (next == nullptr) return;
+
+    next->notify_pending = false;
+    next->signaled       = false;
+
+    const auto previous  = tpl;
+    tpl                  = next->notify_tpl;
+    next->notify_function(next, next->notify_context);
+    tpl = previous;
+  }
+}
+
+auto State::find_handle(Handle handle) const noexcept -> HandleObject* {
+  for (auto& object : handles) {
+    if (object.get() == handle) return object.get();
+  }
+  return nullptr;
+}
+
+auto State::install_protocol(Handle* handle, const Guid& guid, void* interface)
+    -> Status {
+  if (handle == nullptr) return Status::InvalidParameter;
+
+  HandleObject* object = nullptr;
+  if (*handle == nullptr) {
+    handles.push_back(std::make_unique<HandleObject>());
+    object = handles.back().get();
+  } else {
+    object = find_handle(*handle);
+    if (object == nullptr) return Status::InvalidParameter;
+
+    for (auto& entry : object->interfaces) {
+      if (entry->guid == guid) return Status::InvalidParameter;
+    }
+  }
+
+  object->interfaces.push_back(std::make_unique<InterfaceEntry>(
+      InterfaceEntry{.guid = guid, .interface = interface, .opens = {}}));
+  *handle = object;
+
+  notify_registrations(object, guid);
+  return Status::Success;
+}
+
+auto State::uninstall_protocol(Handle handle, const Guid& guid,
+                               void* interface) -> Status {
+  auto* object = find_handle(handle);
+  if (object == nullptr) return Status::InvalidParameter;
+
+  auto& interfaces = object->interfaces;
+  auto  entry      = std::find_if(
+      interfaces.begin(), interfaces.end(), [&](const auto& entry) {
+        return entry->guid == guid && entry->interface == interface;
+      });
+
+  if (entry == interfaces.end()) return Status::NotFound;
+
+  for (const auto& open : (*entry)->opens) {
+    const auto bits = static_cast<uint32_t>(open.attributes);
+    if (bits & (static_cast<uint32_t>(OpenProtocolAttribute::ByDriver) |
+                static_cast<uint32_t>(OpenProtocolAttribute::Exclusive))) {
+      return Status::AccessDenied;
+    }
+  }
+
+  interfaces.erase(entry);
+
+  if (interfaces.empty()) {
+    for (auto& registration : registrations) {
+      std::erase(registration->pending, handle);
+    }
+    std::erase_if(handles,
+                  [object](const auto& h) { return h.get() == object; });
+  }
+
+  return Status::Success;
+}
+
+void State::notify_registrations(Handle handle, const Guid& guid) {
+  for (auto& registration : registrations) {
+    if (!(registration->guid == guid)) continue;
+    registration->pending.push_back(handle);
+    signal_event(registration->event);
+  }
+  dispatch_notifies();
+}
+
+void State::seal_system_table() noexcept {
+  system_table.num_table_entries   = configuration_tables.size();
+  system_table.configuration_table = configuration_tables.data();
+  seal_table(&system_table.header);
+}
+
+#pragma endregion
+
+}  // namespace efi::mock::detail
+
+namespace efi::mock {
+
+Firmware::Firmware(const FirmwareConfig& config)
+    : state_{std::make_unique<detail::State>(config)} {
+  assert(detail::current_state == nullptr);
+  detail::current_state = state_.get();
+
+  auto& state = *state_;
+
+  state.install_protocol(&state.image_handle, detail::image_protocol_guid,
+                         nullptr);
+
+  auto  console = std::make_unique<detail::Console>();
+  auto& images  = *console;
+
+  console->mode = detail::TextOutputModeImage{.max_mode      = 1,
+                                              .mode          = 0,
+                                              .attribute     = 0x07,
+                                              .cursor_column = 0,
+                                              .cursor_row    = 0,
+                                              .visible       = true};
+  detail::build_text_output(images.output, &images.mode);
+  detail::build_text_output(images.error, &images.mode);
+
+  images.input = detail::TextInputImage{
+      .entries      = {detail::to_entry(&detail::text_input_reset),
+                       detail::to_entry(&detail::text_read_key_stroke)},
+      .wait_for_key = state.create_event(EventType{}, 0, nullptr, nullptr,
+                                         nullptr)};
+
+  state.install_protocol(&images.output_handle,
+                         SimpleTextOutputProtocol::guid, &images.output);
+  state.install_protocol(&images.input_handle, SimpleTextInputProtocol::guid,
+                         &images.input);
+
+  state.system_table.con_in_handle  = images.input_handle;
+  state.system_table.con_in         = &images.input;
+  state.system_table.con_out_handle = images.output_handle;
+  state.system_table.con_out        = &images.output;
+  state.system_table.std_err_handle = images.output_handle;
+  state.system_table.std_err        = &images.error;
+
+  state.devices.push_back(std::move(console));
+
+  state.seal_system_table();
+}
+
+Firmware::~Firmware() {
+  detail::current_state = nullptr;
+}
+
+auto Firmware::system_table() const noexcept -> SystemTable* {
+  return reinterpret_cast<SystemTable*>(&state_->system_table);
+}
+
+auto Firmware::boot_services() const noexcept -> BootServices* {
+  return reinterpret_cast<BootServices*>(&state_->boot_services);
+}
+
+auto Firmware::runtime_services() const noexcept -> RuntimeServices* {
+  return reinterpret_cast<RuntimeServices*>(&state_->runtime_services);
+}
+
+auto Firmware::image_handle() const noexcept -> Handle {
+  return state_->image_handle;
+}
+
+auto Firmware::map_key() const noexcept -> uintn_t {
+  return state_->map_key;
+}
+
+auto Firmware::boot_services_exited() const noexcept -> bool {
+  return state_->exited;
+}
+
+auto Firmware::console_output() const noexcept -> std::string_view {
+  return state_->console;
+}
+
+auto Firmware::add_block_device(const char* path, uint32_t block_size,
+                                Handle* handle) noexcept -> Status {
+  return detail::create_block_device(*state_, path, block_size, handle);
+}
+
+auto Firmware::add_file_system(Handle* handle) noexcept -> Status {
+  return detail::create_file_system(*state_, handle);
+}
+
+auto Firmware::add_file(Handle file_system, const char16_t* path,
+                        const void* data, uintn_t size) noexcept -> Status {
+  return detail::add_file(*state_, file_system, path, data, size);
+}
+
+auto Firmware::add_loopback_network(const MacAddress& address,
+                                    Handle* handle) noexcept -> Status {
+  return detail::create_loopback_network(*state_, address, handle);
+}
+
+}  // namespace efi::mock
@@ -0,0 +1,372 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include "state.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "efi/protocol/simple_network.hpp"
+
+namespace efi::mock::detail {
+
+namespace {
+
+constexpr auto media_header_size = uint32_t{14};
+constexpr auto max_packet_size   = uint32_t{1500};
+
+constexpr auto interrupt_receive  = uint32_t{0x01};
+constexpr auto interrupt_transmit = uint32_t{0x02};
+
+struct ModeImage {
+  SimpleNetworkState              state;
+  uint32_t                        hw_address_size;
+  uint32_t                        media_header_size;
+  uint32_t                        max_packet_size;
+  uint32_t                        nv_ram_size;
+  uint32_t                        nv_ram_access_size;
+  uint32_t                        receive_filter_mask;
+  uint32_t                        receive_filter_setting;
+  uint32_t                        max_mcast_filter_count;
+  uint32_t                        mcast_filter_count;
+  std::array<MacAddress, 16>      mcast_filter;
+  MacAddress                      current_address;
+  MacAddress                      broadcast_address;
+  MacAddress                      permanent_address;
+  uint8_t                         if_type;
+  bool                            mac_address_changeable;
+  bool                            multiple_tx_supported;
+  bool                            media_present_supported;
+  bool                            media_present;
+};
+
+static_assert(sizeof(ModeImage) == sizeof(SimpleNetworkMode));
+
+struct NetworkImage {
+  uint64_t         revision;
+  void*            entries[13];
+  Event            wait_for_packet;
+  const ModeImage* mode;
+};
+
+static_assert(offsetof(NetworkImage, mode) == sizeof(SimpleNetworkProtocol));
+
+struct LoopbackNetwork {
+  NetworkImage                     image;
+  ModeImage                        mode;
+  std::deque<std::vector<uint8_t>> frames;
+  std::deque<const void*>          transmitted;
+};
+
+auto network(SimpleNetworkProtocol* self) noexcept {
+  return reinterpret_cast<LoopbackNetwork*>(self);
+}
+
+auto mac_bytes(const MacAddress& address) {
+  auto bytes = std::array<uint8_t, 6>{};
+  std::memcpy(bytes.data(), &address, bytes.size());
+  return bytes;
+}
+
+auto to_mac(const uint8_t* bytes) {
+  auto mac = MacAddress::Mac{};
+  std::copy_n(bytes, mac.size(), mac.begin());
+  return MacAddress{mac};
+}
+
+auto require_state(const LoopbackNetwork& nic, SimpleNetworkState state)
+    -> Status {
+  if (nic.mode.state == state) return Status::Success;
+  return nic.mode.state == SimpleNetworkState::Stopped ? Status::NotStarted
+                                                       : Status::DeviceError;
+}
+
+EFI_CALL auto start(SimpleNetworkProtocol* self) noexcept -> Status {
+  auto& nic = *network(self);
+  if (nic.mode.state != SimpleNetworkState::Stopped) {
+    return Status::AlreadyStarted;
+  }
+  nic.mode.state = SimpleNetworkState::Started;
+  return Status::Success;
+}
+
+EFI_CALL auto stop(SimpleNetworkProtocol* self) noexcept -> Status {
+  auto& nic = *network(self);
+  if (nic.mode.state == SimpleNetworkState::Stopped) return Status::NotStarted;
+  nic.mode.state = SimpleNetworkState::Stopped;
+  return Status::Success;
+}
+
+EFI_CALL auto initialize(SimpleNetworkProtocol* self, uintn_t,
+                         uintn_t) noexcept -> Status {
+  auto& nic = *network(self);
+  if (auto status = require_state(nic, SimpleNetworkState::Started);
+      status != Status::Success) {
+    return status;
+  }
+  nic.mode.state = SimpleNetworkState::Initialized;
+  return Status::Success;
+}
+
+EFI_CALL auto reset(SimpleNetworkProtocol* self, bool) noexcept -> Status {
+  auto& nic = *network(self);
+  if (auto status = require_state(nic, SimpleNetworkState::Initialized);
+      status != Status::Success) {
+    return status;
+  }
+  nic.frames.clear();
+  nic.transmitted.clear();
+  return Status::Success;
+}
+
+EFI_CALL auto shutdown(SimpleNetworkProtocol* self) noexcept -> Status {
+  auto& nic = *network(self);
+  if (auto status = require_state(nic, SimpleNetworkState::Initialized);
+      status != Status::Success) {
+    return status;
+  }
+  nic.frames.clear();
+  nic.transmitted.clear();
+  nic.mode.state = SimpleNetworkState::Started;
+  return Status::Success;
+}
+
+EFI_CALL auto receive_filters(SimpleNetworkProtocol* self, uint32_t enable,
+                              uint32_t disable, bool, uintn_t,
+                              const MacAddress*) noexcept -> Status {
+  auto& nic                       = *network(self);
+  nic.mode.receive_filter_setting = (nic.mode.receive_filter_setting | enable) &
+                                    ~disable & nic.mode.receive_filter_mask;
+  return Status::Success;
+}
+
+EFI_CALL auto station_address(SimpleNetworkProtocol* self, bool reset,
+                              const MacAddress* new_address) noexcept
+    -> Status {
+  auto& nic = *network(self);
+  if (reset) {
+    nic.mode.current_address = nic.mode.permanent_address;
+  } else if (new_address != nullptr) {
+    nic.mode.current_address = *new_address;
+  } else {
+    return Status::InvalidParameter;
+  }
+  return Status::Success;
+}
+
+EFI_CALL auto statistics(SimpleNetworkProtocol*, bool, uintn_t*,
+                         NetworkStatistics*) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto mcast_ip_to_mac(SimpleNetworkProtocol*, bool ipv6,
+                              const IpAddress& ip, MacAddress* mac) noexcept
+    -> Status {
+  if (mac == nullptr) return Status::InvalidParameter;
+
+  const auto* bytes = reinterpret_cast<const uint8_t*>(&ip);
+  if (ipv6) {
+    *mac = MacAddress{MacAddress::Mac{0x33, 0x33, bytes[12], bytes[13],
+                                      bytes[14], bytes[15]}};
+  } else {
+    *mac = MacAddress{MacAddress::Mac{0x01, 0x00, 0x5e,
+                                      static_cast<uint8_t>(bytes[1] & 0x7f),
+                                      bytes[2], bytes[3]}};
+  }
+  return Status::Success;
+}
+
+EFI_CALL auto nv_data(SimpleNetworkProtocol*, bool, uintn_t, uintn_t,
+                      void*) noexcept -> Status {
+  return Status::Unsupported;
+}
+
+EFI_CALL auto get_status(SimpleNetworkProtocol* self,
+                         uint32_t* interrupt_status, void** tx_buf) noexcept
+    -> Status {
+  auto& nic = *network(self);
+  if (auto status = require_state(nic, SimpleNetworkState::Initialized);
+      status != Status::Success) {
+    return status;
+  }
+
+  if (interrupt_status != nullptr) {
+    *interrupt_status = (nic.frames.empty() ? 0 : interrupt_receive) |
+                        (nic.transmitted.empty() ? 0 : interrupt_transmit);
+  }
+
+  if (tx_buf != nullptr) {
+    *tx_buf = nullptr;
+    if (!nic.transmitted.empty()) {
+      *tx_buf = const_cast<void*>(nic.transmitted.front());
+      nic.transmitted.pop_front();
+    }
+  }
+
+  return Status::Success;
+}
+
+EFI_CALL auto transmit(SimpleNetworkProtocol* self, uintn_t header_size,
+                       uintn_t buffer_size, const void* buffer,
+                       const MacAddress* src_addr, const MacAddress* dst_addr,
+                       const InetProtocol* protocol) noexcept -> Status {
+  auto& nic = *network(self);
+  if (auto status = require_state(nic, SimpleNetworkState::Initialized);
+      status != Status::Success) {
+    return status;
+  }
+
+  if (buffer == nullptr || buffer_size < header_size) {
+    return Status::InvalidParameter;
+  }
+  if (buffer_size > max_packet_size + media_header_size) {
+    return Status::BufferTooSmall;
+  }
+
+  const auto* bytes = static_cast<const uint8_t*>(buffer);
+  auto        frame = std::vector<uint8_t>(bytes, bytes + buffer_size);
+
+  if (header_size != 0) {
+    if (header_size != media_header_size || dst_addr == nullptr ||
+        protocol == nullptr) {
+      return Status::InvalidParameter;
+    }
+
+    const auto destination = mac_bytes(*dst_addr);
+    const auto source =
+        mac_bytes(src_addr != nullptr ? *src_addr : nic.mode.current_address);
+    const auto type = static_cast<uint16_t>(*protocol);
+
+    std::copy(destination.begin(), destination.end(), frame.begin());
+    std::copy(source.begin(), source.end(), frame.begin() + 6);
+    frame[12] = static_cast<uint8_t>(type >> 8);
+    frame[13] = static_cast<uint8_t>(type);
+  }
+
+  nic.frames.push_back(std::move(frame));
+  nic.transmitted.push_back(buffer);
+
+  state().signal_event(
+      static_cast<EventObject*>(nic.image.wait_for_packet));
+  return Status::Success;
+}
+
+EFI_CALL auto receive(SimpleNetworkProtocol* self, uintn_t* header_size,
+                      uintn_t* buffer_size, void* buffer, MacAddress* src_addr,
+                      MacAddress* dst_addr, InetProtocol* protocol) noexcept
+    -> Status {
+  auto& nic = *network(self);
+  if (auto status = require_state(nic, SimpleNetworkState::Initialized);
+      status != Status::Success) {
+    return status;
+  }
+
+  if (buffer_size == nullptr || buffer == nullptr) {
+    return Status::InvalidParameter;
+  }
+  if (nic.frames.empty()) return Status::NotReady;
+
+  const auto& frame = nic.frames.front();
+  if (*buffer_size < frame.size()) {
+    *buffer_size = frame.size();
+    return Status::BufferTooSmall;
+  }
+
+  std::memcpy(buffer, frame.data(), frame.size());
+  *buffer_size = frame.size();
+
+  if (header_size != nullptr) *header_size = media_header_size;
+  if (frame.size() >= media_header_size) {
+    if (dst_addr != nullptr) *dst_addr = to_mac(frame.data());
+    if (src_addr != nullptr) *src_addr = to_mac(frame.data() + 6);
+    if (protocol != nullptr) {
+      *protocol = static_cast<InetProtocol>((frame[12] << 8) | frame[13]);
+    }
+  }
+
+  nic.frames.pop_front();
+  if (!nic.frames.empty()) {
+    state().signal_event(
+        static_cast<EventObject*>(nic.image.wait_for_packet));
+  }
+
+  return Status::Success;
+}
+
+}  // namespace
+
+auto create_loopback_network(State& state, const MacAddress& address,
+                             Handle* handle) -> Status {
+  if (handle == nullptr) return Status::InvalidParameter;
+
+  auto  device = std::make_unique<DeviceOf<LoopbackNetwork>>();
+  auto& nic    = device->instance;
+
+  const auto filters =
+      RecieveFilterSettings::Unicast | RecieveFilterSettings::Multicast |
+      RecieveFilterSettings::Broadcast | RecieveFilterSettings::Promiscuous;
+
+  nic.mode = ModeImage{
+      .state                   = SimpleNetworkState::Stopped,
+      .hw_address_size         = 6,
+      .media_header_size       = media_header_size,
+      .max_packet_size         = max_packet_size,
+      .nv_ram_size             = 0,
+      .nv_ram_access_size      = 0,
+      .receive_filter_mask     = static_cast<uint32_t>(filters),
+      .receive_filter_setting  = 0,
+      .max_mcast_filter_count  = 16,
+      .mcast_filter_count      = 0,
+      .mcast_filter            = {},
+      .current_address         = address,
+      .broadcast_address       = MacAddress{MacAddress::Mac{
+          0xff, 0xff, 0xff, 0xff, 0xff, 0xff}},
+      .permanent_address       = address,
+      .if_type                 = 1,
+      .mac_address_changeable  = true,
+      .multiple_tx_supported   = true,
+      .media_present_supported = true,
+      .media_present           = true};
+
+  nic.image = NetworkImage{
+      .revision        = 0x00010000,
+      .entries         = {reinterpret_cast<void*>(&start),
+                          reinterpret_cast<void*>(&stop),
+                          reinterpret_cast<void*>(&initialize),
+                          reinterpret_cast<void*>(&reset),
+                          reinterpret_cast<void*>(&shutdown),
+                          reinterpret_cast<void*>(&receive_filters),
+                          reinterpret_cast<void*>(&station_address),
+                          reinterpret_cast<void*>(&statistics),
+                          reinterpret_cast<void*>(&mcast_ip_to_mac),
+                          reinterpret_cast<void*>(&nv_data),
+                          reinterpret_cast<void*>(&get_status),
+                          reinterpret_cast<void*>(&transmit),
+                          reinterpret_cast<void*>(&receive)},
+      .wait_for_packet = state.create_event(EventType{}, 0, nullptr, nullptr,
+                                            nullptr),
+      .mode            = &nic.mode};
+
+  if (auto status = state.install_protocol(handle, SimpleNetworkProtocol::guid,
+                                           &nic.image);
+      status != Status::Success) {
+    return status;
+  }
+
+  state.devices.push_back(std::move(device));
+  return Status::Success;
+}
+
+}  // namespace efi::mock::detail
@@ -0,0 +1,280 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <deque>
+
+#include "efi/mock/firmware.hpp"
+
+namespace efi::mock::detail {
+
+// The wrapper classes only expose firmware owned memory, so the mock builds
+// tables as layout compatible images and hands out pointers to those.
+
+struct TableHeader {
+  uint64_t signature;
+  uint32_t revision;
+  uint32_t header_size;
+  uint32_t crc32;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(TableHeader) == sizeof(Table));
+
+struct BootServicesImage {
+  TableHeader header;
+  void*       entries[44];
+};
+
+static_assert(sizeof(BootServicesImage) == sizeof(BootServices));
+
+struct RuntimeServicesImage {
+  TableHeader header;
+  void*       entries[14];
+};
+
+static_assert(sizeof(RuntimeServicesImage) == sizeof(RuntimeServices));
+
+struct ConfigurationTableImage {
+  Guid  vendor_guid;
+  void* vendor_table;
+};
+
+static_assert(sizeof(ConfigurationTableImage) == sizeof(ConfigurationTable));
+
+struct SystemTableImage {
+  TableHeader              header;
+  const char16_t*          firmware_vendor;
+  uint32_t                 firmware_revision;
+  Handle                   con_in_handle;
+  void*                    con_in;
+  Handle                   con_out_handle;
+  void*                    con_out;
+  Handle                   std_err_handle;
+  void*                    std_err;
+  RuntimeServicesImage*    runtime_services;
+  BootServicesImage*       boot_services;
+  uintn_t                  num_table_entries;
+  ConfigurationTableImage* configuration_table;
+};
+
+static_assert(sizeof(SystemTableImage) == sizeof(SystemTable));
+
+struct MemoryDescriptorImage {
+  MemoryType      type;
+  PhysicalAddress physical_start;
+  VirtualAddress  virtual_start;
+  uint64_t        number_of_pages;
+  uint64_t        attribute;
+};
+
+static_assert(sizeof(MemoryDescriptorImage) == sizeof(MemoryDescriptor));
+
+struct OpenProtocolInformationImage {
+  Handle                agent_handle;
+  Handle                controller_handle;
+  OpenProtocolAttribute attributes;
+  uint32_t              open_count;
+};
+
+static_assert(sizeof(OpenProtocolInformationImage) ==
+              sizeof(OpenProtocolInformationEntry));
+
+auto crc32(const void* data, uintn_t size) noexcept -> uint32_t;
+
+// Recomputes the header crc over header_size bytes
+void seal_table(TableHeader* header) noexcept;
+
+// Converts UTF-16 to UTF-8 and appends it to out
+void append_utf8(std::string& out, const char16_t* str);
+
+// Base for anything a protocol instance needs to keep alive
+class Device {
+ public:
+  virtual ~Device() = default;
+};
+
+// Owns a standard layout instance which starts with its protocol image, so
+// the self pointer handed to protocol functions casts straight back to it
+template <typename T>
+class DeviceOf final : public Device {
+ public:
+  T instance{};
+};
+
+struct EventObject {
+  EventType                             type;
+  TPL                                   notify_tpl;
+  EventNotify                           notify_function;
+  void*                                 notify_context;
+  bool                                  has_group;
+  Guid                                  group;
+  bool                                  signaled;
+  bool                                  notify_pending;
+  TimerDelay                            timer_type;
+  uint64_t                              timer_period;
+  std::chrono::steady_clock::time_point timer_deadline;
+};
+
+struct OpenRecord {
+  Handle                agent_handle;
+  Handle                controller_handle;
+  OpenProtocolAttribute attributes;
+  uint32_t              open_count;
+};
+
+struct InterfaceEntry {
+  Guid                    guid;
+  void*                   interface;
+  std::vector<OpenRecord> opens;
+};
+
+struct HandleObject {
+  std::vector<std::unique_ptr<InterfaceEntry>> interfaces;
+};
+
+struct Registration {
+  Guid               guid;
+  EventObject*       event;
+  std::deque<Handle> pending;
+};
+
+struct Region {
+  uint64_t   pages;
+  MemoryType type;
+  bool       allocated;
+};
+
+struct Variable {
+  VariableAttribute    attributes;
+  std::vector<uint8_t> data;
+};
+
+class State {
+ public:
+  FirmwareConfig config;
+
+  SystemTableImage     system_table;
+  BootServicesImage    boot_services;
+  RuntimeServicesImage runtime_services;
+
+  // Host memory standing in for physical memory
+  uint8_t*                           memory;
+  std::map<PhysicalAddress, Region>  regions;
+  std::unordered_map<void*, uintn_t> pool;
+  uintn_t                            map_key;
+
+  TPL                                       tpl;
+  std::vector<std::unique_ptr<EventObject>> events;
+
+  std::vector<std::unique_ptr<HandleObject>> handles;
+  std::vector<std::unique_ptr<Registration>> registrations;
+
+  std::vector<ConfigurationTableImage> configuration_tables;
+
+  std::map<std::pair<std::u16string, Guid::Bytes>, Variable> variables;
+
+  uint64_t monotonic_count;
+  bool     exited;
+
+  Handle      image_handle;
+  std::string console;
+
+  std::vector<std::unique_ptr<Device>> devices;
+
+  explicit State(const FirmwareConfig& config);
+  ~State();
+
+  State(State&&)                         = delete;
+  State(const State&)                    = delete;
+  auto operator=(State&&) -> State&      = delete;
+  auto operator=(const State&) -> State& = delete;
+
+#pragma region Memory
+
+  auto allocate_pages(AllocateType type, MemoryType memory_type, uintn_t pages,
+                      PhysicalAddress* memory) noexcept -> Status;
+
+  auto free_pages(PhysicalAddress memory, uintn_t pages) noexcept -> Status;
+
+  auto allocate_pool(uintn_t size, void** buffer) noexcept -> Status;
+
+  auto free_pool(void* buffer) noexcept -> Status;
+
+#pragma endregion
+
+#pragma region Events
+
+  auto create_event(EventType type, TPL notify_tpl, EventNotify notify_function,
+                    void* context, const Guid* group) -> EventObject*;
+
+  auto find_event(Event event) const noexcept -> EventObject*;
+
+  void signal_event(EventObject* event);
+
+  void signal_group(const Guid& group);
+
+  void service_timers();
+
+  void dispatch_notifies();
+
+#pragma endregion
+
+#pragma region Handles
+
+  auto find_handle(Handle handle) const noexcept -> HandleObject*;
+
+  auto install_protocol(Handle* handle, const Guid& guid, void* interface)
+      -> Status;
+
+  auto uninstall_protocol(Handle handle, const Guid& guid, void* interface)
+      -> Status;
+
+  void notify_registrations(Handle handle, const Guid& guid);
+
+#pragma endregion
+
+  void seal_system_table() noexcept;
+
+ private:
+  void set_region(PhysicalAddress start, uint64_t pages, MemoryType type,
+                  bool allocated);
+};
+
+auto state() noexcept -> State&;
+
+#pragma region Devices
+
+auto create_block_device(State& state, const char* path, uint32_t block_size,
+                         Handle* handle) -> Status;
+
+auto create_file_system(State& state, Handle* handle) -> Status;
+
+auto add_file(State& state, Handle file_system, const char16_t* path,
+              const void* data, uintn_t size) -> Status;
+
+auto create_loopback_network(State& state, const MacAddress& address,
+                             Handle* handle) -> Status;
+
+#pragma endregion
+
+}  // namespace efi::mock::detail
@@ -0,0 +1,49 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#ifndef __cplusplus
+#error
+#endif
+
+// Minimal assertions for the host tests, a failed check is reported and makes
+// the test exit non zero once main returns check_result()
+
+#include <cstdio>
+
+namespace efi::test {
+
+inline auto failures = 0;
+
+inline auto check_result() noexcept -> int {
+  if (failures != 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+  }
+  return failures == 0 ? 0 : 1;
+}
+
+}  // namespace efi::test
+
+#define CHECK(expression)                                         \
+  do {                                                            \
+    if (!(expression)) {                                          \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, \
+                   __LINE__, #expression);                        \
+      ++::efi::test::failures;                                    \
+    }                                                             \
+  } while (false)
+
+#define CHECK_SUCCESS(expression) CHECK((expression) == ::efi::Status::Success)
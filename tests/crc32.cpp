@@ -0,0 +1,160 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "efi/crc32.hpp"
+
+using namespace efi;
+
+namespace {
+
+constexpr auto check_value = uint32_t{0xcbf43926};
+constexpr auto max_length  = uintn_t{300};
+
+// One bit at a time, straight from the polynomial
+auto reference(const uint8_t* data, uintn_t size) -> uint32_t {
+  auto crc = ~uint32_t{0};
+  for (auto i = uintn_t{0}; i < size; ++i) {
+    crc ^= data[i];
+    for (auto bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ ((crc & 1) != 0 ? Crc32::polynomial : 0);
+    }
+  }
+  return ~crc;
+}
+
+auto kernels() -> std::vector<Crc32Kernel> {
+  auto list = std::vector<Crc32Kernel>{Crc32Kernel::Slicing8};
+  if (Crc32::detect() == Crc32Kernel::Pclmul) {
+    list.push_back(Crc32Kernel::Pclmul);
+  }
+  return list;
+}
+
+void test_check_value(Crc32Kernel kernel) {
+  Crc32::use(kernel);
+
+  const char* digits = "123456789";
+  CHECK(Crc32::compute(digits, 9) == check_value);
+  CHECK(Crc32::compute(digits, 0) == 0);
+
+  auto crc = Crc32{};
+  crc.update(digits, 4);
+  crc.update(digits + 4, 5);
+  CHECK(crc.value() == check_value);
+}
+
+// Lengths around the 8 byte slices and the 64 byte folds, fed whole and in
+// two pieces split anywhere
+void test_random(Crc32Kernel kernel) {
+  Crc32::use(kernel);
+
+  auto random = std::mt19937{0x1234};
+  auto data   = std::vector<uint8_t>(max_length);
+
+  auto whole = true;
+  auto split = true;
+  for (auto length = uintn_t{0}; length <= max_length; ++length) {
+    for (auto& byte : data) {
+      byte = static_cast<uint8_t>(random());
+    }
+    const auto expected = reference(data.data(), length);
+    whole = whole && Crc32::compute(data.data(), length) == expected;
+
+    for (auto i = 0; i < 4; ++i) {
+      const auto at  = length != 0 ? random() % (length + 1) : 0;
+      auto       crc = Crc32{};
+      crc.update(data.data(), at);
+      crc.update(data.data() + at, length - at);
+      split = split && crc.value() == expected;
+    }
+  }
+  CHECK(whole);
+  CHECK(split);
+}
+
+// The kernels themselves, without the resolver in between
+void test_kernels() {
+  auto random = std::mt19937{0x5678};
+  auto data   = std::vector<uint8_t>(4096 + 13);
+  for (auto& byte : data) {
+    byte = static_cast<uint8_t>(random());
+  }
+  const auto expected = reference(data.data(), data.size());
+
+  CHECK(~Crc32::update_slicing8(~uint32_t{0}, data.data(), data.size()) ==
+        expected);
+  if (Crc32::detect() == Crc32Kernel::Pclmul) {
+    CHECK(~Crc32::update_pclmul(~uint32_t{0}, data.data(), data.size()) ==
+          expected);
+  }
+}
+
+// A table header followed by a body the crc32 covers
+struct TableImage {
+  uint64_t signature;
+  uint32_t revision;
+  uint32_t header_size;
+  uint32_t crc32;
+  uint32_t reserved;
+  uint8_t  body[40];
+};
+
+void test_seal_table() {
+  constexpr auto signature = uint64_t{0x454c424154545345};
+
+  auto image = TableImage{signature, 0x10000, sizeof(TableImage), 0, 0, {}};
+  for (auto i = uintn_t{0}; i < sizeof(image.body); ++i) {
+    image.body[i] = static_cast<uint8_t>(i);
+  }
+  auto* table = reinterpret_cast<Table*>(&image);
+
+  CHECK(verify_table(table, signature) == Status::CrcError);
+  CHECK_SUCCESS(seal_table(table));
+  CHECK_SUCCESS(verify_table(table, signature));
+  CHECK(verify_table(table, signature + 1) == Status::Unsupported);
+
+  // Taken with the crc32 field as zero
+  auto copy  = image;
+  copy.crc32 = 0;
+  CHECK(image.crc32 ==
+        reference(reinterpret_cast<const uint8_t*>(&copy), sizeof(copy)));
+
+  image.body[7] ^= 1;
+  CHECK(verify_table(table, signature) == Status::CrcError);
+  CHECK_SUCCESS(seal_table(table));
+  CHECK_SUCCESS(verify_table(table, signature));
+
+  image.header_size = sizeof(Table) - 1;
+  CHECK(seal_table(table) == Status::BadBufferSize);
+  CHECK(verify_table(table, signature) == Status::BadBufferSize);
+}
+
+}  // namespace
+
+auto main() -> int {
+  for (const auto kernel : kernels()) {
+    test_check_value(kernel);
+    test_random(kernel);
+  }
+  test_kernels();
+  test_seal_table();
+
+  return test::check_result();
+}
@@ -0,0 +1,140 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <vector>
+
+#include "check.hpp"
+#include "efi/event_bus.hpp"
+#include "efi/mock/firmware.hpp"
+
+using namespace efi;
+
+namespace {
+
+constexpr auto test_group =
+    Guid{0x5d0a3b1e,
+         0x64c2,
+         0x4f0b,
+         {0x9a, 0x1d, 0x3c, 0x77, 0x20, 0x8e, 0x41, 0xb5}};
+
+// Logs its tag, then drops the subscriptions listed in unsubscribe
+struct Subscriber {
+  EventBus*                 bus;
+  int                       tag;
+  std::vector<int>*         log;
+  std::vector<EventBus::Id> unsubscribe;
+};
+
+void record(const Guid& /*group*/, void* context) noexcept {
+  auto& subscriber = *static_cast<Subscriber*>(context);
+  subscriber.log->push_back(subscriber.tag);
+  for (const auto id : subscriber.unsubscribe) {
+    CHECK_SUCCESS(subscriber.bus->unsubscribe(id));
+  }
+}
+
+void test_publish(BootServices* bs) {
+  auto bus = EventBus{bs};
+  auto log = std::vector<int>{};
+
+  auto first  = Subscriber{&bus, 1, &log, {}};
+  auto second = Subscriber{&bus, 2, &log, {}};
+  auto ids    = std::array<EventBus::Id, 2>{};
+  CHECK_SUCCESS(bus.subscribe(test_group, &record, &first, &ids[0]));
+  CHECK_SUCCESS(bus.subscribe(test_group, &record, &second, &ids[1]));
+  CHECK(bus.subscribed(test_group));
+
+  // Subscribers run in subscription order
+  CHECK_SUCCESS(bus.publish(test_group));
+  CHECK((log == std::vector<int>{1, 2}));
+  CHECK(bus.stats().published == 1);
+  CHECK(bus.stats().notified == 1);
+  CHECK(bus.stats().dispatched == 2);
+
+  // The first handler removes itself and the second before it is reached
+  first.unsubscribe = {ids[0], ids[1]};
+  log.clear();
+  CHECK_SUCCESS(bus.publish(test_group));
+  CHECK((log == std::vector<int>{1}));
+  CHECK(!bus.subscribed(test_group));
+  CHECK(bus.unsubscribe(ids[0]) == Status::NotFound);
+
+  // Publishing without a subscription still succeeds
+  CHECK_SUCCESS(bus.publish(test_group));
+  CHECK(bus.stats().dispatched == 3);
+}
+
+// A stale id must not remove the subscription reusing its slot
+void test_stale_id(BootServices* bs) {
+  auto bus = EventBus{bs};
+  auto log = std::vector<int>{};
+
+  auto old_subscriber = Subscriber{&bus, 1, &log, {}};
+  auto new_subscriber = Subscriber{&bus, 2, &log, {}};
+  auto old_id         = EventBus::Id{0};
+  auto new_id         = EventBus::Id{0};
+  CHECK_SUCCESS(bus.subscribe(test_group, &record, &old_subscriber, &old_id));
+  CHECK_SUCCESS(bus.unsubscribe(old_id));
+  CHECK_SUCCESS(bus.subscribe(test_group, &record, &new_subscriber, &new_id));
+
+  CHECK(new_id != old_id);
+  CHECK(bus.unsubscribe(old_id) == Status::NotFound);
+  CHECK_SUCCESS(bus.publish(test_group));
+  CHECK((log == std::vector<int>{2}));
+  CHECK_SUCCESS(bus.unsubscribe(new_id));
+}
+
+// Leaves boot services, so it runs last
+void test_exit_boot_services(mock::Firmware* fw, BootServices* bs) {
+  auto bus = EventBus{bs};
+  auto log = std::vector<int>{};
+
+  auto subscriber = Subscriber{&bus, 1, &log, {}};
+  auto id         = EventBus::Id{0};
+  CHECK_SUCCESS(
+      bus.subscribe(EventGroupExitBootServices, &record, &subscriber, &id));
+
+  // Unsubscribing the last one closes the group event from its own notify
+  subscriber.unsubscribe = {id};
+
+  auto map_size        = uintn_t{0};
+  auto map_key         = uintn_t{0};
+  auto descriptor_size = uintn_t{0};
+  auto version         = uint32_t{0};
+  bs->get_memory_map(&map_size, nullptr, &map_key, &descriptor_size,
+                     &version);
+
+  auto  buffer = std::vector<uint8_t>(map_size);
+  auto* map    = reinterpret_cast<MemoryDescriptor*>(buffer.data());
+  CHECK_SUCCESS(bs->get_memory_map(&map_size, map, &map_key, &descriptor_size,
+                                   &version));
+  CHECK_SUCCESS(bs->exit_boot_services(fw->image_handle(), map_key));
+
+  CHECK((log == std::vector<int>{1}));
+  CHECK(!bus.subscribed(EventGroupExitBootServices));
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto  fw = mock::Firmware{};
+  auto* bs = fw.boot_services();
+
+  test_publish(bs);
+  test_stale_id(bs);
+  test_exit_boot_services(&fw, bs);
+
+  return test::check_result();
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include "check.hpp"
+#include "efi/event_set.hpp"
+#include "efi/mock/firmware.hpp"
+
+using namespace efi;
+
+namespace {
+
+auto create(BootServices* bs) -> Event {
+  auto event = Event{};
+  CHECK_SUCCESS(bs->create_event(EventType{0}, TplCallback, nullptr, nullptr,
+                                 &event));
+  return event;
+}
+
+struct Swap {
+  EventSet*    set;
+  EventSet::Id old_id;
+  EventSet::Id new_id;
+  Event        new_event;
+  int          new_runs;
+};
+
+void count(Event /*event*/, void* context) noexcept {
+  ++*static_cast<int*>(context);
+}
+
+// Replaces the other entry, which takes over its slot
+void swap(Event /*event*/, void* context) noexcept {
+  auto& swap = *static_cast<Swap*>(context);
+  CHECK_SUCCESS(swap.set->remove(swap.old_id));
+  CHECK_SUCCESS(
+      swap.set->add(swap.new_event, &count, &swap.new_runs, &swap.new_id));
+}
+
+void test_reused_slot(BootServices* bs) {
+  // Sweeps on every dispatch
+  auto set = EventSet{bs, 0};
+
+  auto old_runs = 0;
+  auto first    = create(bs);
+  auto second   = create(bs);
+  auto state    = Swap{&set, 0, 0, create(bs), 0};
+
+  auto first_id = EventSet::Id{0};
+  CHECK_SUCCESS(set.add(first, &swap, &state, &first_id));
+  CHECK_SUCCESS(set.add(second, &count, &old_runs, &state.old_id));
+
+  CHECK_SUCCESS(bs->signal_event(first));
+  CHECK_SUCCESS(bs->signal_event(second));
+  CHECK_SUCCESS(set.dispatch());
+
+  // The new entry only runs for its own event
+  CHECK(old_runs == 0);
+  CHECK(state.new_runs == 0);
+  CHECK(state.new_id != state.old_id);
+
+  // A stale id does not reach the new entry
+  CHECK(!set.contains(state.old_id));
+  CHECK(set.remove(state.old_id) == Status::NotFound);
+  CHECK(set.contains(state.new_id));
+
+  CHECK_SUCCESS(set.remove(first_id));
+  CHECK_SUCCESS(bs->signal_event(state.new_event));
+  CHECK_SUCCESS(set.dispatch());
+  CHECK(state.new_runs == 1);
+
+  CHECK_SUCCESS(bs->close_event(first));
+  CHECK_SUCCESS(bs->close_event(second));
+  CHECK_SUCCESS(bs->close_event(state.new_event));
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto fw = mock::Firmware{};
+
+  test_reused_slot(fw.boot_services());
+
+  return test::check_result();
+}
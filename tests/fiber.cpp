@@ -0,0 +1,70 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include "check.hpp"
+#include "efi/fiber.hpp"
+#include "efi/mock/firmware.hpp"
+
+using namespace efi;
+
+namespace {
+
+struct Shared {
+  BootServices* boot_services;
+  Event         event;
+  Status        first;
+  Status        second;
+};
+
+void wait_first(FiberScheduler* scheduler, void* context) noexcept {
+  auto& shared = *static_cast<Shared*>(context);
+  shared.first = scheduler->wait(shared.event);
+}
+
+// Runs once the first fiber waits, then signals for it
+void wait_second(FiberScheduler* scheduler, void* context) noexcept {
+  auto& shared  = *static_cast<Shared*>(context);
+  shared.second = scheduler->wait(shared.event);
+  shared.boot_services->signal_event(shared.event);
+}
+
+// A second waiter on an event is turned away instead of never waking
+void test_duplicate_wait(BootServices* bs) {
+  auto shared = Shared{bs, nullptr, Status::NotReady, Status::NotReady};
+  CHECK_SUCCESS(bs->create_event(EventType{0}, TplCallback, nullptr, nullptr,
+                                 &shared.event));
+
+  auto scheduler = FiberScheduler{bs};
+  auto first     = Fiber{&wait_first, &shared};
+  auto second    = Fiber{&wait_second, &shared};
+  CHECK_SUCCESS(scheduler.spawn(&first));
+  CHECK_SUCCESS(scheduler.spawn(&second));
+  CHECK_SUCCESS(scheduler.run());
+
+  CHECK(first.done() && second.done());
+  CHECK(shared.first == Status::Success);
+  CHECK(shared.second == Status::AccessDenied);
+  CHECK_SUCCESS(bs->close_event(shared.event));
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto fw = mock::Firmware{};
+
+  test_duplicate_wait(fw.boot_services());
+
+  return test::check_result();
+}
@@ -0,0 +1,197 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "check.hpp"
+#include "efi/handle_snapshot.hpp"
+#include "efi/mock/firmware.hpp"
+#include "efi/protocol/file_system.hpp"
+
+using namespace efi;
+
+namespace {
+
+constexpr auto protocol_a =
+    Guid{0x0c8b7a4e,
+         0x2f61,
+         0x4d1a,
+         {0x8e, 0x35, 0x71, 0x0d, 0x9c, 0x42, 0xa6, 0x13}};
+
+constexpr auto protocol_b =
+    Guid{0x6e2d94f0,
+         0x5b17,
+         0x4c83,
+         {0xb1, 0x4a, 0x2e, 0x96, 0x07, 0xd8, 0x3f, 0x5c}};
+
+constexpr auto protocol_unknown =
+    Guid{0xa3f1c6d2,
+         0x08e4,
+         0x47b9,
+         {0x93, 0x6c, 0x5d, 0x21, 0xf8, 0x0a, 0x7e, 0x44}};
+
+auto interface_a = 1;
+auto interface_b = 2;
+
+auto contains(const HandleSnapshot& snapshot,
+              const HandleSnapshot::HandleSet& set, Handle handle) -> bool {
+  Handle     buffer[HandleSnapshot::max_handles];
+  const auto count =
+      snapshot.handles(set, buffer, HandleSnapshot::max_handles);
+  for (auto i = uintn_t{0}; i < count; ++i) {
+    if (buffer[i] == handle) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// first has a, second has a and b, third has b
+struct Handles {
+  BootServices* bs;
+  Handle        first  = nullptr;
+  Handle        second = nullptr;
+  Handle        third  = nullptr;
+
+  explicit Handles(BootServices* boot_services) : bs{boot_services} {
+    CHECK_SUCCESS(
+        bs->install_protocol_interface(&first, protocol_a, &interface_a));
+    CHECK_SUCCESS(
+        bs->install_protocol_interface(&second, protocol_a, &interface_a));
+    CHECK_SUCCESS(
+        bs->install_protocol_interface(&second, protocol_b, &interface_b));
+    CHECK_SUCCESS(
+        bs->install_protocol_interface(&third, protocol_b, &interface_b));
+  }
+
+  ~Handles() {
+    bs->uninstall_protocol_interface(first, protocol_a, &interface_a);
+    bs->uninstall_protocol_interface(second, protocol_a, &interface_a);
+    bs->uninstall_protocol_interface(second, protocol_b, &interface_b);
+    bs->uninstall_protocol_interface(third, protocol_b, &interface_b);
+  }
+};
+
+void test_refresh(BootServices* bs) {
+  auto handles  = Handles{bs};
+  auto snapshot = HandleSnapshot{bs};
+
+  CHECK_SUCCESS(snapshot.refresh());
+  CHECK(snapshot.stats().refreshes == 1);
+  CHECK(snapshot.stats().dropped == 0);
+  CHECK(contains(snapshot, snapshot.all(), handles.first));
+  CHECK(contains(snapshot, snapshot.all(), handles.second));
+  CHECK(contains(snapshot, snapshot.all(), handles.third));
+
+  const auto a = snapshot.query({protocol_a});
+  CHECK(a.count() == 2);
+  CHECK(contains(snapshot, a, handles.first));
+  CHECK(contains(snapshot, a, handles.second));
+
+  const auto b = snapshot.query({protocol_b});
+  CHECK(b.count() == 2);
+  CHECK(contains(snapshot, b, handles.second));
+  CHECK(contains(snapshot, b, handles.third));
+
+  const auto both = snapshot.query({protocol_a, protocol_b});
+  CHECK(both.count() == 1);
+  CHECK(snapshot.handle(both.next(0)) == handles.second);
+
+  CHECK(snapshot.query({protocol_a, protocol_unknown}).empty());
+
+  // A second refresh rebuilds the same sets
+  CHECK_SUCCESS(snapshot.refresh());
+  CHECK(snapshot.stats().refreshes == 2);
+  CHECK(snapshot.query({protocol_a, protocol_b}).count() == 1);
+}
+
+void test_watch(mock::Firmware& fw) {
+  auto* bs       = fw.boot_services();
+  auto  snapshot = HandleSnapshot{bs};
+
+  CHECK_SUCCESS(snapshot.refresh());
+  CHECK_SUCCESS(snapshot.watch(SimpleFileSystemProtocol::guid));
+  CHECK(snapshot.update() == 0);
+
+  const auto before = snapshot.query({SimpleFileSystemProtocol::guid});
+
+  Handle file_system = nullptr;
+  CHECK_SUCCESS(fw.add_file_system(&file_system));
+
+  // Not seen until update
+  CHECK(!contains(snapshot, snapshot.all(), file_system));
+
+  CHECK(snapshot.update() == 1);
+  CHECK(snapshot.update() == 0);
+
+  const auto after = snapshot.query({SimpleFileSystemProtocol::guid});
+  CHECK(after.count() == before.count() + 1);
+  CHECK(contains(snapshot, after, file_system));
+}
+
+void test_rescan(BootServices* bs) {
+  auto handles  = Handles{bs};
+  auto snapshot = HandleSnapshot{bs};
+
+  CHECK_SUCCESS(snapshot.refresh());
+  const auto live = snapshot.all().count();
+
+  // Uninstalls are not notified, the snapshot keeps them until a rescan
+  CHECK_SUCCESS(bs->uninstall_protocol_interface(handles.second, protocol_b,
+                                                 &interface_b));
+  CHECK(snapshot.query({protocol_a, protocol_b}).count() == 1);
+
+  CHECK_SUCCESS(snapshot.rescan(handles.second));
+  CHECK(snapshot.query({protocol_a, protocol_b}).empty());
+  CHECK(contains(snapshot, snapshot.query({protocol_a}), handles.second));
+  CHECK(snapshot.all().count() == live);
+
+  // Removing the last interface frees the handle
+  CHECK_SUCCESS(bs->uninstall_protocol_interface(handles.first, protocol_a,
+                                                 &interface_a));
+  CHECK(contains(snapshot, snapshot.all(), handles.first));
+
+  CHECK(snapshot.rescan(handles.first) != Status::Success);
+  CHECK(!contains(snapshot, snapshot.all(), handles.first));
+  CHECK(snapshot.all().count() == live - 1);
+
+  const auto a = snapshot.query({protocol_a});
+  CHECK(a.count() == 1);
+  CHECK(contains(snapshot, a, handles.second));
+
+  // The freed row is reused
+  auto fourth = Handle{};
+  CHECK_SUCCESS(
+      bs->install_protocol_interface(&fourth, protocol_b, &interface_b));
+  CHECK_SUCCESS(snapshot.rescan(fourth));
+  CHECK(snapshot.all().count() == live);
+  CHECK(snapshot.query({protocol_b}).count() == 2);
+
+  CHECK_SUCCESS(
+      bs->uninstall_protocol_interface(fourth, protocol_b, &interface_b));
+  // Already freed above
+  handles.first = nullptr;
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto fw = mock::Firmware{};
+
+  test_refresh(fw.boot_services());
+  test_watch(fw);
+  test_rescan(fw.boot_services());
+
+  return test::check_result();
+}
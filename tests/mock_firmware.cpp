@@ -0,0 +1,179 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <vector>
+
+#include "check.hpp"
+#include "efi/crc32.hpp"
+#include "efi/memory_map.hpp"
+#include "efi/mock/firmware.hpp"
+#include "efi/protocol/file_system.hpp"
+
+using namespace efi;
+
+namespace {
+
+void test_memory_map(BootServices* bs) {
+  auto map_size        = uintn_t{0};
+  auto map_key         = uintn_t{0};
+  auto descriptor_size = uintn_t{0};
+  auto version         = uint32_t{0};
+  CHECK(bs->get_memory_map(&map_size, nullptr, &map_key, &descriptor_size,
+                           &version) == Status::BufferTooSmall);
+  CHECK(descriptor_size > sizeof(MemoryDescriptor));
+
+  auto buffer = std::vector<uint8_t>(map_size + 4 * descriptor_size);
+  map_size    = buffer.size();
+  auto* map   = reinterpret_cast<MemoryDescriptor*>(buffer.data());
+  CHECK_SUCCESS(bs->get_memory_map(&map_size, map, &map_key, &descriptor_size,
+                                   &version));
+
+  const auto view = MemoryMapView{map, map_size, descriptor_size};
+  CHECK(!view.empty());
+  CHECK(view.is_sorted());
+  CHECK(view.pages(MemoryType::ConventionalMemory) > 0);
+
+  // Allocating pages changes the map and its key
+  auto address = PhysicalAddress{0};
+  CHECK_SUCCESS(bs->allocate_pages(AllocateType::AnyPages,
+                                   MemoryType::LoaderData, 4, &address));
+  CHECK(view.find(address) != nullptr);
+
+  auto new_key = uintn_t{0};
+  map_size     = buffer.size();
+  CHECK_SUCCESS(bs->get_memory_map(&map_size, map, &new_key, &descriptor_size,
+                                   &version));
+  CHECK(new_key != map_key);
+  CHECK_SUCCESS(bs->free_pages(address, 4));
+}
+
+auto notified = 0;
+
+EFI_CALL void count_notify(Event /*event*/, void* context) noexcept {
+  ++*static_cast<int*>(context);
+}
+
+void test_events(BootServices* bs) {
+  auto event = Event{};
+  CHECK_SUCCESS(bs->create_event(EventType::NotifySignal, TplCallback,
+                                 &count_notify, &notified, &event));
+  CHECK_SUCCESS(bs->signal_event(event));
+  CHECK(notified == 1);
+  CHECK_SUCCESS(bs->close_event(event));
+
+  auto timer = Event{};
+  CHECK_SUCCESS(bs->create_event(EventType::Timer, TplCallback, nullptr,
+                                 nullptr, &timer));
+  CHECK(bs->check_event(timer) == Status::NotReady);
+  CHECK_SUCCESS(bs->set_timer(timer, TimerDelay::Relative, 1000));
+
+  auto index = uintn_t{1};
+  CHECK_SUCCESS(bs->wait_for_events(1, &timer, &index));
+  CHECK(index == 0);
+  CHECK_SUCCESS(bs->close_event(timer));
+}
+
+void test_protocols(mock::Firmware* fw, BootServices* bs) {
+  const auto& guid = SimpleFileSystemProtocol::guid;
+
+  auto event = Event{};
+  CHECK_SUCCESS(bs->create_event(EventType::NotifySignal, TplCallback,
+                                 &count_notify, &notified, &event));
+  auto* registration = static_cast<void*>(nullptr);
+  CHECK_SUCCESS(bs->register_protocol_notify(guid, event, &registration));
+
+  auto handle = Handle{};
+  CHECK_SUCCESS(fw->add_file_system(&handle));
+
+  auto* file_system = static_cast<SimpleFileSystemProtocol*>(nullptr);
+  CHECK_SUCCESS(bs->locate_protocol(&file_system));
+  CHECK(file_system != nullptr);
+  CHECK_SUCCESS(bs->handle_protocol(handle, &file_system));
+
+  auto  count   = uintn_t{0};
+  auto* handles = static_cast<Handle*>(nullptr);
+  CHECK_SUCCESS(bs->locate_handle_buffer<SimpleFileSystemProtocol>(&count,
+                                                                   &handles));
+  CHECK(count == 1 && handles[0] == handle);
+  CHECK_SUCCESS(bs->free_pool(handles));
+
+  // A size query must not consume the notification
+  auto size = uintn_t{0};
+  CHECK(bs->locate_handle(LocateSearchType::ByRegisterNotify, guid,
+                          registration, &size,
+                          nullptr) == Status::BufferTooSmall);
+  CHECK(size == sizeof(Handle));
+
+  auto found = Handle{};
+  CHECK_SUCCESS(bs->locate_handle(LocateSearchType::ByRegisterNotify, guid,
+                                  registration, &size, &found));
+  CHECK(found == handle);
+  CHECK(bs->locate_handle(LocateSearchType::ByRegisterNotify, guid,
+                          registration, &size,
+                          &found) == Status::NotFound);
+  CHECK_SUCCESS(bs->close_event(event));
+}
+
+EFI_CALL void close_self(Event event, void* context) noexcept {
+  static_cast<BootServices*>(context)->close_event(event);
+}
+
+// Leaves boot services, so it runs last
+void test_exit_boot_services(mock::Firmware* fw, BootServices* bs) {
+  auto* system_table = fw->system_table();
+  CHECK_SUCCESS(verify_tables(system_table));
+
+  // A notify closing its own event must not stop the ones after it
+  auto closing = Event{};
+  auto counted = Event{};
+  CHECK_SUCCESS(bs->create_event_ex(EventType::NotifySignal, TplCallback,
+                                    &close_self, bs,
+                                    &EventGroupExitBootServices, &closing));
+  CHECK_SUCCESS(bs->create_event_ex(EventType::NotifySignal, TplCallback,
+                                    &count_notify, &notified,
+                                    &EventGroupExitBootServices, &counted));
+  const auto before = notified;
+
+  auto map_size        = uintn_t{0};
+  auto map_key         = uintn_t{0};
+  auto descriptor_size = uintn_t{0};
+  auto version         = uint32_t{0};
+  bs->get_memory_map(&map_size, nullptr, &map_key, &descriptor_size,
+                     &version);
+
+  auto buffer = std::vector<uint8_t>(map_size);
+  auto* map   = reinterpret_cast<MemoryDescriptor*>(buffer.data());
+  CHECK_SUCCESS(bs->get_memory_map(&map_size, map, &map_key, &descriptor_size,
+                                   &version));
+  CHECK_SUCCESS(bs->exit_boot_services(fw->image_handle(), map_key));
+
+  CHECK(system_table->boot_services() == nullptr);
+  CHECK_SUCCESS(verify_tables(system_table));
+  CHECK(notified == before + 1);
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto  fw = mock::Firmware{};
+  auto* bs = fw.boot_services();
+
+  test_memory_map(bs);
+  test_events(bs);
+  test_protocols(&fw, bs);
+  test_exit_boot_services(&fw, bs);
+
+  return test::check_result();
+}
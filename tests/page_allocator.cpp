@@ -0,0 +1,151 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <vector>
+
+#include "check.hpp"
+#include "efi/mock/firmware.hpp"
+#include "efi/page_allocator.hpp"
+
+using namespace efi;
+
+namespace {
+
+// Leaves count single page ConventionalMemory ranges, separated by runtime
+// pages that the allocator does not manage
+void fragment(BootServices* bs, uintn_t count) {
+  auto pages = std::vector<PhysicalAddress>(count * 2);
+  for (auto& page : pages) {
+    CHECK_SUCCESS(bs->allocate_pages(AllocateType::AnyPages,
+                                     MemoryType::RuntimeServicesData, 1,
+                                     &page));
+  }
+  for (auto i = uintn_t{0}; i < pages.size(); i += 2) {
+    CHECK_SUCCESS(bs->free_pages(pages[i], 1));
+  }
+}
+
+auto memory_map(BootServices* bs, std::vector<uint8_t>* buffer)
+    -> MemoryMapView {
+  auto map_size        = uintn_t{0};
+  auto map_key         = uintn_t{0};
+  auto descriptor_size = uintn_t{0};
+  auto version         = uint32_t{0};
+  bs->get_memory_map(&map_size, nullptr, &map_key, &descriptor_size,
+                     &version);
+
+  buffer->resize(map_size + 4 * descriptor_size);
+  map_size  = buffer->size();
+  auto* map = reinterpret_cast<MemoryDescriptor*>(buffer->data());
+  CHECK_SUCCESS(bs->get_memory_map(&map_size, map, &map_key,
+                                   &descriptor_size, &version));
+  return MemoryMapView{map, map_size, descriptor_size};
+}
+
+void test_zone_overflow(BootServices* bs) {
+  fragment(bs, PageAllocator::max_zones + 6);
+
+  auto       buffer = std::vector<uint8_t>{};
+  const auto map    = memory_map(bs, &buffer);
+
+  auto allocator = PageAllocator{};
+  CHECK_SUCCESS(allocator.seed(map, false));
+
+  const auto& stats = allocator.stats();
+  CHECK(stats.dropped_pages > 0);
+  CHECK(stats.free_pages == stats.total_pages);
+
+  // Every page handed out lies in a free range of the map
+  auto allocated = std::vector<PhysicalAddress>{};
+  auto address   = PhysicalAddress{0};
+  while (allocator.allocate(0, &address) == Status::Success) {
+    const auto* descriptor = map.find(address);
+    CHECK(descriptor != nullptr &&
+          descriptor->type() == MemoryType::ConventionalMemory);
+    allocated.push_back(address);
+  }
+  CHECK(allocated.size() == stats.total_pages);
+  CHECK(stats.free_pages == 0);
+
+  for (const auto page : allocated) {
+    CHECK_SUCCESS(allocator.free(page));
+  }
+  CHECK(stats.free_pages == stats.total_pages);
+}
+
+// Loader pages start allocated and are handed over once
+void test_reclaim(BootServices* bs) {
+  constexpr auto loader_pages = uint64_t{3};
+
+  auto loader = PhysicalAddress{0};
+  CHECK_SUCCESS(bs->allocate_pages(AllocateType::AnyPages,
+                                   MemoryType::LoaderData, loader_pages,
+                                   &loader));
+
+  auto       buffer = std::vector<uint8_t>{};
+  const auto map    = memory_map(bs, &buffer);
+
+  auto allocator = PageAllocator{};
+  CHECK_SUCCESS(allocator.seed(map, false));
+
+  const auto& stats = allocator.stats();
+  const auto  total = stats.total_pages;
+  CHECK_SUCCESS(allocator.reclaim(loader, loader_pages));
+  CHECK(stats.total_pages == total + loader_pages);
+  CHECK(stats.free_pages == stats.total_pages);
+
+  // Already free pages must not be released a second time
+  CHECK(allocator.reclaim(loader, loader_pages) == Status::InvalidParameter);
+  CHECK(allocator.reclaim(loader + page_size, 1) == Status::InvalidParameter);
+  CHECK(stats.total_pages == total + loader_pages);
+
+  // Neither may pages that were seeded free or handed out
+  const MemoryDescriptor* largest = nullptr;
+  for (const auto& descriptor : map) {
+    if (descriptor.type() == MemoryType::ConventionalMemory &&
+        (largest == nullptr ||
+         descriptor.number_of_pages() > largest->number_of_pages())) {
+      largest = &descriptor;
+    }
+  }
+  CHECK(largest != nullptr);
+  CHECK(allocator.reclaim(largest->physical_end() - page_size, 1) ==
+        Status::InvalidParameter);
+
+  auto address = PhysicalAddress{0};
+  CHECK_SUCCESS(allocator.allocate(2, &address));
+  CHECK(allocator.reclaim(address, 1) == Status::InvalidParameter);
+  CHECK(allocator.reclaim(address + page_size, 1) ==
+        Status::InvalidParameter);
+  CHECK_SUCCESS(allocator.free(address));
+
+  // The page state is carved from the start of the largest free range
+  const auto state = largest->physical_start() != 0
+                         ? largest->physical_start()
+                         : PhysicalAddress{page_size};
+  CHECK(allocator.reclaim(state, 1) == Status::InvalidParameter);
+  CHECK(stats.free_pages == stats.total_pages);
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto fw = mock::Firmware{};
+
+  test_zone_overflow(fw.boot_services());
+  test_reclaim(fw.boot_services());
+
+  return test::check_result();
+}
@@ -0,0 +1,137 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include "check.hpp"
+#include "efi/poll_scheduler.hpp"
+
+using namespace efi;
+
+namespace {
+
+constexpr auto max_interval  = uint64_t{8};
+constexpr auto busy_interval = uint64_t{2};
+
+// Answers every poll with result
+struct FakeProtocol {
+  Status   result = Status::NotReady;
+  uint64_t polls  = 0;
+
+  auto poll() noexcept -> Status {
+    polls++;
+    return result;
+  }
+};
+
+// Runs rounds until protocol was polled once more, returns the rounds taken
+auto run_until_polled(PollScheduler* scheduler, const FakeProtocol& protocol)
+    -> uint64_t {
+  const auto polls  = protocol.polls;
+  auto       rounds = uint64_t{0};
+  while (protocol.polls == polls && rounds <= max_interval) {
+    scheduler->run();
+    rounds++;
+  }
+  return rounds;
+}
+
+void test_backoff() {
+  auto scheduler = PollScheduler{max_interval, busy_interval};
+  auto protocol  = FakeProtocol{};
+  auto id        = PollScheduler::Id{0};
+  CHECK_SUCCESS(scheduler.add(&protocol, &id));
+
+  // Idle polls double the interval up to max_interval
+  CHECK(run_until_polled(&scheduler, protocol) == 1);
+  CHECK(scheduler.interval(id) == 2);
+  CHECK(run_until_polled(&scheduler, protocol) == 2);
+  CHECK(scheduler.interval(id) == 4);
+  CHECK(run_until_polled(&scheduler, protocol) == 4);
+  CHECK(scheduler.interval(id) == 8);
+  CHECK(run_until_polled(&scheduler, protocol) == 8);
+  CHECK(scheduler.interval(id) == max_interval);
+
+  // Work brings it back to every round
+  protocol.result = Status::Success;
+  run_until_polled(&scheduler, protocol);
+  CHECK(scheduler.interval(id) == 1);
+  CHECK(scheduler.next_due() == 0);
+  CHECK(scheduler.run() == 1);
+
+  CHECK(scheduler.stats(id).polls == 6);
+  CHECK(scheduler.stats(id).productive == 2);
+  CHECK(scheduler.stats().polls == 6);
+  CHECK(scheduler.stats().productive == 2);
+}
+
+// Outstanding tokens cap the interval at busy_interval
+void test_busy() {
+  auto scheduler = PollScheduler{max_interval, busy_interval};
+  auto protocol  = FakeProtocol{};
+  auto id        = PollScheduler::Id{0};
+  CHECK_SUCCESS(scheduler.add(&protocol, &id));
+  for (auto i = 0; i < 4; ++i) {
+    run_until_polled(&scheduler, protocol);
+  }
+  CHECK(scheduler.interval(id) == max_interval);
+
+  CHECK_SUCCESS(scheduler.expect(id));
+  CHECK(scheduler.interval(id) == busy_interval);
+  CHECK(scheduler.next_due() == 0);
+  for (auto i = 0; i < 4; ++i) {
+    CHECK(run_until_polled(&scheduler, protocol) <= busy_interval);
+    CHECK(scheduler.interval(id) == busy_interval);
+  }
+
+  // Once the token completed the backoff resumes
+  CHECK_SUCCESS(scheduler.complete(id));
+  run_until_polled(&scheduler, protocol);
+  run_until_polled(&scheduler, protocol);
+  CHECK(scheduler.interval(id) == max_interval);
+}
+
+// A stale id must not reach the instance reusing its slot
+void test_stale_id() {
+  auto scheduler    = PollScheduler{max_interval, busy_interval};
+  auto old_protocol = FakeProtocol{};
+  auto new_protocol = FakeProtocol{};
+  auto old_id       = PollScheduler::Id{0};
+  auto new_id       = PollScheduler::Id{0};
+  CHECK_SUCCESS(scheduler.add(&old_protocol, &old_id));
+  CHECK_SUCCESS(scheduler.remove(old_id));
+  CHECK_SUCCESS(scheduler.add(&new_protocol, &new_id));
+
+  CHECK(new_id != old_id);
+  CHECK(!scheduler.contains(old_id));
+  CHECK(scheduler.expect(old_id) == Status::NotFound);
+  CHECK(scheduler.complete(old_id) == Status::NotFound);
+  CHECK(scheduler.remove(old_id) == Status::NotFound);
+
+  // Not pinned to busy_interval by the stale expect
+  for (auto i = 0; i < 4; ++i) {
+    run_until_polled(&scheduler, new_protocol);
+  }
+  CHECK(scheduler.interval(new_id) == max_interval);
+  CHECK(old_protocol.polls == 0);
+}
+
+}  // namespace
+
+auto main() -> int {
+  test_backoff();
+  test_busy();
+  test_stale_id();
+
+  return test::check_result();
+}
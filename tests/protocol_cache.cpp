@@ -0,0 +1,206 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "check.hpp"
+#include "efi/mock/firmware.hpp"
+#include "efi/protocol_cache.hpp"
+
+using namespace efi;
+
+namespace {
+
+constexpr auto protocol_a =
+    Guid{0x3b6f0d2a,
+         0x91c4,
+         0x4e57,
+         {0xa8, 0x1e, 0x64, 0x0f, 0xd3, 0x29, 0x7b, 0xc5}};
+
+constexpr auto protocol_b =
+    Guid{0xd17e5c93,
+         0x4a08,
+         0x4b2f,
+         {0x86, 0xd4, 0x1a, 0x5b, 0xe2, 0x70, 0x0c, 0x98}};
+
+constexpr auto protocol_unknown =
+    Guid{0x58a2e4f7,
+         0x0d3b,
+         0x4f61,
+         {0x9c, 0x27, 0xb5, 0x4e, 0x81, 0x16, 0xda, 0x03}};
+
+auto interface_a = 1;
+auto interface_b = 2;
+auto interface_c = 3;
+
+// Looks protocol up on handle, or locates it under a null handle, and checks
+// the result
+void expect(ProtocolCache& cache, Handle handle, const Guid& protocol,
+            const void* expected) {
+  void* interface = nullptr;
+  if (handle != nullptr) {
+    CHECK_SUCCESS(cache.handle_protocol(handle, protocol, &interface));
+  } else {
+    CHECK_SUCCESS(cache.locate_protocol(protocol, &interface));
+  }
+  CHECK(interface == expected);
+}
+
+void test_hits(BootServices* bs) {
+  auto handle = Handle{};
+  CHECK_SUCCESS(
+      bs->install_protocol_interface(&handle, protocol_a, &interface_a));
+
+  auto cache = ProtocolCache{bs};
+
+  expect(cache, handle, protocol_a, &interface_a);
+  CHECK(cache.stats().hits == 0);
+  CHECK(cache.stats().misses == 1);
+
+  expect(cache, handle, protocol_a, &interface_a);
+  expect(cache, handle, protocol_a, &interface_a);
+  CHECK(cache.stats().hits == 2);
+  CHECK(cache.stats().misses == 1);
+
+  // locate_protocol is cached apart from handle_protocol
+  expect(cache, nullptr, protocol_a, &interface_a);
+  expect(cache, nullptr, protocol_a, &interface_a);
+  CHECK(cache.stats().hits == 3);
+  CHECK(cache.stats().misses == 2);
+
+  // Failures are not cached
+  void* interface = nullptr;
+  CHECK(cache.handle_protocol(handle, protocol_unknown, &interface) !=
+        Status::Success);
+  CHECK(cache.handle_protocol(handle, protocol_unknown, &interface) !=
+        Status::Success);
+  CHECK(cache.stats().misses == 4);
+
+  CHECK(cache.handle_protocol(nullptr, protocol_a, &interface) ==
+        Status::InvalidParameter);
+  CHECK(cache.locate_protocol(protocol_a, nullptr) ==
+        Status::InvalidParameter);
+  CHECK(cache.stats().hits == 3);
+  CHECK(cache.stats().misses == 4);
+  CHECK(cache.stats().invalidations == 0);
+
+  CHECK_SUCCESS(
+      bs->uninstall_protocol_interface(handle, protocol_a, &interface_a));
+}
+
+void test_notify(BootServices* bs) {
+  auto handle = Handle{};
+  CHECK_SUCCESS(
+      bs->install_protocol_interface(&handle, protocol_a, &interface_a));
+  CHECK_SUCCESS(
+      bs->install_protocol_interface(&handle, protocol_b, &interface_b));
+
+  auto cache = ProtocolCache{bs};
+
+  expect(cache, handle, protocol_a, &interface_a);
+  expect(cache, handle, protocol_b, &interface_b);
+  expect(cache, nullptr, protocol_a, &interface_a);
+  expect(cache, handle, protocol_a, &interface_a);
+  CHECK(cache.stats().hits == 1);
+  CHECK(cache.stats().misses == 3);
+
+  // Another instance of a anywhere drops both entries of a, not b
+  auto other = Handle{};
+  CHECK_SUCCESS(
+      bs->install_protocol_interface(&other, protocol_a, &interface_c));
+
+  expect(cache, handle, protocol_a, &interface_a);
+  CHECK(cache.stats().misses == 4);
+  CHECK(cache.stats().invalidations == 2);
+
+  expect(cache, handle, protocol_b, &interface_b);
+  expect(cache, handle, protocol_a, &interface_a);
+  CHECK(cache.stats().hits == 3);
+  CHECK(cache.stats().misses == 4);
+
+  expect(cache, other, protocol_a, &interface_c);
+  CHECK(cache.stats().misses == 5);
+
+  CHECK_SUCCESS(
+      bs->uninstall_protocol_interface(other, protocol_a, &interface_c));
+  CHECK_SUCCESS(
+      bs->uninstall_protocol_interface(handle, protocol_b, &interface_b));
+  CHECK_SUCCESS(
+      bs->uninstall_protocol_interface(handle, protocol_a, &interface_a));
+}
+
+void test_invalidate(BootServices* bs) {
+  auto first  = Handle{};
+  auto second = Handle{};
+  CHECK_SUCCESS(
+      bs->install_protocol_interface(&first, protocol_a, &interface_a));
+  CHECK_SUCCESS(
+      bs->install_protocol_interface(&first, protocol_b, &interface_b));
+  CHECK_SUCCESS(
+      bs->install_protocol_interface(&second, protocol_b, &interface_c));
+
+  auto cache = ProtocolCache{bs};
+
+  expect(cache, first, protocol_a, &interface_a);
+  expect(cache, first, protocol_b, &interface_b);
+  expect(cache, second, protocol_b, &interface_c);
+  expect(cache, nullptr, protocol_a, &interface_a);
+  CHECK(cache.stats().misses == 4);
+
+  // Only the entries of first
+  cache.invalidate(first);
+  CHECK(cache.stats().invalidations == 2);
+
+  expect(cache, second, protocol_b, &interface_c);
+  expect(cache, nullptr, protocol_a, &interface_a);
+  CHECK(cache.stats().hits == 2);
+
+  expect(cache, first, protocol_a, &interface_a);
+  expect(cache, first, protocol_b, &interface_b);
+  CHECK(cache.stats().misses == 6);
+
+  // Only the entries of b, on every handle
+  cache.invalidate(protocol_b);
+  CHECK(cache.stats().invalidations == 4);
+
+  expect(cache, first, protocol_a, &interface_a);
+  expect(cache, nullptr, protocol_a, &interface_a);
+  CHECK(cache.stats().hits == 4);
+
+  expect(cache, first, protocol_b, &interface_b);
+  expect(cache, second, protocol_b, &interface_c);
+  CHECK(cache.stats().misses == 8);
+
+  cache.clear();
+  CHECK(cache.stats().invalidations == 8);
+
+  CHECK_SUCCESS(
+      bs->uninstall_protocol_interface(second, protocol_b, &interface_c));
+  CHECK_SUCCESS(
+      bs->uninstall_protocol_interface(first, protocol_b, &interface_b));
+  CHECK_SUCCESS(
+      bs->uninstall_protocol_interface(first, protocol_a, &interface_a));
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto fw = mock::Firmware{};
+
+  test_hits(fw.boot_services());
+  test_notify(fw.boot_services());
+  test_invalidate(fw.boot_services());
+
+  return test::check_result();
+}
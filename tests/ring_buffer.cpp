@@ -0,0 +1,128 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "efi/ring_buffer.hpp"
+
+using namespace efi;
+
+namespace {
+
+// Host threads stand in for notify functions preempting the main loop. The
+// consumer runs on the main thread, which is the only one calling CHECK.
+
+constexpr auto capacity  = uintn_t{256};
+constexpr auto messages  = uint64_t{1} << 18;
+constexpr auto producers = uint64_t{4};
+
+template <typename Ring>
+void test_full_and_empty(Ring* ring) {
+  auto value = uint64_t{0};
+  CHECK(!ring->pop(&value));
+
+  for (auto i = uint64_t{0}; i < capacity; ++i) {
+    CHECK(ring->push(i));
+  }
+  CHECK(!ring->push(capacity));
+  CHECK(ring->dropped() == 1);
+  CHECK(ring->size() == capacity);
+
+  for (auto i = uint64_t{0}; i < capacity; ++i) {
+    CHECK(ring->pop(&value) && value == i);
+  }
+  CHECK(!ring->pop(&value));
+  CHECK(ring->empty());
+}
+
+// Retries until the consumer makes room
+template <typename Ring>
+void push_all(Ring* ring, uint64_t tag, uint64_t count) {
+  for (auto i = uint64_t{0}; i < count; ++i) {
+    while (!ring->push(tag | i)) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void test_spsc() {
+  static auto ring = SpscRing<uint64_t, capacity>{};
+  test_full_and_empty(&ring);
+
+  auto producer = std::thread{[] { push_all(&ring, 0, messages); }};
+
+  auto expected = uint64_t{0};
+  auto value    = uint64_t{0};
+  auto in_order = true;
+  while (expected < messages) {
+    if (ring.pop(&value)) {
+      in_order = in_order && value == expected;
+      ++expected;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+
+  CHECK(in_order);
+  CHECK(ring.empty());
+}
+
+void test_mpsc() {
+  static auto ring = MpscRing<uint64_t, capacity>{};
+  test_full_and_empty(&ring);
+
+  // The producer id goes in the high half, each producer's own messages
+  // must arrive in order
+  auto threads = std::vector<std::thread>{};
+  for (auto id = uint64_t{0}; id < producers; ++id) {
+    threads.emplace_back([id] { push_all(&ring, id << 32, messages); });
+  }
+
+  auto next     = std::vector<uint64_t>(producers);
+  auto received = uint64_t{0};
+  auto value    = uint64_t{0};
+  auto in_order = true;
+  while (received < producers * messages) {
+    if (ring.pop(&value)) {
+      auto& expected = next[value >> 32];
+      in_order       = in_order && (value & 0xffff'ffff) == expected;
+      ++expected;
+      ++received;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  CHECK(in_order);
+  CHECK(ring.empty());
+  for (const auto count : next) {
+    CHECK(count == messages);
+  }
+}
+
+}  // namespace
+
+auto main() -> int {
+  test_spsc();
+  test_mpsc();
+
+  return test::check_result();
+}
@@ -0,0 +1,140 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include "check.hpp"
+#include "efi/mock/firmware.hpp"
+#include "efi/task.hpp"
+
+using namespace efi;
+
+namespace {
+
+// 100us in 100ns units
+constexpr auto short_delay = uint64_t{1'000};
+
+struct Token {
+  Event  event_  = nullptr;
+  Status status_ = Status::NotReady;
+
+  NODISCARD auto event() const noexcept {
+    return event_;
+  }
+
+  NODISCARD auto status() const noexcept {
+    return status_;
+  }
+};
+
+// A timer event set to fire shortly, so run blocks in wait_for_events
+auto timer(BootServices* bs) -> Event {
+  auto event = Event{};
+  CHECK_SUCCESS(bs->create_event(EventType::Timer, TplCallback, nullptr,
+                                 nullptr, &event));
+  CHECK_SUCCESS(bs->set_timer(event, TimerDelay::Relative, short_delay));
+  return event;
+}
+
+auto child(Executor* executor, Event event) -> Task<int> {
+  co_await executor->wait(event);
+  co_return 42;
+}
+
+auto parent(Executor* executor, Event event, int* result) -> Task<> {
+  auto task = child(executor, event);
+  *result   = co_await task;
+}
+
+auto wait_token(Executor* executor, const Token* token, Status* result)
+    -> Task<> {
+  *result = co_await executor->wait(*token);
+}
+
+auto wait_event(Executor* executor, Event event, Status* result) -> Task<> {
+  *result = co_await executor->wait(event);
+}
+
+void test_child(BootServices* bs) {
+  auto executor = Executor{bs};
+  auto event    = timer(bs);
+
+  auto result = 0;
+  auto task   = parent(&executor, event, &result);
+  CHECK(task.valid() && !task.done());
+  CHECK_SUCCESS(executor.spawn(task));
+  CHECK_SUCCESS(executor.run());
+
+  CHECK(task.done());
+  CHECK(result == 42);
+  CHECK(executor.spawn(task) == Status::InvalidParameter);
+
+  // The child's wait is counted towards its parent, the root is resumed
+  // once to start and once woken
+  CHECK(task.stats().waits == 1);
+  CHECK(executor.stats().wakeups == 1);
+  CHECK(executor.stats().resumes == 2);
+  CHECK(executor.stats().peak_waiting == 1);
+  CHECK(executor.waiting() == 0);
+
+  CHECK_SUCCESS(bs->close_event(event));
+}
+
+void test_token(BootServices* bs) {
+  auto executor = Executor{bs};
+  auto token    = Token{timer(bs), Status::Aborted};
+
+  auto result = Status::Success;
+  auto task   = wait_token(&executor, &token, &result);
+  CHECK_SUCCESS(executor.spawn(task));
+  CHECK_SUCCESS(executor.run());
+
+  CHECK(result == Status::Aborted);
+  CHECK(task.stats().waits == 1);
+
+  CHECK_SUCCESS(bs->close_event(token.event_));
+}
+
+// A second waiter on an event is turned away instead of never waking
+void test_duplicate_wait(BootServices* bs) {
+  auto executor = Executor{bs};
+  auto event    = timer(bs);
+
+  auto first_result  = Status::NotReady;
+  auto second_result = Status::NotReady;
+  auto first         = wait_event(&executor, event, &first_result);
+  auto second        = wait_event(&executor, event, &second_result);
+  CHECK_SUCCESS(executor.spawn(first));
+  CHECK_SUCCESS(executor.spawn(second));
+  CHECK_SUCCESS(executor.run());
+
+  CHECK(first_result == Status::Success);
+  CHECK(second_result == Status::AccessDenied);
+  CHECK(first.stats().waits == 1);
+  CHECK(second.stats().waits == 0);
+
+  CHECK_SUCCESS(bs->close_event(event));
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto  fw = mock::Firmware{};
+  auto* bs = fw.boot_services();
+
+  test_child(bs);
+  test_token(bs);
+  test_duplicate_wait(bs);
+
+  return test::check_result();
+}
@@ -0,0 +1,113 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include "check.hpp"
+#include "efi/mock/firmware.hpp"
+#include "efi/token_wait.hpp"
+
+using namespace efi;
+
+namespace {
+
+// 100us in 100ns units
+constexpr auto short_timeout = uint64_t{1'000};
+
+struct Token {
+  Event  event_  = nullptr;
+  Status status_ = Status::NotReady;
+
+  NODISCARD auto event() const noexcept {
+    return event_;
+  }
+
+  NODISCARD auto status() const noexcept {
+    return status_;
+  }
+};
+
+BootServices* boot_services = nullptr;
+
+// Cancellers for the ways a protocol may answer
+auto cancel_not_found(Token* /*token*/) noexcept -> Status {
+  return Status::NotFound;
+}
+
+auto stop_without_signal(Token* /*token*/) noexcept -> Status {
+  return Status::Success;
+}
+
+auto cancel_and_signal(Token* token) noexcept -> Status {
+  token->status_ = Status::Aborted;
+  return boot_services->signal_event(token->event_);
+}
+
+void test_completed(BootServices* bs, Token* token) {
+  auto waiter = TokenWaiter{bs};
+
+  token->status_ = Status::Success;
+  CHECK_SUCCESS(bs->signal_event(token->event_));
+  CHECK_SUCCESS(waiter.wait_for(token, short_timeout, &cancel_not_found));
+  CHECK(waiter.stats().completed == 1);
+}
+
+// A cancel that finds nothing to cancel must not wait for the event
+void test_not_found(BootServices* bs, Token* token) {
+  auto waiter = TokenWaiter{bs};
+
+  CHECK(waiter.wait_for(token, short_timeout, &cancel_not_found) ==
+        Status::Timeout);
+  CHECK(waiter.stats().timeouts == 1);
+  CHECK(waiter.stats().undrained == 0);
+}
+
+// A stop that never signals the token is given up on after drain_timeout
+void test_undrained(BootServices* bs, Token* token) {
+  auto waiter = TokenWaiter{bs};
+
+  auto tokens = std::array<Token*, 2>{token, token};
+  auto index  = uintn_t{0};
+  CHECK(waiter.wait_any(tokens.data(), tokens.size(), short_timeout,
+                        &stop_without_signal, &index) == Status::Timeout);
+  CHECK(waiter.stats().undrained == 2);
+}
+
+void test_drained(BootServices* bs, Token* token) {
+  auto waiter = TokenWaiter{bs};
+
+  CHECK(waiter.wait_for(token, short_timeout, &cancel_and_signal) ==
+        Status::Timeout);
+  CHECK(waiter.stats().undrained == 0);
+  CHECK(token->status() == Status::Aborted);
+  CHECK(bs->check_event(token->event_) == Status::NotReady);
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto fw       = mock::Firmware{};
+  boot_services = fw.boot_services();
+
+  auto token = Token{};
+  CHECK_SUCCESS(boot_services->create_event(EventType{0}, TplCallback, nullptr,
+                                            nullptr, &token.event_));
+
+  test_completed(boot_services, &token);
+  test_not_found(boot_services, &token);
+  test_undrained(boot_services, &token);
+  test_drained(boot_services, &token);
+
+  CHECK_SUCCESS(boot_services->close_event(token.event_));
+  return test::check_result();
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <string>
+
+#include "check.hpp"
+#include "efi/mock/firmware.hpp"
+#include "efi/trace.hpp"
+
+using namespace efi;
+
+namespace {
+
+auto collect_line(const char* line, uintn_t length, void* context) noexcept
+    -> Status {
+  static_cast<std::string*>(context)->append(line, length);
+  return Status::Success;
+}
+
+void test_install(SystemTable* system_table) {
+  auto* bs = system_table->boot_services();
+
+  CHECK_SUCCESS(Tracer::install(system_table));
+  CHECK_SUCCESS(verify_tables(system_table));
+  CHECK(Tracer::install(system_table) == Status::AlreadyStarted);
+  CHECK(Tracer::install(bs) == Status::AlreadyStarted);
+
+  // Calls go through the shims
+  auto* buffer = static_cast<void*>(nullptr);
+  CHECK_SUCCESS(bs->allocate_pool(MemoryType::LoaderData, 100, &buffer));
+  CHECK_SUCCESS(bs->free_pool(buffer));
+
+  const auto* allocate = Tracer::find("allocate_pool");
+  CHECK(allocate != nullptr);
+  CHECK(allocate->calls == 1);
+  CHECK(allocate->bytes == 100);
+  CHECK(Tracer::find("free_pool")->calls == 1);
+  CHECK(Tracer::find("get_time")->calls == 0);
+  CHECK(Tracer::find("no_such_service") == nullptr);
+
+  // Only called services are listed, after the header and before the total
+  auto text = std::string{};
+  CHECK_SUCCESS(Tracer::dump(&collect_line, &text));
+  CHECK(text.starts_with("service"));
+  CHECK(text.find("allocate_pool") != std::string::npos);
+  CHECK(text.find("free_pool") != std::string::npos);
+  CHECK(text.find("get_time") == std::string::npos);
+  CHECK(text.find("total") != std::string::npos);
+
+  CHECK_SUCCESS(Tracer::uninstall(system_table));
+  CHECK_SUCCESS(verify_tables(system_table));
+  CHECK(Tracer::uninstall(system_table) == Status::NotStarted);
+
+  // Records are kept but no longer updated
+  CHECK_SUCCESS(bs->allocate_pool(MemoryType::LoaderData, 100, &buffer));
+  CHECK_SUCCESS(bs->free_pool(buffer));
+  CHECK(allocate->calls == 1);
+}
+
+// A failed runtime services install leaves boot services unpatched
+void test_partial_install(SystemTable* system_table) {
+  auto* runtime = system_table->runtime_services();
+
+  CHECK_SUCCESS(Tracer::install(runtime));
+  CHECK(Tracer::install(system_table) == Status::AlreadyStarted);
+  CHECK(Tracer::uninstall(system_table->boot_services()) ==
+        Status::NotStarted);
+  CHECK_SUCCESS(verify_tables(system_table));
+
+  CHECK_SUCCESS(Tracer::uninstall(runtime));
+  CHECK_SUCCESS(verify_tables(system_table));
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto fw = mock::Firmware{};
+
+  test_install(fw.system_table());
+  test_partial_install(fw.system_table());
+
+  return test::check_result();
+}
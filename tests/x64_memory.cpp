@@ -0,0 +1,161 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <vector>
+
+#include "check.hpp"
+#include "efi/platform/x64_memory.hpp"
+
+using namespace efi;
+
+namespace {
+
+constexpr auto max_size  = uintn_t{1200};
+constexpr auto alignment = uintn_t{64};
+
+// Room for the largest copy at any misalignment, with guard bytes after it
+constexpr auto buffer_size = max_size + 2 * alignment;
+
+// Sizes around the 16 and 32 byte vector widths and the unrolled loops,
+// tried at every pair of misalignments
+constexpr uintn_t edge_sizes[] = {1,   15,  16,  17,  31,  32,  33,  63,  64,
+                                  65,  127, 128, 129, 255, 256, 257, 1000};
+
+struct Kernels {
+  const char*           name;
+  MemoryKernels::CopyFn copy;
+  MemoryKernels::SetFn  set;
+};
+
+auto kernels() -> std::vector<Kernels> {
+  auto list = std::vector<Kernels>{
+      {"rep", &MemoryKernels::copy_rep_movsb, &MemoryKernels::set_rep_stosb},
+      {"sse2", &MemoryKernels::copy_sse2, &MemoryKernels::set_sse2},
+  };
+  if (MemoryKernels::detect() == MemoryKernel::Avx2) {
+    list.push_back(
+        {"avx2", &MemoryKernels::copy_avx2, &MemoryKernels::set_avx2});
+  }
+  return list;
+}
+
+// 64 byte aligned so offsets are the misalignment
+struct alignas(alignment) Buffer {
+  uint8_t bytes[buffer_size];
+};
+
+class Checker final {
+ private:
+  Buffer source_{};
+  Buffer destination_{};
+  Buffer expected_{};
+
+ public:
+  Checker() noexcept {
+    for (auto i = uintn_t{0}; i < buffer_size; ++i) {
+      source_.bytes[i] = static_cast<uint8_t>(i * 7 + 1);
+    }
+  }
+
+  // Bytes outside the copied range must be left alone
+  auto copy(MemoryKernels::CopyFn kernel, uintn_t from, uintn_t to,
+            uintn_t size) noexcept -> bool {
+    reset();
+    kernel(destination_.bytes + to, source_.bytes + from, size);
+    std::memcpy(expected_.bytes + to, source_.bytes + from, size);
+    return std::memcmp(destination_.bytes, expected_.bytes, buffer_size) == 0;
+  }
+
+  auto set(MemoryKernels::SetFn kernel, uintn_t to, uintn_t size) noexcept
+      -> bool {
+    reset();
+    const auto value = static_cast<uint8_t>(size + 0x5a);
+    kernel(destination_.bytes + to, value, size);
+    std::memset(expected_.bytes + to, value, size);
+    return std::memcmp(destination_.bytes, expected_.bytes, buffer_size) == 0;
+  }
+
+ private:
+  void reset() noexcept {
+    std::memset(destination_.bytes, 0xee, buffer_size);
+    std::memset(expected_.bytes, 0xee, buffer_size);
+  }
+};
+
+void test_kernel(Checker* checker, const Kernels& kernel) {
+  auto copies = true;
+  auto sets   = true;
+
+  // Every size with every source and every destination misalignment
+  for (auto size = uintn_t{0}; size <= max_size; ++size) {
+    for (auto from = uintn_t{0}; from < alignment; ++from) {
+      const auto to = (from * 7 + size) % alignment;
+      copies        = copies && checker->copy(kernel.copy, from, to, size);
+      sets          = sets && checker->set(kernel.set, from, size);
+    }
+  }
+
+  for (const auto size : edge_sizes) {
+    for (auto from = uintn_t{0}; from < alignment; ++from) {
+      for (auto to = uintn_t{0}; to < alignment; ++to) {
+        copies = copies && checker->copy(kernel.copy, from, to, size);
+      }
+    }
+  }
+
+  if (!copies || !sets) {
+    std::fprintf(stderr, "%s kernel failed\n", kernel.name);
+  }
+  CHECK(copies);
+  CHECK(sets);
+}
+
+// Above non_temporal_threshold the vector kernels use streaming stores
+void test_streaming(const Kernels& kernel) {
+  constexpr auto size = MemoryKernels::non_temporal_threshold + 77;
+
+  auto source      = std::vector<uint8_t>(size + alignment);
+  auto destination = std::vector<uint8_t>(size + alignment, 0xee);
+  for (auto i = uintn_t{0}; i < source.size(); ++i) {
+    source[i] = static_cast<uint8_t>(i * 13 + i / 4096);
+  }
+
+  kernel.copy(destination.data() + 3, source.data() + 5, size);
+  CHECK(std::memcmp(destination.data() + 3, source.data() + 5, size) == 0);
+  CHECK(destination[2] == 0xee && destination[size + 3] == 0xee);
+
+  std::memset(destination.data(), 0xee, destination.size());
+  kernel.set(destination.data() + 9, 0x42, size);
+  auto filled = true;
+  for (auto i = uintn_t{0}; i < size; ++i) {
+    filled = filled && destination[i + 9] == 0x42;
+  }
+  CHECK(filled);
+  CHECK(destination[8] == 0xee && destination[size + 9] == 0xee);
+}
+
+}  // namespace
+
+auto main() -> int {
+  static auto checker = Checker{};
+
+  for (const auto& kernel : kernels()) {
+    test_kernel(&checker, kernel);
+    test_streaming(kernel);
+  }
+
+  return test::check_result();
+}
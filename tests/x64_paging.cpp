@@ -0,0 +1,147 @@
+// Copyright (c) 2023 Jacob R. Green
+//
+// This file is part of MuchCool-EFI.
+//
+// MuchCool-EFI is free software: you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later version.
+//
+// MuchCool-EFI is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// MuchCool-EFI. If not, see <https://www.gnu.org/licenses/>.
+
+#include <vector>
+
+#include "check.hpp"
+#include "efi/mock/firmware.hpp"
+#include "efi/platform/x64_paging.hpp"
+
+using namespace efi;
+
+namespace {
+
+constexpr auto gib = uint64_t{1} << 30;
+constexpr auto mib = uint64_t{1} << 20;
+
+auto has(PageFlags flags, PageFlags flag) -> bool {
+  return (flags & flag) == flag;
+}
+
+// Tables live in mock pages, translate walks them like the MMU would
+void test_large_pages(BootServices* bs) {
+  auto builder = PageTableBuilder{bs};
+  CHECK_SUCCESS(builder.map(4 * gib, 8 * gib, 2 * gib,
+                            PageFlags::Writable | PageFlags::NoExecute));
+  CHECK(builder.stats().pages_1g == 2);
+  CHECK(builder.stats().pages_2m == 0);
+  CHECK(builder.stats().pages_4k == 0);
+
+  auto physical = PhysicalAddress{0};
+  auto flags    = PageFlags::None;
+  CHECK_SUCCESS(builder.translate(4 * gib + 0x1234, &physical, &flags));
+  CHECK(physical == 8 * gib + 0x1234);
+  CHECK(has(flags, PageFlags::Present | PageFlags::Writable |
+                       PageFlags::NoExecute | PageFlags::PageSize));
+
+  CHECK_SUCCESS(builder.translate(6 * gib - page_size, &physical));
+  CHECK(physical == 10 * gib - page_size);
+  CHECK(builder.translate(6 * gib, &physical) == Status::NotFound);
+  CHECK(builder.translate(0, &physical) == Status::NotFound);
+}
+
+void test_mixed_alignment(BootServices* bs) {
+  auto builder = PageTableBuilder{bs, false};
+
+  // 4KiB head up to the 2MiB boundary, 2MiB body, 4KiB tail
+  const auto virtual_start = 2 * mib - 3 * page_size;
+  const auto size          = 3 * page_size + 4 * mib + 2 * page_size;
+  CHECK_SUCCESS(builder.map(virtual_start, virtual_start + gib, size,
+                            PageFlags::Writable));
+  CHECK(builder.stats().pages_4k == 5);
+  CHECK(builder.stats().pages_2m == 2);
+
+  for (auto offset = uint64_t{0}; offset < size; offset += page_size) {
+    auto physical = PhysicalAddress{0};
+    CHECK_SUCCESS(builder.translate(virtual_start + offset, &physical));
+    CHECK(physical == virtual_start + gib + offset);
+  }
+
+  // Without 1GiB support a gigabyte takes 512 large pages
+  CHECK_SUCCESS(builder.map(4 * gib, 4 * gib, gib, PageFlags::None));
+  CHECK(builder.stats().pages_1g == 0);
+  CHECK(builder.stats().pages_2m == 2 + 512);
+}
+
+void test_split(BootServices* bs) {
+  auto builder = PageTableBuilder{bs};
+  CHECK_SUCCESS(builder.map(0, 0, gib, PageFlags::Writable));
+
+  // Remapping one page inside the 1GiB page breaks it down to 4KiB
+  CHECK_SUCCESS(
+      builder.map(3 * mib, 5 * gib, page_size, PageFlags::NoExecute));
+  CHECK(builder.stats().splits == 2);
+
+  auto physical = PhysicalAddress{0};
+  auto flags    = PageFlags::None;
+  CHECK_SUCCESS(builder.translate(3 * mib + 0x10, &physical, &flags));
+  CHECK(physical == 5 * gib + 0x10);
+  CHECK(has(flags, PageFlags::NoExecute));
+  CHECK(!has(flags, PageFlags::PageSize));
+
+  // Neighbours keep the original mapping and flags
+  CHECK_SUCCESS(builder.translate(3 * mib + page_size, &physical, &flags));
+  CHECK(physical == 3 * mib + page_size);
+  CHECK(has(flags, PageFlags::Writable));
+  CHECK_SUCCESS(builder.translate(gib - page_size, &physical));
+  CHECK(physical == gib - page_size);
+}
+
+void test_memory_map(BootServices* bs) {
+  auto map_size        = uintn_t{0};
+  auto map_key         = uintn_t{0};
+  auto descriptor_size = uintn_t{0};
+  auto version         = uint32_t{0};
+  bs->get_memory_map(&map_size, nullptr, &map_key, &descriptor_size,
+                     &version);
+
+  // Room for the descriptors added by the table allocations
+  auto buffer = std::vector<uint8_t>(map_size + 8 * descriptor_size);
+  map_size    = buffer.size();
+  auto* map   = reinterpret_cast<MemoryDescriptor*>(buffer.data());
+  CHECK_SUCCESS(bs->get_memory_map(&map_size, map, &map_key,
+                                   &descriptor_size, &version));
+  const auto view = MemoryMapView{map, map_size, descriptor_size};
+
+  constexpr auto offset = VirtualAddress{0xffff'8000'0000'0000};
+
+  auto builder = PageTableBuilder{bs};
+  CHECK_SUCCESS(builder.map_memory_map(view, offset, PageFlags::Writable));
+
+  for (const auto& descriptor : view) {
+    auto physical = PhysicalAddress{0};
+    CHECK_SUCCESS(
+        builder.translate(descriptor.physical_start() + offset, &physical));
+    CHECK(physical == descriptor.physical_start());
+
+    const auto last = descriptor.physical_end() - page_size;
+    CHECK_SUCCESS(builder.translate(last + offset, &physical));
+    CHECK(physical == last);
+  }
+}
+
+}  // namespace
+
+auto main() -> int {
+  auto  fw = mock::Firmware{};
+  auto* bs = fw.boot_services();
+
+  test_large_pages(bs);
+  test_mixed_alignment(bs);
+  test_split(bs);
+  test_memory_map(bs);
+
+  return test::check_result();
+}